@@ -24,11 +24,15 @@
 #include <Python.h>
 #include <string.h>
 #include <gtk/gtk.h>
-#include <gdk/gdkkeysyms.h>
 #include <geanyplugin.h>
+#include <glib/gstdio.h>
 
+#include "zen-actions.h"
 #include "zen-controller.h"
+#include "zen-matcher.h"
+#include "zen-tag-index.h"
 #include "zen-editor.h"
+#include "zen-profiles.h"
 
 
 GeanyPlugin		*geany_plugin;
@@ -43,6 +47,10 @@ GeanyFunctions	*geany_functions;
 #define ZEN_PROFILES_PATH "/usr/local/share/geany/zencoding/profiles"
 #endif
 
+#ifndef ZEN_ACTIONS_FILE
+#define ZEN_ACTIONS_FILE "/usr/local/share/geany/zencoding/actions.conf"
+#endif
+
 #ifndef ZEN_ICONS_PATH
 #define ZEN_ICONS_PATH "/usr/local/share/geany/zencoding/icons"
 #endif
@@ -69,118 +77,62 @@ static struct ZenCodingPlugin
 	GFile*			settings_file;
 	const gchar*	active_profile;
 	ZenController*	zen_controller;
+	gboolean		zen_load_failed;
+	GPtrArray*		profiles;		/* ZenProfile from ZEN_PROFILES_PATH */
+	GPtrArray*		actions;		/* ZenAction from ZEN_ACTIONS_FILE, by id */
 }
 plugin;
 
 
-enum
+static ZenController *get_zen_controller(void);
+
+
+static void run_action(guint id)
 {
-	ACTION_EXPAND_ABBR,
-	ACTION_EXPAND_ABBR_TAB,
-	ACTION_MATCH_IN,
-	ACTION_MATCH_OUT,
-	ACTION_WRAP_ABBR,
-	ACTION_PREV_POINT,
-	ACTION_NEXT_POINT,
-	ACTION_INSERT_FORMAT_NEWLINE,
-	ACTION_SELECT_LINE,
-	ACTION_GO_TO_MATCHING_PAIR,
-	ACTION_MERGE_LINES,
-	ACTION_TOGGLE_COMMENTS,
-	ACTION_SPLIT_JOIN_TAG,
-	ACTION_REMOVE_TAG,
-	/*ACTION_ENCODE_DECODE_BASE64,*/
-	ACTION_INCREMENT_NUMBER_BY_1,
-	ACTION_INCREMENT_NUMBER_BY_10,
-	ACTION_INCREMENT_NUMBER_BY_01,
-	ACTION_DECREMENT_NUMBER_BY_1,
-	ACTION_DECREMENT_NUMBER_BY_10,
-	ACTION_DECREMENT_NUMBER_BY_01,
-	ACTION_EVALUATE_MATH_EXPRESSION,
-	ACTION_LAST
-};
+	ZenController *zen;
 
+	g_return_if_fail(id < plugin.actions->len);
 
-typedef struct _ZenCodingAction ZenCodingAction;
+	if ((zen = get_zen_controller()) == NULL)
+		return;
 
-static struct _ZenCodingAction
-{
-	const gchar *name;
-	const gchar *blurb;
-	guint key;
-	GdkModifierType mod;
+	zen_controller_run_action(zen, id);
 }
-actions[ACTION_LAST] = {
-
-	{ "expand_abbreviation", _("Expand Abbreviation"), GDK_e, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "expand_abbreviation_with_tab", _("Expand Abbreviation with Tab"), GDK_T, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "match_pair_inward", _("Match Tag Inward"), GDK_L, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "match_pair_outward", _("Match Tag Outward"), GDK_R, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "wrap_with_abbreviation", _("Wrap with Abbreviation"), GDK_q, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "prev_edit_point", _("Previous Edit Point"), GDK_p, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "next_edit_point", _("Next Edit Point"), GDK_n, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "insert_formatted_newline", _("Insert Formatted Newline"), GDK_l, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "select_line", _("Select Line"), GDK_s, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "go_to_matching_pair", _("Go to Matching Pair"), GDK_m, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "merge_lines", _("Merge Lines"), GDK_b, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "toggle_comment", _("Toggle Comment"), GDK_c, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "split_join_tag", _("Split or Join Tag"), GDK_j, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	{ "remove_tag", _("Remove Tag"), GDK_r, GDK_SHIFT_MASK | GDK_CONTROL_MASK },
-	/*{ "encode_decode_base64", _("Encode/Decode to/from Base64"), GDK_6, GDK_SHIFT_MASK | GDK_CONTROL_MASK },*/
-	{ "increment_number_by_1", _("Increment Number by 1"), 0, 0 },
-	{ "increment_number_by_10", _("Increment Number by 10"), 0, 0 },
-	{ "increment_number_by_01", _("Increment Number by 0.1"), 0, 0 },
-	{ "decrement_number_by_1", _("Decrement Number by 1"), 0, 0 },
-	{ "decrement_number_by_10", _("Decrement Number by 10"), 0, 0 },
-	{ "decrement_number_by_01", _("Decrement Number by 0.1"), 0, 0 },
-	{ "evaluate_math_expression", _("Evaluate Math Expression"), 0, 0 }
-
-};
 
 
 static void action_activate(guint key_id)
 {
-	ZenCodingAction action;
-
-	g_return_if_fail(key_id >= 0 && key_id < ACTION_LAST);
-
-	action = actions[key_id];
-	zen_controller_run_action(plugin.zen_controller, action.name);
-	ui_set_statusbar(FALSE, "Zen Coding: Running '%s' action", action.blurb);
+	run_action(key_id);
 }
 
 
 static void on_action_item_activate(GObject *object, gpointer id_ptr)
 {
-	gint id = GPOINTER_TO_INT(id_ptr);
-	ZenCodingAction action;
-
-	g_return_if_fail(id >= 0 && id < ACTION_LAST);
-
-	action = actions[id];
-	zen_controller_run_action(plugin.zen_controller, action.name);
-	ui_set_statusbar(FALSE, "Zen Coding: Running '%s' action", action.blurb);
+	run_action(GPOINTER_TO_UINT(id_ptr));
 }
 
 
 static void initialize_actions(GtkMenu *menu)
 {
-	gint i;
+	guint i;
 	GeanyKeyGroup *group;
-	ZenCodingAction action;
+	ZenAction *action;
 	GtkWidget *item;
 
-	group = plugin_set_key_group(geany_plugin, "zencoding", ACTION_LAST, NULL);
+	if (plugin.actions->len == 0)
+		return;
 
-	for (i = 0; i < ACTION_LAST; i++)
+	group = plugin_set_key_group(geany_plugin, "zencoding", plugin.actions->len, NULL);
+
+	for (i = 0; i < plugin.actions->len; i++)
 	{
-		action = actions[i];
+		action = g_ptr_array_index(plugin.actions, i);
 
-		item = gtk_menu_item_new_with_label(action.blurb);
+		item = gtk_menu_item_new_with_label(action->label);
 		g_signal_connect(item, "activate", G_CALLBACK(on_action_item_activate),
-			GINT_TO_POINTER(i));
-		keybindings_set_item(group, i, action_activate, action.key, action.mod,
-			action.name, action.blurb, item);
+			GUINT_TO_POINTER(i));
+		keybindings_set_item(group, i, action_activate, action->key, action->mods,
+			action->name, action->label, item);
 		gtk_menu_append(menu, item);
 		gtk_widget_show(item);
 	}
@@ -190,11 +142,58 @@ static void initialize_actions(GtkMenu *menu)
 static void init_config(struct ZenCodingPlugin *plugin);
 
 
+static gboolean on_editor_notify(GObject *object, GeanyEditor *editor,
+	SCNotification *nt, gpointer user_data)
+{
+	zen_editor_notify(editor->document, nt);
+
+	if (nt->nmhdr.code == SCN_MODIFIED &&
+		(nt->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)))
+	{
+		zen_editor_content_changed();
+		zen_tag_index_notify(editor->document, nt);
+		if (plugin.zen_controller != NULL)
+			zen_controller_document_changed(plugin.zen_controller, editor->document);
+	}
+
+	return FALSE;
+}
+
+
+static void on_document_close(GObject *object, GeanyDocument *doc,
+	gpointer user_data)
+{
+	zen_tag_index_remove(doc);
+	zen_editor_forget_document(doc);
+	if (plugin.zen_controller != NULL)
+		zen_controller_document_closed(plugin.zen_controller, doc);
+}
+
+
+static void on_document_filetype_set(GObject *object, GeanyDocument *doc,
+	GeanyFiletype *filetype_old, gpointer user_data)
+{
+	zen_editor_forget_document(doc);
+}
+
+
+PluginCallback plugin_callbacks[] =
+{
+	{ "editor-notify", (GCallback) &on_editor_notify, FALSE, NULL },
+	{ "document-close", (GCallback) &on_document_close, FALSE, NULL },
+	{ "document-filetype-set", (GCallback) &on_document_filetype_set, FALSE, NULL },
+	{ NULL, NULL, FALSE, NULL }
+};
+
+
 static void on_profile_toggled(GtkCheckMenuItem *item, const gchar *profile_name)
 {
 	if (gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(item)))
 	{
-		zen_controller_set_active_profile(plugin.zen_controller, profile_name);
+		/* Applied when Zen Coding is loaded if it isn't yet */
+		plugin.active_profile = profile_name;
+		if (plugin.zen_controller != NULL)
+			zen_controller_set_active_profile(plugin.zen_controller, profile_name);
 		ui_set_statusbar(TRUE, _("Zen Coding: Selected profile '%s'"),
 			gtk_menu_item_get_label(GTK_MENU_ITEM(item)));
 	}
@@ -218,10 +217,9 @@ static void build_zc_menu(struct ZenCodingPlugin *plugin)
 {
 	GtkWidget *img;
 	GtkWidget *item, *menu, *pmenu;
-	GDir *dir;
 	GSList *group = NULL;
-	const gchar *ent;
-	gchar *name;
+	ZenProfile *profile;
+	guint i;
 
 	menu = gtk_menu_new();
 
@@ -282,31 +280,17 @@ static void build_zc_menu(struct ZenCodingPlugin *plugin)
 	gtk_menu_append(GTK_MENU(pmenu), item);
 	g_signal_connect(item, "toggled", G_CALLBACK(on_profile_toggled), "xml");
 
-#if 0
-	dir = g_dir_open(ZEN_PROFILES_PATH, 0, NULL);
-	if (dir != NULL)
+	/* Profiles from ZEN_PROFILES_PATH, set up once Zen Coding is loaded */
+	for (i = 0; i < plugin->profiles->len; i++)
 	{
-
-		while ((ent = g_dir_read_name(dir)) != NULL)
-		{
-			/* TODO: add error handling */
-			gchar *p = g_build_filename(ZEN_PROFILES_PATH, ent, NULL);
-			GKeyFile *kf = g_key_file_new();
-			g_key_file_load_from_file(kf, p, G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS, NULL);
-			if (g_key_file_has_group(kf, "profile") && g_key_file_has_key(kf, "profile", "name", NULL))
-			{
-				name = g_key_file_get_string(kf, "profile", "name", NULL);
-				item = gtk_radio_menu_item_new_with_label(group, name);
-				g_object_set_data_full(G_OBJECT(item), "profile_name", name, g_free);
-				group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
-				gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), FALSE);
-				gtk_menu_append(GTK_MENU(pmenu), item);
-				g_signal_connect(item, "toggled", G_CALLBACK(on_profile_toggled), name);
-			}
-		}
-		g_dir_close(dir);
+		profile = g_ptr_array_index(plugin->profiles, i);
+		item = gtk_radio_menu_item_new_with_label(group, profile->label);
+		g_object_set_data(G_OBJECT(item), "profile_name", profile->name);
+		group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), FALSE);
+		gtk_menu_append(GTK_MENU(pmenu), item);
+		g_signal_connect(item, "toggled", G_CALLBACK(on_profile_toggled), profile->name);
 	}
-#endif
 
 	item = gtk_image_menu_item_new_with_label(_("Open Zen Coding Settings File"));
 	img = gtk_image_new_from_stock(GTK_STOCK_PREFERENCES, GTK_ICON_SIZE_MENU);
@@ -349,10 +333,9 @@ static void on_monitor_changed(GFileMonitor *monitor, GFile *file,
 {
 	if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
 	{
-		reload_zen_coding_notice(
-				"The Zen Coding settings file has changed, you need to "
-				"reload the Zen Coding plugin or restart Geany for the "
-				"settings to take effect.");
+		/* Not loaded yet, the first action will read the new settings */
+		if (plugin->zen_controller != NULL)
+			zen_controller_reload_settings(plugin->zen_controller);
 	}
 	else if (event_type == G_FILE_MONITOR_EVENT_DELETED ||
 		event_type == G_FILE_MONITOR_EVENT_MOVED)
@@ -365,86 +348,164 @@ static void on_monitor_changed(GFileMonitor *monitor, GFile *file,
 }
 
 
-static gboolean copy_file(const gchar *src, const gchar *dst)
+#define MANIFEST_GROUP "files"
+
+
+/* Returns "size:mtime" for fn, or NULL if it can't be stat'ed */
+static gchar *file_stamp(const gchar *fn)
 {
-	gboolean result = TRUE;
-	gint ch;
-	FILE *fpsrc, *fpdst;
+	struct stat st;
 
-	fpsrc = fopen(src, "rb");
-	if (fpsrc == NULL)
-		return FALSE;
+	if (g_stat(fn, &st) != 0)
+		return NULL;
 
-	fpdst = fopen(dst, "wb");
-	if (fpdst == NULL)
-		return FALSE;
+	return g_strdup_printf("%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+		(gint64) st.st_size, (gint64) st.st_mtime);
+}
+
+
+/* Copies src to dst, keeping its modification time */
+static gboolean copy_file(const gchar *src, const gchar *dst)
+{
+	GFile *src_file, *dst_file;
+	GError *error = NULL;
+	gboolean result;
+
+	src_file = g_file_new_for_path(src);
+	dst_file = g_file_new_for_path(dst);
 
-	while (!feof(fpsrc))
+	result = g_file_copy(src_file, dst_file,
+				G_FILE_COPY_OVERWRITE | G_FILE_COPY_ALL_METADATA,
+				NULL, NULL, NULL, &error);
+	if (!result)
 	{
-		ch = getc(fpsrc);
-		if (ferror(fpsrc))
-		{
-			result = FALSE;
-			break;
-		}
-		else
-		{
-			if (!feof(fpsrc))
-				putc(ch, fpdst);
-			if (ferror(fpdst))
-			{
-				result = FALSE;
-				break;
-			}
-		}
+		g_warning("An error occurred copying file '%s' to '%s': %s",
+			src, dst, error->message);
+		g_error_free(error);
 	}
 
-	fclose(fpsrc);
-	fclose(fpdst);
+	g_object_unref(src_file);
+	g_object_unref(dst_file);
 
 	return result;
 }
 
 
-static void recursively_copy(const char *src, const char *dst)
+/*
+ * Copies the Python sources and precompiled files under src to dst,
+ * except those whose size and modification time match what the manifest
+ * recorded for them when they were last copied.  Files the user or
+ * Python changed in dst are left alone until the installed ones change.
+ * The relative paths of the files found are added to seen.  Returns
+ * whether the manifest changed.
+ */
+static gboolean sync_tree(const gchar *src, const gchar *dst,
+	const gchar *prefix, GKeyFile *manifest, GHashTable *seen)
 {
 	GDir *dir;
-
-	char *src_fn, *dst_fn;
-	const char *ent;
+	gboolean changed = FALSE;
+	gchar *src_fn, *dst_fn, *key, *stamp, *old_stamp;
+	const gchar *ent;
 
 	dir = g_dir_open(src, 0, NULL);
+	if (dir == NULL)
+		return FALSE;
 
 	while ((ent = g_dir_read_name(dir)) != NULL)
 	{
-		if (g_str_equal(ent, ".") || g_str_equal(ent, ".."))
-			continue;
-
 		src_fn = g_build_filename(src, ent, NULL);
 		dst_fn = g_build_filename(dst, ent, NULL);
+		key = (prefix != NULL) ? g_strconcat(prefix, "/", ent, NULL) : g_strdup(ent);
 
 		if (g_file_test(src_fn, G_FILE_TEST_IS_DIR))
 		{
 			if (!g_file_test(dst_fn, G_FILE_TEST_IS_DIR))
 				g_mkdir_with_parents(dst_fn, 0700);
-			recursively_copy(src_fn, dst_fn);
+			if (sync_tree(src_fn, dst_fn, key, manifest, seen))
+				changed = TRUE;
 		}
 		else if (g_file_test(src_fn, G_FILE_TEST_IS_REGULAR) &&
-					g_str_has_suffix(src_fn, ".py"))
+					(g_str_has_suffix(ent, ".py") || g_str_has_suffix(ent, ".pyc")))
 		{
-			if (!copy_file(src_fn, dst_fn))
-				g_warning("An error occurred copy file '%s' to '%s'.", src_fn, dst_fn);
+			g_hash_table_insert(seen, g_strdup(key), NULL);
+
+			stamp = file_stamp(src_fn);
+			old_stamp = g_key_file_get_string(manifest, MANIFEST_GROUP, key, NULL);
+
+			if (stamp != NULL && (old_stamp == NULL || !g_str_equal(stamp, old_stamp) ||
+					!g_file_test(dst_fn, G_FILE_TEST_EXISTS)))
+			{
+				if (copy_file(src_fn, dst_fn))
+				{
+					g_key_file_set_string(manifest, MANIFEST_GROUP, key, stamp);
+					changed = TRUE;
+				}
+			}
+
+			g_free(stamp);
+			g_free(old_stamp);
 		}
 
 		g_free(src_fn);
 		g_free(dst_fn);
+		g_free(key);
 	}
+
+	g_dir_close(dir);
+
+	return changed;
+}
+
+
+/*
+ * Brings the copy of the Zen Coding package in dst up to date with the
+ * installed one in src.  Files that were removed from src since the last
+ * sync are removed from dst too.
+ */
+static void sync_zencoding(const gchar *src, const gchar *dst, const gchar *manifest_fn)
+{
+	GKeyFile *manifest;
+	GHashTable *seen;
+	gboolean changed;
+	gchar **keys, *fn, *data;
+	gsize i, len;
+
+	manifest = g_key_file_new();
+	g_key_file_load_from_file(manifest, manifest_fn, G_KEY_FILE_NONE, NULL);
+
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	changed = sync_tree(src, dst, NULL, manifest, seen);
+
+	keys = g_key_file_get_keys(manifest, MANIFEST_GROUP, NULL, NULL);
+	for (i = 0; keys != NULL && keys[i] != NULL; i++)
+	{
+		if (!g_hash_table_lookup_extended(seen, keys[i], NULL, NULL))
+		{
+			fn = g_build_filename(dst, keys[i], NULL);
+			g_unlink(fn);
+			g_free(fn);
+			g_key_file_remove_key(manifest, MANIFEST_GROUP, keys[i], NULL);
+			changed = TRUE;
+		}
+	}
+	g_strfreev(keys);
+
+	if (changed)
+	{
+		data = g_key_file_to_data(manifest, &len, NULL);
+		if (!g_file_set_contents(manifest_fn, data, len, NULL))
+			g_warning("Unable to write the manifest '%s'.", manifest_fn);
+		g_free(data);
+	}
+
+	g_hash_table_destroy(seen);
+	g_key_file_free(manifest);
 }
 
 
 static void init_config(struct ZenCodingPlugin *plugin)
 {
-	gchar *tmp, *settings, *sys_path;
+	gchar *tmp, *settings, *sys_path, *manifest;
 
 	g_free(plugin->config_dir);
 	plugin->config_dir = g_build_filename(geany->app->configdir, "plugins", "zencoding", NULL);
@@ -468,7 +529,9 @@ static void init_config(struct ZenCodingPlugin *plugin)
 
 	sys_path = g_build_filename(ZEN_MODULE_PATH, "zencoding", NULL);
 
-	recursively_copy(sys_path, tmp);
+	manifest = g_build_filename(plugin->config_dir, "manifest", NULL);
+	sync_zencoding(sys_path, tmp, manifest);
+	g_free(manifest);
 
 	settings = g_build_filename(tmp, "zen_settings.py", NULL);
 	plugin->settings_file = g_file_new_for_path(settings);
@@ -506,30 +569,94 @@ static gchar *python_version(void)
 #endif
 
 
+/*
+ * Starting Python and importing Zen Coding takes a while, so it's done
+ * when the first action runs instead of when Geany starts.  Returns NULL
+ * if loading failed, in which case it isn't tried again.
+ */
+static ZenController *get_zen_controller(void)
+{
+#ifdef ZEN_EDITOR_DEBUG
+	GTimer *timer;
+	ZenControllerTimings *t;
+#endif
+
+	if (plugin.zen_controller != NULL || plugin.zen_load_failed)
+		return plugin.zen_controller;
+
+#ifdef ZEN_EDITOR_DEBUG
+	timer = g_timer_new();
+#endif
+
+	plugin.zen_controller = zen_controller_new(plugin.config_dir, plugin.profiles,
+								plugin.actions);
+	if (plugin.zen_controller == NULL)
+	{
+		plugin.zen_load_failed = TRUE;
+		ui_set_statusbar(TRUE, _("Zen Coding: Unable to load Zen Coding"));
+		return NULL;
+	}
+
+	zen_controller_set_active_profile(plugin.zen_controller, plugin.active_profile);
+
+#ifdef ZEN_EDITOR_DEBUG
+	t = &plugin.zen_controller->timings;
+	g_print("Zen Coding Plugin - Load Times\n"
+			"------------------------------\n"
+			"  Python Interpreter: %.1f ms\n"
+			"  Zen Coding Modules: %.1f ms\n"
+			"  Profiles: %.1f ms\n"
+			"  Total: %.1f ms\n",
+			t->python * 1000, t->modules * 1000, t->profiles * 1000,
+			g_timer_elapsed(timer, NULL) * 1000);
+	g_timer_destroy(timer);
+#endif
+
+	return plugin.zen_controller;
+}
+
+
 void plugin_init(GeanyData *data)
 {
+#ifdef ZEN_EDITOR_DEBUG
+	GTimer *timer;
+	gdouble menu_time;
+	gchar *pyversion;
+
+	timer = g_timer_new();
+#endif
+
 	memset(&plugin, 0, sizeof(struct ZenCodingPlugin));
+	plugin.active_profile = "xhtml";
+	plugin.profiles = zen_profiles_load(ZEN_PROFILES_PATH);
+	plugin.actions = zen_actions_load(ZEN_ACTIONS_FILE);
 
 	build_zc_menu(&plugin);
 
-	init_config(&plugin);
-
-	plugin.zen_controller = zen_controller_new(plugin.config_dir, ZEN_PROFILES_PATH);
+#ifdef ZEN_EDITOR_DEBUG
+	menu_time = g_timer_elapsed(timer, NULL);
+	g_timer_start(timer);
+#endif
 
-	zen_controller_set_active_profile(plugin.zen_controller, "xhtml");
+	init_config(&plugin);
 
 #ifdef ZEN_EDITOR_DEBUG
-	gchar *pyversion;
 	pyversion = python_version();
 	g_print("Zen Coding Plugin - Version Information\n"
 			"---------------------------------------\n"
 			"  GTK+ Version: %d.%d.%d\n"
 			"  GLib Version: %d.%d.%d\n"
-			"  Python Version: %s\n",
+			"  Python Version: %s\n"
+			"Zen Coding Plugin - Startup Times\n"
+			"---------------------------------\n"
+			"  Menu: %.1f ms\n"
+			"  Config Files: %.1f ms\n"
+			"  (Python is started by the first action)\n",
 			gtk_major_version, gtk_minor_version, gtk_micro_version,
 			glib_major_version, glib_minor_version, glib_micro_version,
-			pyversion);
+			pyversion, menu_time * 1000, g_timer_elapsed(timer, NULL) * 1000);
 	g_free(pyversion);
+	g_timer_destroy(timer);
 #endif
 }
 
@@ -540,5 +667,10 @@ void plugin_cleanup(void)
 	g_free(plugin.config_dir);
 	g_object_unref(plugin.settings_file);
 	g_object_unref(plugin.monitor);
-	zen_controller_free(plugin.zen_controller);
+	if (plugin.zen_controller != NULL)
+		zen_controller_free(plugin.zen_controller);
+	g_ptr_array_free(plugin.profiles, TRUE);
+	g_ptr_array_free(plugin.actions, TRUE);
+	zen_tag_index_cleanup();
+	zen_editor_cleanup();
 }
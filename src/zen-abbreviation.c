@@ -0,0 +1,843 @@
+/*
+ * zen-abbreviation.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file contains a native version of the abbreviation parser in
+ * zencoding/parser/abbreviation.py, exposed to Python as
+ * geany.parse_abbreviation().  It follows parse(), split_expression(),
+ * parse_attributes(), extract_attributes() and optimize_tree() step by
+ * step, quirks included, so that both build the same tree.
+ *
+ * Whenever the Python version would raise an exception (like for invalid
+ * tag names or unbalanced groups), or the abbreviation contains something
+ * the regular expressions there treat specially (newlines), the native
+ * parser gives up and lets the Python version handle it.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include "zen-abbreviation.h"
+
+
+/* Give up on repeat counts Python would turn into a long */
+#define ZEN_ABBR_MAX_DIGITS 9
+
+/* Same endless loop protection as extract_attributes() */
+#define ZEN_ABBR_MAX_ATTRS 100
+
+
+/* [\w\-:\$] */
+#define is_word_char(c) (g_ascii_isalnum(c) || (c) == '_' || (c) == '-' || \
+	(c) == ':' || (c) == '$')
+/* [\w\d\-_\$\:@!] */
+#define is_name_char(c) (is_word_char(c) || (c) == '@' || (c) == '!')
+
+
+static void attribute_free(ZenAbbrAttribute *attr)
+{
+	g_free(attr->name);
+	g_string_free(attr->value, TRUE);
+	g_slice_free(ZenAbbrAttribute, attr);
+}
+
+
+static ZenAbbrNode *node_new(GPtrArray *nodes)
+{
+	ZenAbbrNode *node;
+
+	node = g_slice_new0(ZenAbbrNode);
+	node->children = g_ptr_array_new();
+	node->attributes = g_ptr_array_new_with_free_func((GDestroyNotify) attribute_free);
+	node->count = 1;
+	g_ptr_array_add(nodes, node);
+
+	return node;
+}
+
+
+void zen_abbreviation_node_free(ZenAbbrNode *node)
+{
+	g_ptr_array_free(node->children, TRUE);
+	g_ptr_array_free(node->attributes, TRUE);
+	g_free(node->abbreviation);
+	g_free(node->name);
+	g_free(node->text);
+	g_slice_free(ZenAbbrNode, node);
+}
+
+
+/* TreeNode.add_child(), creates the child if it's NULL */
+static ZenAbbrNode *node_add_child(ZenAbbrNode *node, ZenAbbrNode *child,
+	GPtrArray *nodes)
+{
+	if (child == NULL)
+		child = node_new(nodes);
+	child->parent = node;
+	g_ptr_array_add(node->children, child);
+	return child;
+}
+
+
+static ZenAbbrAttribute *add_attribute(GPtrArray *attributes,
+	const gchar *name, gsize name_len, const gchar *value, gsize value_len)
+{
+	ZenAbbrAttribute *attr;
+
+	attr = g_slice_new(ZenAbbrAttribute);
+	attr->name = g_strndup(name, name_len);
+	attr->value = g_string_new_len(value, value_len);
+	g_ptr_array_add(attributes, attr);
+
+	return attr;
+}
+
+
+/* Length of the re_word match at s */
+static gsize word_len(const gchar *s, gsize len)
+{
+	gsize i = 0;
+
+	while (i < len && is_word_char(s[i]))
+		i++;
+
+	return i;
+}
+
+
+/* str.strip() */
+static const gchar *strip(const gchar *s, gsize *len)
+{
+	while (*len > 0 && g_ascii_isspace(s[0]))
+	{
+		s++;
+		(*len)--;
+	}
+	while (*len > 0 && g_ascii_isspace(s[*len - 1]))
+		(*len)--;
+
+	return s;
+}
+
+
+/* Length of the re_attr_string match at s (quotes included), 0 if none */
+static gsize attr_string_len(const gchar *s, gsize len)
+{
+	gsize i;
+
+	for (i = 1; i < len; i++)
+	{
+		if (s[i] == '\\')
+		{
+			if (i + 1 >= len)
+				break;
+			i++;
+		}
+		else if (s[i] == s[0])
+			return i + 1;
+	}
+
+	return 0;
+}
+
+
+/* extract_attributes() */
+static void extract_attributes(const gchar *s, gsize len, GPtrArray *attributes)
+{
+	gsize name_len, value_len;
+	gint loop_count = ZEN_ABBR_MAX_ATTRS;
+	ZenAbbrAttribute *attr;
+	gchar ch;
+
+	s = strip(s, &len);
+
+	while (len > 0 && loop_count > 0)
+	{
+		name_len = word_len(s, len);
+		if (name_len == 0)
+			break;
+
+		attr = add_attribute(attributes, s, name_len, "", 0);
+
+		/* let's see if attribute has value */
+		if (name_len < len && s[name_len] == '=')
+		{
+			ch = (name_len + 1 < len) ? s[name_len + 1] : '\0';
+			if (ch == '"' || ch == '\'')
+			{
+				/* we have a quoted string */
+				value_len = attr_string_len(s + name_len + 1, len - name_len - 1);
+				if (value_len > 0)
+				{
+					g_string_append_len(attr->value, s + name_len + 2, value_len - 2);
+					s += name_len + value_len + 1;
+					len -= name_len + value_len + 1;
+					s = strip(s, &len);
+				}
+				else
+					len = 0;
+			}
+			else if (name_len + 1 < len)
+			{
+				/* unquoted string, up to the next whitespace */
+				value_len = 1;
+				while (name_len + 1 + value_len < len &&
+					!g_ascii_isspace(s[name_len + 1 + value_len]))
+				{
+					value_len++;
+				}
+				g_string_append_len(attr->value, s + name_len + 1, value_len);
+				s += name_len + value_len + 1;
+				len -= name_len + value_len + 1;
+				s = strip(s, &len);
+			}
+			else
+				len = 0;
+		}
+		else
+		{
+			s += name_len;
+			len -= name_len;
+			s = strip(s, &len);
+		}
+
+		loop_count--;
+	}
+}
+
+
+/* parse_attributes(), returns the tag name */
+static gchar *parse_attributes(const gchar *s, gsize len, GPtrArray *attributes)
+{
+	GString *name;
+	ZenAbbrAttribute *class_attr = NULL;
+	gboolean collect_name = TRUE;
+	const gchar *end;
+	gsize i = 0, w;
+
+	name = g_string_new(NULL);
+
+	while (i < len)
+	{
+		if (s[i] == '#')
+		{
+			/* id */
+			w = word_len(s + i + 1, len - i - 1);
+			add_attribute(attributes, "id", 2, s + i + 1, w);
+			i += w + 1;
+			collect_name = FALSE;
+		}
+		else if (s[i] == '.')
+		{
+			/* class */
+			w = word_len(s + i + 1, len - i - 1);
+			if (class_attr == NULL)
+				class_attr = add_attribute(attributes, "class", 5, "", 0);
+			if (class_attr->value->len > 0)
+				g_string_append_c(class_attr->value, ' ');
+			g_string_append_len(class_attr->value, s + i + 1, w);
+			i += w + 1;
+			collect_name = FALSE;
+		}
+		else if (s[i] == '[')
+		{
+			/* begin attribute set, search for end of set */
+			end = memchr(s + i, ']', len - i);
+			if (end != NULL)
+			{
+				extract_attributes(s + i + 1, (end - s) - i - 1, attributes);
+				i = end - s;
+			}
+			else
+				i = len;	/* invalid attribute set, stop searching */
+			collect_name = FALSE;
+		}
+		else
+		{
+			if (collect_name)
+				g_string_append_c(name, s[i]);
+			i++;
+		}
+	}
+
+	return g_string_free(name, FALSE);
+}
+
+
+/*
+ * split_expression(), sets text_start to the '{' of the text node or -1.
+ * Returns FALSE where the Python version fails on an unbalanced '}'.
+ */
+static gboolean split_expression(const gchar *expr, gsize len, gssize *text_start,
+	gsize *text_end)
+{
+	gint attr_lvl = 0, text_lvl = 0;
+	gssize brace_start = -1;
+	gsize i;
+
+	*text_start = -1;
+
+	if (memchr(expr, '{', len) == NULL)
+		return TRUE;
+
+	for (i = 0; i < len; i++)
+	{
+		switch (expr[i])
+		{
+			case '[':
+				if (text_lvl == 0)
+					attr_lvl++;
+				break;
+			case ']':
+				if (text_lvl == 0)
+					attr_lvl--;
+				break;
+			case '{':
+				if (attr_lvl == 0)
+				{
+					/* the brace stack only matters for its bottom */
+					if (text_lvl == 0)
+						brace_start = i;
+					text_lvl++;
+				}
+				break;
+			case '}':
+				if (attr_lvl == 0)
+				{
+					if (text_lvl <= 0)
+						return FALSE;
+					text_lvl--;
+					if (text_lvl == 0)
+					{
+						/* found braces bounds */
+						*text_start = brace_start;
+						*text_end = i;
+						return TRUE;
+					}
+				}
+				break;
+		}
+	}
+
+	return TRUE;
+}
+
+
+/* TreeNode.set_abbreviation(), FALSE where Python would raise */
+static gboolean node_set_abbreviation(ZenAbbrNode *node, const gchar *abbr,
+	gsize len)
+{
+	const gchar *star;
+	gssize text_start;
+	gsize text_end, name_len, digits, i;
+
+	g_free(node->abbreviation);
+	node->abbreviation = g_strndup(abbr, len);
+
+	/* \*(\d+)?$ */
+	star = g_strrstr_len(abbr, len, "*");
+	if (star != NULL)
+	{
+		digits = len - (star - abbr) - 1;
+		for (i = 0; i < digits && g_ascii_isdigit(star[i + 1]); i++)
+			;
+		if (i == digits)
+		{
+			if (digits > ZEN_ABBR_MAX_DIGITS)
+				return FALSE;
+			node->count = (digits > 0) ? atoi(star + 1) : 0;
+			if (node->count == 0)
+				node->count = 1;
+			node->is_repeating = (digits == 0);
+			len = star - abbr;
+		}
+	}
+
+	if (len > 0)
+	{
+		if (!split_expression(abbr, len, &text_start, &text_end))
+			return FALSE;
+
+		g_free(node->text);
+		if (text_start >= 0)
+		{
+			node->text = g_strndup(abbr + text_start + 1, text_end - text_start - 1);
+			name_len = text_start;
+		}
+		else
+		{
+			node->text = NULL;
+			name_len = len;
+		}
+
+		if (name_len > 0)
+		{
+			g_ptr_array_set_size(node->attributes, 0);
+
+			g_free(node->name);
+			node->name = parse_attributes(abbr, name_len, node->attributes);
+			if (node->name[0] == '\0')
+			{
+				g_free(node->name);
+				node->name = g_strdup("div");
+				node->has_implicit_name = TRUE;
+			}
+		}
+	}
+
+	/* validate name, re_valid_name */
+	if (node->name != NULL)
+	{
+		name_len = strlen(node->name);
+		if (name_len > 0 && node->name[name_len - 1] == '+')
+			name_len--;
+		if (name_len == 0)
+			return FALSE;
+		for (i = 0; i < name_len; i++)
+		{
+			if (!is_name_char(node->name[i]))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+static gboolean node_is_empty(ZenAbbrNode *node)
+{
+	return node->abbreviation == NULL || node->abbreviation[0] == '\0';
+}
+
+
+static gboolean node_has_empty_children(ZenAbbrNode *node)
+{
+	guint i;
+
+	for (i = 0; i < node->children->len; i++)
+	{
+		if (node_is_empty(g_ptr_array_index(node->children, i)))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/*
+ * squash(), replaces empty nodes with their children.  Like the Python
+ * version this carries on with the next index of the changed list, and the
+ * moved children keep their old parent.
+ */
+static void squash(ZenAbbrNode *node)
+{
+	ZenAbbrNode *child;
+	GPtrArray *children;
+	guint i, j;
+
+	for (i = 0; i < node->children->len; i++)
+	{
+		child = g_ptr_array_index(node->children, i);
+		if (!node_is_empty(child))
+			continue;
+
+		children = g_ptr_array_sized_new(node->children->len + child->children->len);
+		for (j = 0; j < i; j++)
+			g_ptr_array_add(children, g_ptr_array_index(node->children, j));
+		for (j = 0; j < child->children->len; j++)
+			g_ptr_array_add(children, g_ptr_array_index(child->children, j));
+		for (j = i + 1; j < node->children->len; j++)
+			g_ptr_array_add(children, g_ptr_array_index(node->children, j));
+
+		g_ptr_array_free(node->children, TRUE);
+		node->children = children;
+	}
+}
+
+
+static void optimize_tree(ZenAbbrNode *node)
+{
+	guint i;
+
+	while (node_has_empty_children(node))
+		squash(node);
+
+	for (i = 0; i < node->children->len; i++)
+		optimize_tree(g_ptr_array_index(node->children, i));
+}
+
+
+/* dump_token() */
+static gboolean dump_token(ZenAbbrNode *context, GString *token)
+{
+	gboolean ok = TRUE;
+
+	if (token->len > 0)
+		ok = node_set_abbreviation(context, token->str, token->len);
+	g_string_truncate(token, 0);
+
+	return ok;
+}
+
+
+/*
+ * Parses abbreviation into tree like zencoding.parser.abbreviation.parse().
+ * Every node created is added to `nodes`, even if parsing fails, so the
+ * caller can free them.  Returns the root or NULL if the abbreviation has
+ * to be left to the Python version.
+ */
+ZenAbbrNode *zen_abbreviation_parse(const gchar *abbr, GPtrArray *nodes)
+{
+	ZenAbbrNode *root, *context;
+	GPtrArray *group_stack;
+	GString *token;
+	gint text_lvl = 0, attr_lvl = 0, group_mul;
+	gsize i, j, il;
+	gchar ch, prev_ch;
+	gboolean ok = TRUE;
+
+	if (strchr(abbr, '\n') != NULL)
+		return NULL;
+
+	root = node_new(nodes);
+	context = node_add_child(root, NULL, nodes);
+	group_stack = g_ptr_array_new();
+	g_ptr_array_add(group_stack, root);
+	token = g_string_new(NULL);
+	il = strlen(abbr);
+
+	for (i = 0; ok && i < il; i++)
+	{
+		ch = abbr[i];
+		prev_ch = (i > 0) ? abbr[i - 1] : '\0';
+
+		switch (ch)
+		{
+			case '{':
+				if (attr_lvl == 0)
+					text_lvl++;
+				g_string_append_c(token, ch);
+				break;
+
+			case '}':
+				if (attr_lvl == 0)
+					text_lvl--;
+				g_string_append_c(token, ch);
+				break;
+
+			case '[':
+				if (text_lvl == 0)
+					attr_lvl++;
+				g_string_append_c(token, ch);
+				break;
+
+			case ']':
+				if (text_lvl == 0)
+					attr_lvl--;
+				g_string_append_c(token, ch);
+				break;
+
+			case '(':
+				if (text_lvl == 0 && attr_lvl == 0)
+				{
+					/* beginning of the new group */
+					ok = dump_token(context, token);
+
+					if (prev_ch != '+' && prev_ch != '>')
+					{
+						/* previous char is not an operator, assume it's
+						 * a sibling */
+						if (context->parent == NULL)
+						{
+							ok = FALSE;
+							break;
+						}
+						context = node_add_child(context->parent, NULL, nodes);
+					}
+
+					g_ptr_array_add(group_stack, context);
+					context = node_add_child(context, NULL, nodes);
+				}
+				else
+					g_string_append_c(token, ch);
+				break;
+
+			case ')':
+				if (text_lvl == 0 && attr_lvl == 0)
+				{
+					/* end of the group, pop stack */
+					ok = dump_token(context, token);
+					if (group_stack->len == 0)
+					{
+						ok = FALSE;
+						break;
+					}
+					context = g_ptr_array_index(group_stack, group_stack->len - 1);
+					g_ptr_array_set_size(group_stack, group_stack->len - 1);
+
+					if (i + 1 < il && abbr[i + 1] == '*')
+					{
+						/* group multiplication */
+						for (j = i + 2; j < il && g_ascii_isdigit(abbr[j]); j++)
+							;
+						if (j - (i + 2) > ZEN_ABBR_MAX_DIGITS)
+						{
+							ok = FALSE;
+							break;
+						}
+						group_mul = (j > i + 2) ? atoi(abbr + i + 2) : 1;
+						i = j - 1;
+
+						for (; group_mul > 1; group_mul--)
+						{
+							if (context->parent == NULL)
+							{
+								ok = FALSE;
+								break;
+							}
+							node_add_child(context->parent, context, nodes);
+						}
+					}
+				}
+				else
+					g_string_append_c(token, ch);
+				break;
+
+			case '+':
+				/* sibling operator */
+				if (text_lvl == 0 && attr_lvl == 0 && i != il - 1)
+				{
+					ok = dump_token(context, token);
+					if (context->parent == NULL)
+					{
+						ok = FALSE;
+						break;
+					}
+					context = node_add_child(context->parent, NULL, nodes);
+				}
+				else
+					g_string_append_c(token, ch);
+				break;
+
+			case '>':
+				/* child operator */
+				if (text_lvl == 0 && attr_lvl == 0)
+				{
+					ok = dump_token(context, token);
+					context = node_add_child(context, NULL, nodes);
+				}
+				else
+					g_string_append_c(token, ch);
+				break;
+
+			default:
+				g_string_append_c(token, ch);
+				break;
+		}
+	}
+
+	/* put the final token */
+	if (ok)
+		ok = dump_token(context, token);
+
+	g_string_free(token, TRUE);
+	g_ptr_array_free(group_stack, TRUE);
+
+	if (!ok)
+		return NULL;
+
+	optimize_tree(root);
+
+	return root;
+}
+
+
+static PyObject *py_string_or_none(const gchar *str)
+{
+	if (str == NULL)
+		Py_RETURN_NONE;
+	return PyString_FromString(str);
+}
+
+
+static gboolean py_set_attr(PyObject *obj, const gchar *name, PyObject *value)
+{
+	gint res;
+
+	if (value == NULL)
+		return FALSE;
+	res = PyObject_SetAttrString(obj, name, value);
+	Py_DECREF(value);
+
+	return res == 0;
+}
+
+
+static PyObject *node_to_python(ZenAbbrNode *node, PyObject *node_class,
+	GHashTable *made);
+
+
+static PyObject *node_to_python_or_none(ZenAbbrNode *node, PyObject *node_class,
+	GHashTable *made)
+{
+	if (node == NULL)
+		Py_RETURN_NONE;
+	return node_to_python(node, node_class, made);
+}
+
+
+static PyObject *attributes_to_python(GPtrArray *attributes)
+{
+	PyObject *list, *item;
+	ZenAbbrAttribute *attr;
+	guint i;
+
+	list = PyList_New(attributes->len);
+	for (i = 0; list != NULL && i < attributes->len; i++)
+	{
+		attr = g_ptr_array_index(attributes, i);
+		item = Py_BuildValue("{s:s,s:s#}", "name", attr->name,
+					"value", attr->value->str, (int) attr->value->len);
+		if (item == NULL)
+			Py_CLEAR(list);
+		else
+			PyList_SET_ITEM(list, i, item);
+	}
+
+	return list;
+}
+
+
+static PyObject *children_to_python(GPtrArray *children, PyObject *node_class,
+	GHashTable *made)
+{
+	PyObject *list, *item;
+	guint i;
+
+	list = PyList_New(children->len);
+	for (i = 0; list != NULL && i < children->len; i++)
+	{
+		item = node_to_python(g_ptr_array_index(children, i), node_class, made);
+		if (item == NULL)
+			Py_CLEAR(list);
+		else
+			PyList_SET_ITEM(list, i, item);
+	}
+
+	return list;
+}
+
+
+/*
+ * Makes a TreeNode for node, reusing the one already made for it so that
+ * shared nodes stay shared.  `made` keeps a reference to every object made.
+ * Returns a new reference.
+ */
+static PyObject *node_to_python(ZenAbbrNode *node, PyObject *node_class,
+	GHashTable *made)
+{
+	PyObject *obj;
+
+	obj = g_hash_table_lookup(made, node);
+	if (obj != NULL)
+	{
+		Py_INCREF(obj);
+		return obj;
+	}
+
+	/* skip TreeNode.__init__(), every field is set below */
+	obj = PyObject_CallMethod(node_class, "__new__", "O", node_class);
+	if (obj == NULL)
+		return NULL;
+	g_hash_table_insert(made, node, obj);
+
+	if (!py_set_attr(obj, "abbreviation",
+			PyString_FromString(node->abbreviation ? node->abbreviation : "")) ||
+		!py_set_attr(obj, "parent",
+			node_to_python_or_none(node->parent, node_class, made)) ||
+		!py_set_attr(obj, "children",
+			children_to_python(node->children, node_class, made)) ||
+		!py_set_attr(obj, "count", PyInt_FromLong(node->count)) ||
+		!py_set_attr(obj, "name", py_string_or_none(node->name)) ||
+		!py_set_attr(obj, "text", py_string_or_none(node->text)) ||
+		!py_set_attr(obj, "attributes", attributes_to_python(node->attributes)) ||
+		!py_set_attr(obj, "is_repeating", PyBool_FromLong(node->is_repeating)) ||
+		!py_set_attr(obj, "has_implicit_name", PyBool_FromLong(node->has_implicit_name)))
+	{
+		return NULL;
+	}
+
+	Py_INCREF(obj);
+	return obj;
+}
+
+
+static void py_object_unref(gpointer key, PyObject *obj, gpointer data)
+{
+	Py_DECREF(obj);
+}
+
+
+/*
+ * geany.parse_abbreviation(abbr, node_class)
+ *
+ * Returns the root node_class (TreeNode) object of the parsed abbreviation,
+ * or None if it should be parsed by the Python version.
+ */
+PyObject *zen_abbreviation_py_parse(PyObject *self, PyObject *args)
+{
+	PyObject *abbr, *node_class, *result = NULL;
+	GPtrArray *nodes;
+	GHashTable *made;
+	ZenAbbrNode *root;
+
+	if (!PyArg_ParseTuple(args, "OO", &abbr, &node_class))
+		return NULL;
+
+	/* unicode abbreviations keep the Python parser's result types */
+	if (!PyString_Check(abbr) ||
+		strlen(PyString_AS_STRING(abbr)) != (gsize) PyString_GET_SIZE(abbr))
+	{
+		Py_RETURN_NONE;
+	}
+
+	nodes = g_ptr_array_new_with_free_func((GDestroyNotify) zen_abbreviation_node_free);
+	root = zen_abbreviation_parse(PyString_AS_STRING(abbr), nodes);
+
+	if (root != NULL)
+	{
+		made = g_hash_table_new(g_direct_hash, g_direct_equal);
+		result = node_to_python(root, node_class, made);
+		/* the objects now reference each other through parent and children */
+		g_hash_table_foreach(made, (GHFunc) py_object_unref, NULL);
+		g_hash_table_destroy(made);
+	}
+	else
+	{
+		result = Py_None;
+		Py_INCREF(result);
+	}
+
+	g_ptr_array_free(nodes, TRUE);
+
+	return result;
+}
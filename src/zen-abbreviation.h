@@ -0,0 +1,65 @@
+/*
+ * zen-abbreviation.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_ABBREVIATION_H
+#define ZEN_ABBREVIATION_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ZenAbbrAttribute ZenAbbrAttribute;
+
+struct _ZenAbbrAttribute
+{
+	gchar *name;
+	GString *value;
+};
+
+
+typedef struct _ZenAbbrNode ZenAbbrNode;
+
+/* Same fields as zencoding.parser.abbreviation.TreeNode */
+struct _ZenAbbrNode
+{
+	ZenAbbrNode *parent;
+	GPtrArray *children;	/* ZenAbbrNode, the same node can appear more than once */
+	gchar *abbreviation;	/* NULL while empty */
+	gint count;
+	gchar *name;			/* NULL for None */
+	gchar *text;			/* NULL for None */
+	GPtrArray *attributes;	/* ZenAbbrAttribute */
+	gboolean is_repeating;
+	gboolean has_implicit_name;
+};
+
+
+ZenAbbrNode *zen_abbreviation_parse(const gchar *abbr, GPtrArray *nodes);
+void zen_abbreviation_node_free(ZenAbbrNode *node);
+
+PyObject *zen_abbreviation_py_parse(PyObject *self, PyObject *args);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_ABBREVIATION_H */
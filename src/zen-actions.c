@@ -0,0 +1,113 @@
+/*
+ * zen-actions.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file reads the actions file, which lists the actions of the Zen
+ * Coding menu and keybinding group.  It is read when the plugin starts,
+ * before any Python runs, and the controller looks up the function of
+ * each action in it once Zen Coding is loaded.
+ */
+
+#include <gtk/gtk.h>
+#include <geanyplugin.h>
+#include "zen-actions.h"
+
+
+/* Returns the action in group of kf, or NULL if it has no label */
+static ZenAction *zen_action_load(GKeyFile *kf, const gchar *fn, const gchar *group)
+{
+	ZenAction *action;
+	gchar *label, *key;
+
+	label = g_key_file_get_locale_string(kf, group, "label", NULL, NULL);
+	if (label == NULL || *g_strstrip(label) == '\0')
+	{
+		g_warning("Ignoring action '%s' without a label in '%s'.", group, fn);
+		g_free(label);
+		return NULL;
+	}
+
+	action = g_new0(ZenAction, 1);
+	action->name = g_strdup(group);
+	action->label = label;
+	action->main_thread = g_key_file_get_boolean(kf, group, "main_thread", NULL);
+
+	key = g_key_file_get_string(kf, group, "key", NULL);
+	if (key != NULL && *g_strstrip(key) != '\0')
+	{
+		gtk_accelerator_parse(key, &action->key, &action->mods);
+		if (action->key == 0)
+			g_warning("Ignoring invalid key '%s' of '%s' in '%s'.", key, group, fn);
+	}
+	g_free(key);
+
+	return action;
+}
+
+
+void zen_action_free(ZenAction *action)
+{
+	if (action == NULL)
+		return;
+
+	g_free(action->name);
+	g_free(action->label);
+	g_free(action);
+}
+
+
+/*
+ * Reads the actions in fn, in the order of the file.  Returns an array of
+ * ZenAction that frees them with it, empty if fn can't be read.
+ */
+GPtrArray *zen_actions_load(const gchar *fn)
+{
+	GPtrArray *actions;
+	ZenAction *action;
+	GKeyFile *kf;
+	GError *error = NULL;
+	gchar **groups;
+	gsize i, n_groups;
+
+	actions = g_ptr_array_new_with_free_func((GDestroyNotify) zen_action_free);
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_file(kf, fn, G_KEY_FILE_NONE, &error))
+	{
+		g_warning("Unable to read actions '%s': %s", fn, error->message);
+		g_error_free(error);
+		g_key_file_free(kf);
+		return actions;
+	}
+
+	groups = g_key_file_get_groups(kf, &n_groups);
+	for (i = 0; i < n_groups; i++)
+	{
+		if ((action = zen_action_load(kf, fn, groups[i])) != NULL)
+			g_ptr_array_add(actions, action);
+	}
+
+	g_strfreev(groups);
+	g_key_file_free(kf);
+
+	return actions;
+}
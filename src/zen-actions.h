@@ -0,0 +1,50 @@
+/*
+ * zen-actions.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_ACTIONS_H
+#define ZEN_ACTIONS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ZenAction ZenAction;
+
+/* An action read from the actions file, see data/actions.conf */
+struct _ZenAction
+{
+	gchar *name;			/* as registered with zencoding.action */
+	gchar *label;			/* for the menu and the keybinding */
+	guint key;				/* default keybinding, 0 for none */
+	GdkModifierType mods;
+	gboolean main_thread;	/* can't run against a snapshot of the document */
+};
+
+
+GPtrArray *zen_actions_load(const gchar *fn);
+void zen_action_free(ZenAction *action);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_ACTIONS_H */
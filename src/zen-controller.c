@@ -25,14 +25,28 @@
  * imports the requred modules, and provides a way for the Geany plugin to
  * run Zen Coding actions by means of the zen_controller_run_action()
  * function.
+ *
+ * The actions come from the actions file the plugin reads.  The function
+ * of each one is looked up when Zen Coding is loaded, so running an action
+ * is a call through the function at its id.
+ *
+ * Most actions run on a worker thread against a snapshot of the document,
+ * so a slow one doesn't freeze the editor.  The main thread only holds the
+ * GIL while it runs Python itself, and applies the edits an action made
+ * from an idle callback once it is done.  The text of a streamed edit is
+ * produced on the worker after that, and inserted as it comes.
  */
 
 #include <Python.h>
 #include <limits.h>
 #include <dlfcn.h>
 #include <geanyplugin.h>
+#include "zen-actions.h"
 #include "zen-controller.h"
+#include "zen-matcher.h"
+#include "zen-tag-index.h"
 #include "zen-editor.h"
+#include "zen-profiles.h"
 
 
 extern GeanyPlugin		*geany_plugin;
@@ -40,6 +54,78 @@ extern GeanyData		*geany_data;
 extern GeanyFunctions	*geany_functions;
 
 
+typedef enum
+{
+	ZEN_EDIT_REPLACE,
+	ZEN_EDIT_STREAM,
+	ZEN_EDIT_SELECT,
+	ZEN_EDIT_CARET
+}
+ZenControllerEditType;
+
+
+typedef struct
+{
+	ZenControllerEditType type;
+	gchar *text;
+	PyObject *chunks;			/* iterator of a streamed edit, for the worker */
+	gint start;
+	gint end;
+}
+ZenControllerEdit;
+
+
+/*
+ * An action run on the worker thread.  The main thread fills in the
+ * snapshot, the worker the edits made to it, and the main thread applies
+ * those unless the request was cancelled or its document changed since.
+ */
+typedef struct
+{
+	guint action;				/* id, see ZenController.actions */
+	GeanyDocument *doc;
+	guint generation;			/* of doc when the snapshot was taken */
+	volatile gint cancelled;	/* only accessed atomically */
+
+	gchar *text;
+	gint length;
+	ZenTagIndex *tag_index;		/* copy of doc's, the worker's own until done */
+	gint sel_start;
+	gint sel_end;
+	gint caret;
+	gchar *syntax;
+	gchar *file_name;
+	gchar *profile;
+
+	GArray *edits;				/* ZenControllerEdit */
+	gboolean run_here;			/* run the action again on the main thread */
+	guint streams;				/* streamed edits, their chunks go to zen->chunks */
+
+	/* where the main thread is applying the edits */
+	guint next_edit;
+	gboolean undo;				/* in the undo action of the edits */
+	ZenEditorStream *stream;	/* of the streamed edit being applied */
+}
+ZenControllerRequest;
+
+
+/* Pushed to stop the worker */
+static ZenControllerRequest quit_request;
+
+/* Pushed to make the worker reload the settings */
+static ZenControllerRequest reload_request;
+
+
+/* Streamed edits longer than this show their progress in the status bar */
+#define ZEN_PROGRESS_STEP (1024 * 1024)
+
+/* Chunks of streamed edits produced before the main thread inserts them */
+#define ZEN_STREAM_CHUNKS 4
+
+/* Queued after the last chunk of each streamed edit */
+static gchar chunk_end[] = "";
+
+
 /* FIXME:
  *   A segfault occurs when loading/unloading the plugin, but it seems to
  *   only happen every once in a while.  Grrrrr. */
@@ -61,28 +147,142 @@ static void zen_controller_init_python(void)
 	}
 
 	if (!Py_IsInitialized())
+	{
 		Py_Initialize();
+		/* From here on, threads take the GIL when they need it */
+		PyEval_InitThreads();
+		PyEval_SaveThread();
+	}
 }
 
 
-ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
+/* Passes each of profiles to zencoding.utils.setup_profile() */
+static void zen_controller_setup_profiles(GPtrArray *profiles)
+{
+	PyObject *module, *setup_profile, *options, *res;
+	ZenProfile *profile;
+	guint i;
+
+	module = PyImport_ImportModule("zencoding.utils");
+	if (module == NULL)
+	{
+		if (PyErr_Occurred())
+			PyErr_Print();
+		g_warning("Unable to initialize profiles");
+		return;
+	}
+
+	setup_profile = PyObject_GetAttrString(module, "setup_profile");
+	Py_DECREF(module);
+	if (setup_profile == NULL)
+	{
+		if (PyErr_Occurred())
+			PyErr_Print();
+		g_warning("Unable to initialize profiles");
+		return;
+	}
+
+	for (i = 0; i < profiles->len; i++)
+	{
+		profile = g_ptr_array_index(profiles, i);
+
+		options = zen_profile_to_dict(profile);
+		res = (options != NULL) ?
+			PyObject_CallFunction(setup_profile, "sO", profile->name, options) : NULL;
+		if (res == NULL)
+		{
+			if (PyErr_Occurred())
+				PyErr_Print();
+			g_warning("Unable to set up profile '%s'", profile->label);
+		}
+		Py_XDECREF(res);
+		Py_XDECREF(options);
+	}
+
+	Py_DECREF(setup_profile);
+}
+
+
+static void zen_controller_decref(gpointer object)
+{
+	Py_XDECREF((PyObject *) object);
+}
+
+
+/*
+ * Returns the function of each action, by id, with NULL for the actions
+ * Zen Coding doesn't have.  Returns NULL if the functions can't be
+ * looked up at all.
+ */
+static GPtrArray *zen_controller_load_actions(PyObject *module, GPtrArray *actions)
+{
+	GPtrArray *funcs;
+	PyObject *get_action, *func;
+	ZenAction *action;
+	guint i;
+
+	get_action = PyObject_GetAttrString(module, "get_action");
+	if (get_action == NULL)
+		return NULL;
+
+	funcs = g_ptr_array_new_with_free_func(zen_controller_decref);
+
+	for (i = 0; i < actions->len; i++)
+	{
+		action = g_ptr_array_index(actions, i);
+		func = PyObject_CallFunction(get_action, "s", action->name);
+		if (func == NULL && PyErr_Occurred())
+			PyErr_Print();
+		else if (func == Py_None || !PyCallable_Check(func))
+			Py_CLEAR(func);
+
+		if (func == NULL)
+			g_warning("Zen Coding has no '%s' action.", action->name);
+		g_ptr_array_add(funcs, func);
+	}
+
+	Py_DECREF(get_action);
+
+	return funcs;
+}
+
+
+static ZenController *zen_controller_load(const char *zendir,
+	GPtrArray *profiles, GPtrArray *actions, GTimer *timer,
+	ZenControllerTimings *timings)
 {
 	ZenController *result;
 	char zen_path[PATH_MAX + 20] = { 0 };
-	PyObject *module, *cls, *res;
+	PyObject *module, *geany_module, *cls;
 
 	result = malloc(sizeof(ZenController));
 	result->editor = NULL;
-	result->run_action = NULL;
+	result->actions = actions;
+	result->action_funcs = NULL;
 	result->set_context = NULL;
 	result->set_active_profile = NULL;
+	result->snapshot_editor = NULL;
+	result->cancelled_error = NULL;
+	result->main_thread_error = NULL;
+	result->reload_settings = NULL;
 
-	zen_controller_init_python();
+	g_timer_start(timer);
 
 	PyRun_SimpleString("import sys");
 	snprintf(zen_path, PATH_MAX + 20 - 1, "sys.path.append('%s')", zendir);
 	PyRun_SimpleString(zen_path);
 
+	/* The geany module has to exist before zencoding is imported, so that
+	 * modules like html_matcher can pick up the native functions in it. */
+	geany_module = zen_editor_module_init();
+	if (geany_module == NULL)
+	{
+		if (PyErr_Occurred())
+			PyErr_Print();
+		free(result);
+		return NULL;
+	}
+
 	module = PyImport_ImportModule("zencoding");
 	if (module == NULL)
 	{
@@ -95,7 +295,7 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 	/*
 	 * For some reason on Python 2.7.0+ "pre-importing" these prevents a
 	 * segfault below in zen_controller_run_action() where it calls the
-	 * Zen Coding run_action() function.
+	 * function of the action.
 	 *
 	 * I would *LOVE* to know what's going on, I've spent far too long trying
 	 * to debug this :)
@@ -104,8 +304,8 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 	PyRun_SimpleString("import zencoding.filters");
 	PyRun_SimpleString("import zencoding.utils");
 
-	result->run_action = PyObject_GetAttrString(module, "run_action");
-	if (result->run_action == NULL)
+	result->action_funcs = zen_controller_load_actions(module, actions);
+	if (result->action_funcs == NULL)
 	{
 		if (PyErr_Occurred())
 			PyErr_Print();
@@ -114,34 +314,16 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 		return NULL;
 	}
 
-	if (!PyCallable_Check(result->run_action))
-	{
-		Py_XDECREF(result->run_action);
-		Py_XDECREF(module);
-		free(result);
-		return NULL;
-	}
-
 	Py_XDECREF(module);
 
-
-	module = zen_editor_module_init();
-	if (module == NULL)
-	{
-		if (PyErr_Occurred())
-			PyErr_Print();
-		Py_XDECREF(result->run_action);
-		free(result);
-		return NULL;
-	}
-
+	module = geany_module;
 	cls = PyObject_GetAttrString(module, "ZenEditor");
 	if (cls == NULL)
 	{
 		if (PyErr_Occurred())
 			PyErr_Print();
 		Py_XDECREF(module);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		free(result);
 		return NULL;
 	}
@@ -153,7 +335,7 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 		if (PyErr_Occurred())
 			PyErr_Print();
 		Py_XDECREF(cls);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		free(result);
 		return NULL;
 	}
@@ -166,14 +348,14 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 		if (PyErr_Occurred())
 			PyErr_Print();
 		Py_XDECREF(result->editor);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		free(result);
 		return NULL;
 	}
 	else if (!PyCallable_Check(result->set_context))
 	{
 		Py_XDECREF(result->editor);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		Py_XDECREF(result->set_context);
 		free(result);
 		return NULL;
@@ -185,7 +367,7 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 		if (PyErr_Occurred())
 			PyErr_Print();
 		Py_XDECREF(result->editor);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		Py_XDECREF(result->set_context);
 		free(result);
 		return NULL;
@@ -193,36 +375,185 @@ ZenController *zen_controller_new(const char *zendir, const char *profiles_dir)
 	else if (!PyCallable_Check(result->set_active_profile))
 	{
 		Py_XDECREF(result->editor);
-		Py_XDECREF(result->run_action);
+		g_ptr_array_free(result->action_funcs, TRUE);
 		Py_XDECREF(result->set_context);
 		Py_XDECREF(result->set_active_profile);
 		free(result);
 		return NULL;
 	}
 
+	timings->modules = g_timer_elapsed(timer, NULL);
+	g_timer_start(timer);
+
 	/* Initialize/setup profiles */
-	res = PyObject_CallMethod(result->editor, "init_profiles", "(s)", profiles_dir);
-	if (res == NULL)
+	zen_controller_setup_profiles(profiles);
+
+	timings->profiles = g_timer_elapsed(timer, NULL);
+
+	/* Without these every action runs on the main thread */
+	module = PyImport_ImportModule("zencoding.interface.snapshot");
+	if (module != NULL)
+	{
+		result->snapshot_editor = PyObject_GetAttrString(module, "SnapshotEditor");
+		result->cancelled_error = PyObject_GetAttrString(module, "ZenCancelled");
+		result->main_thread_error = PyObject_GetAttrString(module, "ZenMainThreadRequired");
+		Py_DECREF(module);
+	}
+	if (result->snapshot_editor == NULL || result->cancelled_error == NULL ||
+		result->main_thread_error == NULL)
 	{
 		if (PyErr_Occurred())
 			PyErr_Print();
-		g_warning("Unable to initialize profiles");
+		g_warning("Unable to load the snapshot editor, actions will block the editor.");
+		Py_CLEAR(result->snapshot_editor);
+		Py_CLEAR(result->cancelled_error);
+		Py_CLEAR(result->main_thread_error);
+	}
+
+	module = PyImport_ImportModule("zencoding.resources");
+	if (module != NULL)
+	{
+		result->reload_settings = PyObject_GetAttrString(module, "reload_settings");
+		Py_DECREF(module);
+	}
+	if (result->reload_settings == NULL)
+	{
+		if (PyErr_Occurred())
+			PyErr_Print();
+		g_warning("Unable to load reload_settings(), settings won't be reloaded.");
 	}
-	else
-		Py_XDECREF(res);
 
 	return result;
 }
 
+
+static gpointer zen_controller_worker(gpointer data);
+
+
+ZenController *zen_controller_new(const char *zendir, GPtrArray *profiles,
+	GPtrArray *actions)
+{
+	ZenController *result;
+	ZenControllerTimings timings = { 0 };
+	PyGILState_STATE gstate;
+	GTimer *timer;
+	guint i;
+
+	timer = g_timer_new();
+	zen_controller_init_python();
+	timings.python = g_timer_elapsed(timer, NULL);
+
+	gstate = PyGILState_Ensure();
+	result = zen_controller_load(zendir, profiles, actions, timer, &timings);
+	PyGILState_Release(gstate);
+
+	g_timer_destroy(timer);
+
+	if (result == NULL)
+		return NULL;
+
+	result->timings = timings;
+
+	result->active_profile = NULL;
+	result->reload_failed = FALSE;
+	result->pending = NULL;
+	result->progress = 0;
+	result->progress_action = 0;
+	result->generations = g_hash_table_new(g_direct_hash, g_direct_equal);
+	result->requests = g_async_queue_new();
+	result->done = g_async_queue_new();
+	result->applying = NULL;
+	result->chunks = g_async_queue_new();
+	result->slots = g_async_queue_new();
+	for (i = 0; i < ZEN_STREAM_CHUNKS; i++)
+		g_async_queue_push(result->slots, GINT_TO_POINTER(TRUE));
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	result->worker = g_thread_new("zencoding", zen_controller_worker, result);
+#else
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+	result->worker = g_thread_create(zen_controller_worker, result, TRUE, NULL);
+#endif
+
+	return result;
+}
+
+
+static void zen_controller_cancel_pending(ZenController *zen);
+static void zen_controller_stop_request(ZenController *zen, ZenControllerRequest *req);
+
+
+static void zen_controller_request_free(ZenControllerRequest *req)
+{
+	guint i;
+
+	for (i = 0; i < req->edits->len; i++)
+		g_free(g_array_index(req->edits, ZenControllerEdit, i).text);
+	g_array_free(req->edits, TRUE);
+
+	if (req->tag_index != NULL)
+		zen_tag_index_free(req->tag_index);
+	g_free(req->text);
+	g_free(req->syntax);
+	g_free(req->file_name);
+	g_free(req->profile);
+	g_free(req);
+}
+
+
 void zen_controller_free(ZenController *zen)
 {
+	ZenControllerRequest *req;
+	PyGILState_STATE gstate;
+	gchar *chunk;
+
+	/* Nothing still running is wanted, and should the worker be waiting
+	 * for room to queue a chunk, it gets it and then sees that */
+	zen_controller_cancel_pending(zen);
+	if (zen->applying != NULL)
+		zen_controller_stop_request(zen, zen->applying);
+	g_async_queue_push(zen->slots, GINT_TO_POINTER(TRUE));
+
+	/* The worker may need the GIL to finish, the main thread doesn't hold it */
+	g_async_queue_push(zen->requests, &quit_request);
+	if (zen->worker != NULL)
+		g_thread_join(zen->worker);
+
+	/* the worker is gone, nothing adds idle callbacks for zen any more */
+	while (g_idle_remove_by_data(zen))
+		;
+	if (zen->applying != NULL)
+		zen_controller_request_free(zen->applying);
+	while ((req = g_async_queue_try_pop(zen->done)) != NULL)
+		zen_controller_request_free(req);
+	while ((chunk = g_async_queue_try_pop(zen->chunks)) != NULL)
+	{
+		if (chunk != chunk_end)
+			g_free(chunk);
+	}
+
+	g_async_queue_unref(zen->requests);
+	g_async_queue_unref(zen->done);
+	g_async_queue_unref(zen->chunks);
+	g_async_queue_unref(zen->slots);
+	g_hash_table_destroy(zen->generations);
+	g_free(zen->active_profile);
+
+	gstate = PyGILState_Ensure();
 	Py_XDECREF(zen->editor);
-	Py_XDECREF(zen->run_action);
+	g_ptr_array_free(zen->action_funcs, TRUE);
+	Py_XDECREF(zen->snapshot_editor);
+	Py_XDECREF(zen->cancelled_error);
+	Py_XDECREF(zen->main_thread_error);
+	Py_XDECREF(zen->reload_settings);
+	PyGILState_Release(gstate);
+
 	free(zen);
 }
 
 
-void zen_controller_set_active_profile(ZenController *zen, const char *profile)
+static void zen_controller_call_set_profile_name(ZenController *zen, const char *profile)
 {
 	PyObject *args, *result;
 
@@ -249,22 +580,656 @@ void zen_controller_set_active_profile(ZenController *zen, const char *profile)
 }
 
 
-void zen_controller_run_action(ZenController *zen, const char *action_name)
+void zen_controller_set_active_profile(ZenController *zen, const char *profile)
 {
-	PyObject *addr, *result;
-	GeanyDocument *doc;
+	PyGILState_STATE gstate;
 
 	g_return_if_fail(zen != NULL);
-	g_return_if_fail(action_name != NULL);
 
-	ui_set_statusbar(FALSE, _("Zen Coding: Running '%s' action"), action_name);
+	/* kept for snapshots, which are taken without the GIL */
+	g_free(zen->active_profile);
+	zen->active_profile = g_strdup(profile);
 
-	doc = document_get_current();
-	if (!DOC_VALID(doc))
+	gstate = PyGILState_Ensure();
+	zen_controller_call_set_profile_name(zen, profile);
+	PyGILState_Release(gstate);
+}
+
+
+static guint zen_controller_generation(ZenController *zen, GeanyDocument *doc)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(zen->generations, doc));
+}
+
+
+/* Stops the last action sent to the worker from changing the document */
+static void zen_controller_cancel_pending(ZenController *zen)
+{
+	ZenControllerRequest *req = zen->pending;
+
+	if (req != NULL)
 	{
-		g_warning("No valid document detected.");
+		g_atomic_int_set(&req->cancelled, TRUE);
+		zen->pending = NULL;
+	}
+}
+
+
+/*
+ * Called whenever text is inserted into or deleted from doc, so results
+ * computed from an older snapshot of it are thrown away.
+ */
+void zen_controller_document_changed(ZenController *zen, GeanyDocument *doc)
+{
+	ZenControllerRequest *req = zen->pending;
+
+	g_hash_table_insert(zen->generations, doc,
+		GUINT_TO_POINTER(zen_controller_generation(zen, doc) + 1));
+
+	if (req != NULL && req->doc == doc)
+		zen_controller_cancel_pending(zen);
+}
+
+
+void zen_controller_document_closed(ZenController *zen, GeanyDocument *doc)
+{
+	ZenControllerRequest *req = zen->pending;
+
+	if (req != NULL && req->doc == doc)
+		zen_controller_cancel_pending(zen);
+
+	/* the document is still there, stop inserting into it while it is */
+	req = zen->applying;
+	if (req != NULL && req->doc == doc)
+		zen_controller_stop_request(zen, req);
+
+	g_hash_table_remove(zen->generations, doc);
+}
+
+
+/*
+ * Reloads zen_settings.py and my_zen_settings.py once the actions already
+ * queued are done, and tells the user how it went in the status bar.
+ */
+void zen_controller_reload_settings(ZenController *zen)
+{
+	if (zen->reload_settings != NULL)
+		g_async_queue_push(zen->requests, &reload_request);
+}
+
+
+static PyObject *zen_controller_request_cancelled(PyObject *self, PyObject *args)
+{
+	ZenControllerRequest *req = PyLong_AsVoidPtr(self);
+
+	return PyBool_FromLong(g_atomic_int_get(&req->cancelled));
+}
+
+
+static PyMethodDef request_cancelled_def = {
+	"is_cancelled", (PyCFunction) zen_controller_request_cancelled, METH_NOARGS,
+	"Whether the result of the running action is no longer wanted."
+};
+
+
+static gboolean zen_controller_on_idle(gpointer data);
+
+
+/* Shows how far the running action got, see zen_controller_progress() */
+static gboolean zen_controller_on_progress(gpointer data)
+{
+	ZenController *zen = data;
+	ZenAction *action;
+	gint kib;
+
+	kib = g_atomic_int_get(&zen->progress);
+	action = g_ptr_array_index(zen->actions, g_atomic_int_get(&zen->progress_action));
+	ui_set_statusbar(FALSE, _("Zen Coding: Running '%s' action, %d KiB so far"),
+		action->name, kib);
+	return FALSE;
+}
+
+
+/*
+ * Called on the worker as a streamed edit grows.  Only the latest figures
+ * are kept, and the idle callbacks have zen as their data, so
+ * zen_controller_free() can remove the ones still waiting.
+ */
+static void zen_controller_progress(ZenController *zen, guint action_id, gsize len)
+{
+	g_atomic_int_set(&zen->progress_action, action_id);
+	g_atomic_int_set(&zen->progress, len / 1024);
+	g_idle_add(zen_controller_on_progress, zen);
+}
+
+
+/*
+ * Copies the edits recorded by the snapshot editor, with the GIL held.
+ * Streamed edits keep their iterator, the worker produces their chunks
+ * once the main thread has the request.
+ */
+static void zen_controller_take_edits(ZenController *zen, ZenControllerRequest *req,
+	PyObject *edits)
+{
+	ZenControllerEdit edit;
+	PyObject *value;
+	const gchar *type;
+	Py_ssize_t i;
+
+	if (!PyList_Check(edits))
 		return;
+
+	for (i = 0; i < PyList_GET_SIZE(edits); i++)
+	{
+		if (!PyArg_ParseTuple(PyList_GET_ITEM(edits, i), "sOii",
+				&type, &value, &edit.start, &edit.end))
+			return;
+
+		edit.text = NULL;
+		edit.chunks = NULL;
+		if (strcmp(type, "select") == 0)
+			edit.type = ZEN_EDIT_SELECT;
+		else if (strcmp(type, "caret") == 0)
+			edit.type = ZEN_EDIT_CARET;
+		else if (PyString_Check(value))
+		{
+			edit.type = ZEN_EDIT_REPLACE;
+			edit.text = g_strdup(PyString_AS_STRING(value));
+		}
+		else
+		{
+			/* replace_content_stream() */
+			if ((edit.chunks = PyObject_GetIter(value)) == NULL)
+				return;
+			edit.type = ZEN_EDIT_STREAM;
+			req->streams++;
+		}
+
+		g_array_append_val(req->edits, edit);
 	}
+}
+
+
+/*
+ * Produces the chunks of the request's streamed edits into zen->chunks,
+ * with the GIL held, once the request is queued for the main thread.  No
+ * more than ZEN_STREAM_CHUNKS of them wait to be inserted at a time, and
+ * the GIL is released while the worker waits for room.  Text inserted
+ * before the request is cancelled or the iterator fails stays, it is
+ * undone with the rest of the edits.
+ */
+static void zen_controller_stream_edits(ZenController *zen, ZenControllerRequest *req)
+{
+	ZenControllerEdit *edit;
+	PyObject *chunk;
+	gchar *text;
+	guint i, streams = req->streams;
+	gsize len, progress;
+
+	for (i = 0; streams > 0; i++)
+	{
+		edit = &g_array_index(req->edits, ZenControllerEdit, i);
+		if (edit->type != ZEN_EDIT_STREAM)
+			continue;
+
+		len = 0;
+		progress = ZEN_PROGRESS_STEP;
+		while (!g_atomic_int_get(&req->cancelled) &&
+			(chunk = PyIter_Next(edit->chunks)) != NULL)
+		{
+			if (PyString_Check(chunk))
+			{
+				text = g_strdup(PyString_AS_STRING(chunk));
+				len += PyString_GET_SIZE(chunk);
+
+				Py_BEGIN_ALLOW_THREADS
+				g_async_queue_pop(zen->slots);
+				g_async_queue_push(zen->chunks, text);
+				Py_END_ALLOW_THREADS
+				g_idle_add(zen_controller_on_idle, zen);
+
+				if (len >= progress)
+				{
+					zen_controller_progress(zen, req->action, len);
+					progress = len + ZEN_PROGRESS_STEP;
+				}
+			}
+			Py_DECREF(chunk);
+		}
+
+		if (PyErr_Occurred())
+		{
+			PyErr_Print();
+			g_warning("Call to the action failed.");
+		}
+		Py_CLEAR(edit->chunks);
+
+		/* the main thread frees the request after the last one */
+		streams--;
+		g_async_queue_push(zen->chunks, chunk_end);
+		g_idle_add(zen_controller_on_idle, zen);
+	}
+}
+
+
+/* Runs the request's action on its snapshot, with the GIL held */
+static void zen_controller_run_request(ZenController *zen, ZenControllerRequest *req)
+{
+	PyObject *self, *is_cancelled, *text, *view, *editor, *result, *edits;
+
+	self = PyLong_FromVoidPtr(req);
+	if (self == NULL)
+	{
+		PyErr_Print();
+		return;
+	}
+	is_cancelled = PyCFunction_New(&request_cancelled_def, self);
+	Py_DECREF(self);
+	if (is_cancelled == NULL)
+	{
+		PyErr_Print();
+		return;
+	}
+
+	text = PyString_FromStringAndSize(req->text, req->length);
+	/* the string is the editor's copy now */
+	g_free(req->text);
+	req->text = NULL;
+	if (text == NULL)
+	{
+		PyErr_Print();
+		Py_DECREF(is_cancelled);
+		return;
+	}
+
+	/* pair searches in the view go through the index, which the view owns */
+	view = zen_editor_snapshot_view(text, req->tag_index);
+	if (view == NULL)
+	{
+		PyErr_Print();
+		Py_DECREF(text);
+		Py_DECREF(is_cancelled);
+		return;
+	}
+	req->tag_index = NULL;
+
+	editor = PyObject_CallFunction(zen->snapshot_editor, "OiiiszsOO",
+				text, req->sel_start, req->sel_end, req->caret,
+				req->syntax, req->file_name, req->profile, is_cancelled, view);
+	Py_DECREF(text);
+
+	if (editor == NULL)
+	{
+		PyErr_Print();
+		Py_DECREF(view);
+		Py_DECREF(is_cancelled);
+		return;
+	}
+
+	result = PyObject_CallFunctionObjArgs(
+				g_ptr_array_index(zen->action_funcs, req->action), editor, NULL);
+	if (result != NULL)
+	{
+		edits = PyObject_GetAttrString(editor, "edits");
+		if (edits != NULL)
+		{
+			zen_controller_take_edits(zen, req, edits);
+			Py_DECREF(edits);
+		}
+		Py_DECREF(result);
+	}
+
+	if (PyErr_Occurred())
+	{
+		if (PyErr_ExceptionMatches(zen->main_thread_error))
+		{
+			/* it's run again from the start, without the edits so far */
+			PyErr_Clear();
+			req->run_here = TRUE;
+		}
+		else
+		{
+			if (PyErr_ExceptionMatches(zen->cancelled_error))
+				PyErr_Clear();
+			else
+			{
+				PyErr_Print();
+				g_warning("Call to the action failed.");
+			}
+			g_atomic_int_set(&req->cancelled, TRUE);
+		}
+	}
+
+	/* the request is gone once it's applied, should anything keep the editor */
+	PyObject_SetAttrString(editor, "is_cancelled", Py_None);
+	Py_DECREF(editor);
+	Py_DECREF(is_cancelled);
+
+	/* as built or updated by the action, for the document to take back */
+	req->tag_index = zen_editor_content_tag_index(view, TRUE);
+	Py_DECREF(view);
+}
+
+
+static void zen_controller_run_action_here(ZenController *zen, GeanyDocument *doc,
+	guint action_id);
+
+
+static gboolean zen_controller_on_reload(gpointer data)
+{
+	ZenController *zen = data;
+
+	if (g_atomic_int_get(&zen->reload_failed))
+	{
+		ui_set_statusbar(TRUE,
+			_("Zen Coding: Unable to reload the settings, keeping the old ones"));
+	}
+	else
+		ui_set_statusbar(TRUE, _("Zen Coding: Reloaded the settings"));
+
+	return FALSE;
+}
+
+
+/*
+ * Runs on the worker, so actions queued before the reload finish with the
+ * old settings and those queued after it start with the new ones.
+ */
+static void zen_controller_run_reload(ZenController *zen)
+{
+	PyObject *result;
+	gboolean failed = FALSE;
+
+	/* The profiles are kept, they aren't part of the settings */
+	result = PyObject_CallObject(zen->reload_settings, NULL);
+	if (result == NULL)
+	{
+		if (PyErr_Occurred())
+			PyErr_Print();
+		failed = TRUE;
+	}
+	Py_XDECREF(result);
+
+	g_atomic_int_set(&zen->reload_failed, failed);
+	g_idle_add(zen_controller_on_reload, zen);
+}
+
+
+static gpointer zen_controller_worker(gpointer data)
+{
+	ZenController *zen = data;
+	ZenControllerRequest *req;
+	PyGILState_STATE gstate;
+	guint streams;
+
+	while ((req = g_async_queue_pop(zen->requests)) != &quit_request)
+	{
+		if (req == &reload_request)
+		{
+			gstate = PyGILState_Ensure();
+			zen_controller_run_reload(zen);
+			PyGILState_Release(gstate);
+			continue;
+		}
+
+		if (!g_atomic_int_get(&req->cancelled))
+		{
+			gstate = PyGILState_Ensure();
+			zen_controller_run_request(zen, req);
+			PyGILState_Release(gstate);
+		}
+
+		streams = req->streams;
+		g_async_queue_push(zen->done, req);
+		g_idle_add(zen_controller_on_idle, zen);
+
+		if (streams > 0)
+		{
+			gstate = PyGILState_Ensure();
+			zen_controller_stream_edits(zen, req);
+			PyGILState_Release(gstate);
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Whether the request's edits can still be applied to its document */
+static gboolean zen_controller_request_wanted(ZenController *zen, ZenControllerRequest *req)
+{
+	return !g_atomic_int_get(&req->cancelled) && DOC_VALID(req->doc) &&
+		zen_controller_generation(zen, req->doc) == req->generation;
+}
+
+
+/*
+ * Cancels a request the main thread is applying.  What it inserted so far
+ * stays, and the undo action is ended, the rest of its edits are dropped.
+ */
+static void zen_controller_stop_request(ZenController *zen, ZenControllerRequest *req)
+{
+	g_atomic_int_set(&req->cancelled, TRUE);
+
+	if (req->stream != NULL)
+	{
+		zen_editor_stream_free(req->stream);
+		req->stream = NULL;
+	}
+	if (req->undo)
+	{
+		scintilla_send_message(req->doc->editor->sci, SCI_ENDUNDOACTION, 0, 0);
+		req->undo = FALSE;
+	}
+}
+
+
+/*
+ * Inserts the chunks of the streamed edit being applied that are queued so
+ * far, or drops them if the request is cancelled.  Returns FALSE if its
+ * last chunk hasn't been produced yet.
+ */
+static gboolean zen_controller_take_chunks(ZenController *zen, ZenControllerRequest *req)
+{
+	gchar *chunk;
+
+	while ((chunk = g_async_queue_try_pop(zen->chunks)) != NULL)
+	{
+		if (chunk == chunk_end)
+		{
+			if (req->stream != NULL)
+			{
+				zen_editor_stream_free(req->stream);
+				req->stream = NULL;
+			}
+			return TRUE;
+		}
+
+		if (req->stream != NULL)
+			zen_editor_stream_write(req->stream, chunk);
+		g_free(chunk);
+
+		/* the worker can produce the next one */
+		g_async_queue_push(zen->slots, GINT_TO_POINTER(TRUE));
+	}
+
+	return FALSE;
+}
+
+
+/*
+ * Applies the edits of req from the first one not applied yet.  Returns
+ * FALSE when a streamed edit has to wait for more chunks, the next idle
+ * callback goes on from there.  The chunks of a cancelled request are
+ * still taken off the queue, so those of the next one are found.
+ */
+static gboolean zen_controller_apply_request(ZenController *zen, ZenControllerRequest *req)
+{
+	ZenControllerEdit *edit;
+	ScintillaObject *sci;
+
+	/* only the request's own edits may change the document meanwhile */
+	if (!g_atomic_int_get(&req->cancelled) && !zen_controller_request_wanted(zen, req))
+		zen_controller_stop_request(zen, req);
+
+	for (; req->next_edit < req->edits->len; req->next_edit++)
+	{
+		edit = &g_array_index(req->edits, ZenControllerEdit, req->next_edit);
+
+		if (!g_atomic_int_get(&req->cancelled))
+		{
+			sci = req->doc->editor->sci;
+
+			/* all the edits of an action are undone at once */
+			if (!req->undo)
+			{
+				scintilla_send_message(sci, SCI_BEGINUNDOACTION, 0, 0);
+				req->undo = TRUE;
+			}
+
+			switch (edit->type)
+			{
+				case ZEN_EDIT_REPLACE:
+					zen_editor_replace_text(zen->editor, req->doc, edit->text,
+						edit->start, edit->end);
+					break;
+				case ZEN_EDIT_STREAM:
+					/* unless it is waiting for chunks already */
+					if (req->stream == NULL)
+					{
+						req->stream = zen_editor_stream_new(zen->editor, req->doc,
+									edit->start, edit->end);
+						if (req->stream == NULL)
+							zen_controller_stop_request(zen, req);
+					}
+					break;
+				case ZEN_EDIT_SELECT:
+					if (edit->end == -1)
+						sci_set_current_position(sci, edit->start, TRUE);
+					else
+					{
+						sci_set_selection_start(sci, edit->start);
+						sci_set_selection_end(sci, edit->end);
+					}
+					break;
+				case ZEN_EDIT_CARET:
+					sci_set_current_position(sci, edit->start, TRUE);
+					break;
+			}
+		}
+
+		if (edit->type == ZEN_EDIT_STREAM && !zen_controller_take_chunks(zen, req))
+		{
+			/* those were its own changes */
+			if (req->stream != NULL)
+				req->generation = zen_controller_generation(zen, req->doc);
+			return FALSE;
+		}
+	}
+
+	if (req->undo)
+	{
+		scintilla_send_message(req->doc->editor->sci, SCI_ENDUNDOACTION, 0, 0);
+		req->undo = FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/*
+ * Applies the results of finished requests on the main thread, in the
+ * order they were run.  A request with streamed edits stays in
+ * zen->applying until all their chunks are inserted.
+ */
+static gboolean zen_controller_on_idle(gpointer data)
+{
+	ZenController *zen = data;
+	ZenControllerRequest *req;
+	PyGILState_STATE gstate;
+
+	for (;;)
+	{
+		req = zen->applying;
+		if (req == NULL)
+		{
+			if ((req = g_async_queue_try_pop(zen->done)) == NULL)
+				break;
+
+			if (zen->pending == req)
+				zen->pending = NULL;
+
+			if (req->run_here)
+			{
+				if (zen_controller_request_wanted(zen, req))
+				{
+					gstate = PyGILState_Ensure();
+					zen_controller_run_action_here(zen, req->doc, req->action);
+					PyGILState_Release(gstate);
+				}
+				zen_controller_request_free(req);
+				continue;
+			}
+
+			/* the snapshot was of the document as it still is */
+			if (req->tag_index != NULL && zen_controller_request_wanted(zen, req))
+			{
+				zen_tag_index_adopt(req->doc, req->tag_index);
+				req->tag_index = NULL;
+			}
+			zen->applying = req;
+		}
+
+		if (!zen_controller_apply_request(zen, req))
+			break;
+
+		zen->applying = NULL;
+		zen_controller_request_free(req);
+	}
+
+	return FALSE;
+}
+
+
+/* Takes a snapshot of doc for running action on the worker */
+static ZenControllerRequest *
+zen_controller_request_new(ZenController *zen, GeanyDocument *doc, guint action_id)
+{
+	ZenControllerRequest *req;
+	ScintillaObject *sci = doc->editor->sci;
+
+	req = g_new0(ZenControllerRequest, 1);
+	req->action = action_id;
+	req->doc = doc;
+	req->generation = zen_controller_generation(zen, doc);
+	req->length = sci_get_length(sci);
+	req->text = sci_get_contents(sci, req->length + 1);
+	req->tag_index = zen_tag_index_copy(doc, req->length);
+	req->sel_start = sci_get_selection_start(sci);
+	req->sel_end = sci_get_selection_end(sci);
+	req->caret = sci_get_current_position(sci);
+	req->syntax = g_strdup(zen_editor_document_syntax(doc));
+	req->file_name = g_strdup(doc->file_name);
+	req->profile = g_strdup(zen->active_profile != NULL ? zen->active_profile : "html");
+	req->edits = g_array_new(FALSE, FALSE, sizeof(ZenControllerEdit));
+
+	return req;
+}
+
+
+static gboolean zen_controller_runs_on_main_thread(ZenController *zen, guint action_id)
+{
+	ZenAction *action = g_ptr_array_index(zen->actions, action_id);
+
+	return zen->snapshot_editor == NULL || action->main_thread;
+}
+
+
+/* Runs the action on the document itself, with the GIL held */
+static void zen_controller_run_action_here(ZenController *zen, GeanyDocument *doc,
+	guint action_id)
+{
+	PyObject *addr, *result;
 
 	addr = PyLong_FromVoidPtr((void *) doc);
 	if (addr == NULL)
@@ -286,13 +1251,62 @@ void zen_controller_run_action(ZenController *zen, const char *action_name)
 	}
 	Py_XDECREF(result);
 
-	result = PyObject_CallFunction(zen->run_action, "sO", action_name, zen->editor);
+	scintilla_send_message(doc->editor->sci, SCI_BEGINUNDOACTION, 0, 0);
+	result = PyObject_CallFunctionObjArgs(
+				g_ptr_array_index(zen->action_funcs, action_id), zen->editor, NULL);
+	scintilla_send_message(doc->editor->sci, SCI_ENDUNDOACTION, 0, 0);
 	if (result == NULL)
 	{
 		if (PyErr_Occurred())
 			PyErr_Print();
-		g_warning("Call to run_action() failed.");
+		g_warning("Call to the action failed.");
 		return;
 	}
 	Py_XDECREF(result);
 }
+
+
+/* Runs the action at action_id in the actions the controller was created with */
+void zen_controller_run_action(ZenController *zen, guint action_id)
+{
+	ZenControllerRequest *req;
+	PyGILState_STATE gstate;
+	GeanyDocument *doc;
+	ZenAction *action;
+
+	g_return_if_fail(zen != NULL);
+	g_return_if_fail(action_id < zen->actions->len);
+
+	action = g_ptr_array_index(zen->actions, action_id);
+	if (g_ptr_array_index(zen->action_funcs, action_id) == NULL)
+	{
+		ui_set_statusbar(FALSE, _("Zen Coding: There is no '%s' action"), action->name);
+		return;
+	}
+
+	ui_set_statusbar(FALSE, _("Zen Coding: Running '%s' action"), action->label);
+
+	doc = document_get_current();
+	if (!DOC_VALID(doc))
+	{
+		g_warning("No valid document detected.");
+		return;
+	}
+
+	/* whatever is still running was asked for before this */
+	zen_controller_cancel_pending(zen);
+	if (zen->applying != NULL)
+		zen_controller_stop_request(zen, zen->applying);
+
+	if (zen_controller_runs_on_main_thread(zen, action_id))
+	{
+		gstate = PyGILState_Ensure();
+		zen_controller_run_action_here(zen, doc, action_id);
+		PyGILState_Release(gstate);
+		return;
+	}
+
+	req = zen_controller_request_new(zen, doc, action_id);
+	zen->pending = req;
+	g_async_queue_push(zen->requests, req);
+}
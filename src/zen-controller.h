@@ -33,19 +33,54 @@ extern "C" {
 
 typedef struct _ZenController ZenController;
 
+
+/* Seconds spent loading, for the debug output */
+typedef struct
+{
+	gdouble python;		/* starting the interpreter */
+	gdouble modules;	/* importing zencoding and the geany module */
+	gdouble profiles;	/* setting up the profiles */
+}
+ZenControllerTimings;
+
 struct _ZenController
 {
 	PyObject *editor;
-	PyObject *run_action;
+	GPtrArray *actions;			/* ZenAction, by id, owned by the plugin */
+	GPtrArray *action_funcs;	/* function of each action, NULL if missing */
 	PyObject *set_context;
 	PyObject *set_active_profile;
+	PyObject *snapshot_editor;	/* zencoding.interface.snapshot.SnapshotEditor */
+	PyObject *cancelled_error;
+	PyObject *main_thread_error;	/* actions raising it run again on the main thread */
+	PyObject *reload_settings;	/* zencoding.resources.reload_settings */
+
+	gchar *active_profile;
+	volatile gint reload_failed;	/* only accessed atomically */
+	GHashTable *generations;	/* GeanyDocument -> count of changes */
+
+	GThread *worker;
+	GAsyncQueue *requests;		/* for the worker */
+	GAsyncQueue *done;			/* for the main thread */
+	gpointer pending;			/* the request results are still wanted for */
+	gpointer applying;			/* request waiting for chunks of its streamed edits */
+	GAsyncQueue *chunks;		/* of streamed edits, for the main thread */
+	GAsyncQueue *slots;			/* one item for each chunk the worker may queue */
+	volatile gint progress;		/* KiB produced by a streamed edit, atomic */
+	volatile gint progress_action;	/* id of the action producing it, atomic */
+
+	ZenControllerTimings timings;
 };
 
 
-ZenController *zen_controller_new(const char *zendir, const char *profiles_dir);
+ZenController *zen_controller_new(const char *zendir, GPtrArray *profiles,
+	GPtrArray *actions);
 void zen_controller_free(ZenController *zen);
-void zen_controller_run_action(ZenController *zen, const char *action_name);
+void zen_controller_run_action(ZenController *zen, guint action_id);
 void zen_controller_set_active_profile(ZenController *zen, const char *profile);
+void zen_controller_document_changed(ZenController *zen, GeanyDocument *doc);
+void zen_controller_document_closed(ZenController *zen, GeanyDocument *doc);
+void zen_controller_reload_settings(ZenController *zen);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,325 @@
+/*
+ * zen-css.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file contains a native version of the CSS tokenizer in
+ * zencoding/parser/css.py, exposed to Python as geany.css_lex().  Instead
+ * of one dict per token it returns the tokens as a flat array of
+ * (type, start, end) offsets into the source, and it keeps no state between
+ * calls, so it can run on the worker thread.  It follows the CSSEX rules
+ * css.py implements, quirks included, so that both give the same tokens.
+ *
+ * Whenever css.py would raise an exception (unterminated strings, comments
+ * or braces and unrecognized characters), the native lexer gives up and
+ * lets the Python version report it.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include "zen-css.h"
+
+
+#define is_name_char(c) ((c) == '_' || (c) == '-' || g_ascii_isalpha(c))
+#define is_op(c) ((c) != '\0' && strchr("{}[]()+*=.,;:>~|\\%$#@^!", (c)) != NULL)
+#define is_match_op(c) ((c) != '\0' && strchr("*^|$~", (c)) != NULL)
+
+
+/* Length of the newline at pos, 0 if there's none */
+static gsize newline_length(const gchar *source, gsize len, gsize pos)
+{
+	if (source[pos] == '\r')
+		return (pos + 1 < len && source[pos + 1] == '\n') ? 2 : 1;
+
+	return source[pos] == '\n' ? 1 : 0;
+}
+
+
+/* Position after the character at pos, newlines count as one character */
+static gsize next_char(const gchar *source, gsize len, gsize pos)
+{
+	gsize nl = newline_length(source, len, pos);
+
+	return pos + (nl > 0 ? nl : 1);
+}
+
+
+/* Like comment(), "/" followed by "*" then ends at the first "*" and "/" */
+static gsize lex_comment(const gchar *source, gsize len, gsize pos)
+{
+	for (pos += 1; pos + 1 < len; pos++)
+	{
+		if (source[pos] == '*' && source[pos + 1] == '/')
+			return pos + 2;
+	}
+
+	return 0;
+}
+
+
+/* Like str(), a newline can only be escaped with a backslash before it or
+ * at the start of the next line */
+static gsize lex_string(const gchar *source, gsize len, gsize pos)
+{
+	gchar quote = source[pos];
+	gsize nl;
+
+	for (pos += 1; pos < len; )
+	{
+		if (source[pos] == quote)
+			return pos + 1;
+
+		nl = newline_length(source, len, pos);
+		if (nl > 0)
+		{
+			pos += nl;
+			if (pos >= len || source[pos] != '\\')
+				return 0;
+			pos++;
+		}
+		else if (source[pos] == '\\')
+		{
+			if (++pos >= len)
+				return 0;
+			pos = next_char(source, len, pos);
+		}
+		else
+			pos++;
+	}
+
+	return 0;
+}
+
+
+/* Like brace(), which stops one character after a nested "(" */
+static gsize lex_brace(const gchar *source, gsize len, gsize pos)
+{
+	for (pos += 1; pos < len; )
+	{
+		if (source[pos] == ')')
+			return pos + 1;
+
+		if (source[pos] == '(')
+		{
+			if (++pos >= len)
+				return 0;
+			return next_char(source, len, pos);
+		}
+
+		pos = next_char(source, len, pos);
+	}
+
+	return 0;
+}
+
+
+/* Like identifier(), pos is the first character after the name start */
+static gsize lex_identifier(const gchar *source, gsize len, gsize pos)
+{
+	while (pos < len && (is_name_char(source[pos]) || g_ascii_isdigit(source[pos])))
+		pos++;
+
+	return pos;
+}
+
+
+/* Like num(), sets type since "." and "-" don't always start a number */
+static gsize lex_number(const gchar *source, gsize len, gsize pos, gint *type)
+{
+	gchar first = source[pos];
+	gboolean point = (first == '.');
+	gboolean nondigit;
+
+	pos++;
+	nondigit = (pos >= len || !g_ascii_isdigit(source[pos]));
+
+	if (point && nondigit)
+	{
+		*type = '.';
+		return pos;
+	}
+
+	/* -moz-something, the character after "-" always belongs to it */
+	if (first == '-' && nondigit)
+	{
+		*type = ZEN_CSS_IDENTIFIER;
+		if (pos < len)
+			pos = next_char(source, len, pos);
+		return lex_identifier(source, len, pos);
+	}
+
+	while (pos < len && (g_ascii_isdigit(source[pos]) || (!point && source[pos] == '.')))
+	{
+		if (source[pos] == '.')
+			point = TRUE;
+		pos++;
+	}
+
+	*type = ZEN_CSS_NUMBER;
+	return pos;
+}
+
+
+/*
+ * Appends a (type, start, end) triple of gints to tokens for each token in
+ * source.  Returns FALSE if the source can't be tokenized, tokens then only
+ * contains the tokens before the error.
+ */
+gboolean zen_css_lex(const gchar *source, gsize len, GArray *tokens)
+{
+	gsize pos = 0, end, nl;
+	gint token[3];
+	gchar c;
+
+	while (pos < len)
+	{
+		c = source[pos];
+
+		if (c == ' ' || c == '\t')
+		{
+			for (end = pos + 1; end < len && (source[end] == ' ' || source[end] == '\t'); end++)
+				;
+			token[0] = ZEN_CSS_WHITE;
+		}
+		else if (c == '/')
+		{
+			if (pos + 1 < len && source[pos + 1] == '*')
+			{
+				if ((end = lex_comment(source, len, pos)) == 0)
+					return FALSE;
+				token[0] = ZEN_CSS_COMMENT;
+			}
+			else
+			{
+				end = pos + 1;
+				token[0] = '/';
+			}
+		}
+		else if (c == '"' || c == '\'')
+		{
+			if ((end = lex_string(source, len, pos)) == 0)
+				return FALSE;
+			token[0] = ZEN_CSS_STRING;
+		}
+		else if (c == '(')
+		{
+			if ((end = lex_brace(source, len, pos)) == 0)
+				return FALSE;
+			token[0] = ZEN_CSS_BRACE;
+		}
+		else if (c == '-' || c == '.' || g_ascii_isdigit(c))
+			end = lex_number(source, len, pos, &token[0]);
+		else if (is_name_char(c))
+		{
+			end = lex_identifier(source, len, pos + 1);
+			token[0] = ZEN_CSS_IDENTIFIER;
+		}
+		else if (is_op(c))
+		{
+			if (pos + 1 < len && source[pos + 1] == '=' && is_match_op(c))
+			{
+				end = pos + 2;
+				token[0] = ZEN_CSS_MATCH;
+			}
+			else
+			{
+				end = pos + 1;
+				token[0] = (guchar) c;
+			}
+		}
+		else if ((nl = newline_length(source, len, pos)) > 0)
+		{
+			end = pos + nl;
+			token[0] = ZEN_CSS_LINE;
+		}
+		else
+			return FALSE;
+
+		token[1] = (gint) pos;
+		token[2] = (gint) end;
+		g_array_append_vals(tokens, token, 3);
+		pos = end;
+	}
+
+	return TRUE;
+}
+
+
+/* Wraps the tokens in an array.array('i'), which is what css.lex() and
+ * xml.lex() return */
+PyObject *zen_css_py_token_array(GArray *tokens)
+{
+	PyObject *module, *array, *res;
+
+	module = PyImport_ImportModule("array");
+	if (module == NULL)
+		return NULL;
+
+	array = PyObject_CallMethod(module, "array", "s", "i");
+	Py_DECREF(module);
+	if (array == NULL)
+		return NULL;
+
+	res = PyObject_CallMethod(array, "fromstring", "s#", tokens->data,
+		(int) (tokens->len * sizeof(gint)));
+	if (res == NULL)
+	{
+		Py_DECREF(array);
+		return NULL;
+	}
+	Py_DECREF(res);
+
+	return array;
+}
+
+
+PyObject *zen_css_py_lex(PyObject *self, PyObject *args)
+{
+	PyObject *source, *result;
+	const void *buf;
+	Py_ssize_t len;
+	GArray *tokens;
+
+	if (!PyArg_ParseTuple(args, "O", &source))
+		return NULL;
+
+	/* offsets into unicode strings are left to the Python version */
+	if (PyUnicode_Check(source))
+		Py_RETURN_NONE;
+
+	if (PyObject_AsReadBuffer(source, &buf, &len) != 0)
+		return NULL;
+
+	tokens = g_array_sized_new(FALSE, FALSE, sizeof(gint), 3 * (len / 4 + 1));
+
+	if (zen_css_lex((const gchar *) buf, len, tokens))
+		result = zen_css_py_token_array(tokens);
+	else
+	{
+		result = Py_None;
+		Py_INCREF(result);
+	}
+
+	g_array_free(tokens, TRUE);
+
+	return result;
+}
@@ -0,0 +1,56 @@
+/*
+ * zen-css.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_CSS_H
+#define ZEN_CSS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Token types, same values as the TOKEN_* constants in
+ * zencoding/parser/css.py.  Operators use their own character as type.
+ */
+typedef enum
+{
+	ZEN_CSS_WHITE = 1,
+	ZEN_CSS_COMMENT,
+	ZEN_CSS_STRING,
+	ZEN_CSS_BRACE,
+	ZEN_CSS_IDENTIFIER,
+	ZEN_CSS_NUMBER,
+	ZEN_CSS_MATCH,
+	ZEN_CSS_LINE
+} ZenCssTokenType;
+
+
+gboolean zen_css_lex(const gchar *source, gsize len, GArray *tokens);
+
+PyObject *zen_css_py_lex(PyObject *self, PyObject *args);
+PyObject *zen_css_py_token_array(GArray *tokens);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_CSS_H */
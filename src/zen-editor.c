@@ -29,9 +29,14 @@
 #include <Python.h>
 #include <structmember.h>
 #include <stdarg.h>
-#include <regex.h>
 #include <geanyplugin.h>
+#include "zen-matcher.h"
+#include "zen-tag-index.h"
 #include "zen-editor.h"
+#include "zen-abbreviation.h"
+#include "zen-css.h"
+#include "zen-image.h"
+#include "zen-xml.h"
 
 
 extern GeanyPlugin		*geany_plugin;
@@ -80,6 +85,19 @@ static void _debug_print(const char *file, int line, const char *function, const
 }
 
 
+/*
+ * Scintilla indicator marking the tabstops of the last expansion, Geany
+ * uses the first few container indicators itself.
+ */
+#define ZEN_EDITOR_TABSTOP_INDICATOR (INDIC_CONTAINER + 4)
+
+/*
+ * Hidden indicator over the whole text of that expansion, the tabstops are
+ * cleared once the caret or an edit is outside of it.
+ */
+#define ZEN_EDITOR_EXPANSION_INDICATOR (INDIC_CONTAINER + 5)
+
+
 typedef struct
 {
 	PyObject_HEAD
@@ -88,296 +106,1425 @@ typedef struct
 	PyObject *context;
 
 	gchar *caret_placeholder;
+	GArray *tabstops;	/* ZenEditorTabstop from the last replace_content() */
 
 } ZenEditor;
 
 
-static GeanyDocument *
-ZenEditor_get_context(ZenEditor *self)
+typedef struct
+{
+	gint number;		/* 1 for ${1:value} */
+	gint start;
+	gint end;
+	gboolean mirror;	/* $1 or ${1}, repeating the value of ${1:value} */
+
+} ZenEditorTabstop;
+
+
+/*
+ * Bumped by zen_editor_content_changed() whenever text is inserted into or
+ * deleted from any document.  ZenContent views remember the value at the
+ * time they were created and refuse to hand out their pointer once it has
+ * moved on, since Scintilla is free to reallocate the buffer on any change.
+ *
+ * Views of a snapshot of a document read from a string they hold a
+ * reference to instead, and stay valid.  Pair searches in them go through
+ * the copy of the tag index taken with the snapshot.
+ */
+static gulong content_generation = 0;
+
+
+typedef struct
+{
+	PyObject_HEAD
+
+	GeanyDocument *doc;
+	ScintillaObject *sci;
+	const gchar *data;
+	Py_ssize_t length;
+	gulong generation;
+	PyObject *text;			/* string of a snapshot view, NULL otherwise */
+	ZenTagIndex *index;		/* of a snapshot view, owned */
+
+} ZenContent;
+
+
+static PyTypeObject ZenContentType;
+
+
+void zen_editor_content_changed(void)
+{
+	content_generation++;
+}
+
+
+static gboolean
+ZenContent_check(ZenContent *self)
+{
+	if (self->text != NULL)
+		return TRUE;
+
+	if (self->generation != content_generation || !DOC_VALID(self->doc) ||
+		self->doc->editor == NULL || self->doc->editor->sci != self->sci)
+	{
+		PyErr_SetString(PyExc_ValueError,
+			"content view is no longer valid, the document was modified");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+/*
+ * Returns the document a still valid ZenContent object reads from, or NULL
+ * for any other object, without setting a Python exception.
+ */
+GeanyDocument *zen_editor_content_document(PyObject *obj)
+{
+	ZenContent *self;
+
+	if (!PyObject_TypeCheck(obj, &ZenContentType))
+		return NULL;
+
+	self = (ZenContent *) obj;
+	if (self->text != NULL || self->generation != content_generation || !DOC_VALID(self->doc) ||
+		self->doc->editor == NULL || self->doc->editor->sci != self->sci)
+	{
+		return NULL;
+	}
+
+	return self->doc;
+}
+
+
+static PyObject *
+ZenContent_new_for_sci(GeanyDocument *doc, ScintillaObject *sci)
+{
+	ZenContent *self;
+
+	self = PyObject_New(ZenContent, &ZenContentType);
+	if (self == NULL)
+		return NULL;
+
+	self->doc = doc;
+	self->sci = sci;
+	self->length = sci_get_length(sci);
+	/* Closes the gap and returns a pointer to the contiguous, NUL-terminated
+	 * text.  It stays valid until the next modification of the document. */
+	self->data = (const gchar *) scintilla_send_message(sci,
+					SCI_GETCHARACTERPOINTER, 0, 0);
+	self->generation = content_generation;
+	self->text = NULL;
+	self->index = NULL;
+
+	return (PyObject *) self;
+}
+
+
+/*
+ * Returns a view of text, a snapshot of a document, searched through index
+ * from then on.  The view owns index.
+ */
+PyObject *zen_editor_snapshot_view(PyObject *text, ZenTagIndex *index)
+{
+	ZenContent *self;
+
+	g_return_val_if_fail(PyString_Check(text), NULL);
+
+	self = PyObject_New(ZenContent, &ZenContentType);
+	if (self == NULL)
+		return NULL;
+
+	self->doc = NULL;
+	self->sci = NULL;
+	self->data = PyString_AS_STRING(text);
+	self->length = PyString_GET_SIZE(text);
+	self->generation = content_generation;
+	Py_INCREF(text);
+	self->text = text;
+	self->index = index;
+
+	return (PyObject *) self;
+}
+
+
+/*
+ * Returns the tag index of a snapshot view, or NULL for any other object,
+ * without setting a Python exception.  With take, the view gives it up.
+ */
+ZenTagIndex *zen_editor_content_tag_index(PyObject *obj, gboolean take)
+{
+	ZenContent *self;
+	ZenTagIndex *index;
+
+	if (!PyObject_TypeCheck(obj, &ZenContentType))
+		return NULL;
+
+	self = (ZenContent *) obj;
+	index = self->index;
+	if (take)
+		self->index = NULL;
+
+	return index;
+}
+
+
+static void
+ZenContent_dealloc(ZenContent *self)
+{
+	Py_XDECREF(self->text);
+	if (self->index != NULL)
+		zen_tag_index_free(self->index);
+	PyObject_Del(self);
+}
+
+
+static Py_ssize_t
+ZenContent_length(ZenContent *self)
+{
+	if (!ZenContent_check(self))
+		return -1;
+	return self->length;
+}
+
+
+static PyObject *
+ZenContent_item(ZenContent *self, Py_ssize_t i)
+{
+	if (!ZenContent_check(self))
+		return NULL;
+
+	if (i < 0 || i >= self->length)
+	{
+		PyErr_SetString(PyExc_IndexError, "content index out of range");
+		return NULL;
+	}
+
+	return PyString_FromStringAndSize(self->data + i, 1);
+}
+
+
+static PyObject *
+ZenContent_slice(ZenContent *self, Py_ssize_t start, Py_ssize_t end)
+{
+	if (!ZenContent_check(self))
+		return NULL;
+
+	start = CLAMP(start, 0, self->length);
+	end = CLAMP(end, start, self->length);
+
+	return PyString_FromStringAndSize(self->data + start, end - start);
+}
+
+
+static Py_ssize_t
+ZenContent_get_read_buffer(ZenContent *self, Py_ssize_t segment, void **ptr)
+{
+	if (segment != 0)
+	{
+		PyErr_SetString(PyExc_SystemError, "accessing non-existent content segment");
+		return -1;
+	}
+
+	if (!ZenContent_check(self))
+		return -1;
+
+	*ptr = (void *) self->data;
+	return self->length;
+}
+
+
+static Py_ssize_t
+ZenContent_get_seg_count(ZenContent *self, Py_ssize_t *lenp)
+{
+	if (lenp != NULL)
+	{
+		*lenp = (self->text != NULL || self->generation == content_generation) ?
+			self->length : 0;
+	}
+	return 1;
+}
+
+
+static int
+ZenContent_get_buffer(ZenContent *self, Py_buffer *view, int flags)
+{
+	if (!ZenContent_check(self))
+		return -1;
+
+	return PyBuffer_FillInfo(view, (PyObject *) self, (void *) self->data,
+				self->length, 1, flags);
+}
+
+
+static PyObject *
+ZenContent_str(ZenContent *self)
+{
+	return ZenContent_slice(self, 0, self->length);
+}
+
+
+/*
+ * Same as str.find(), so that code which only searches the document does
+ * not have to copy it first.
+ */
+static PyObject *
+ZenContent_find(ZenContent *self, PyObject *args)
+{
+	const gchar *sub, *found;
+	gint sub_len;
+	Py_ssize_t start = 0, end = PY_SSIZE_T_MAX;
+
+	if (!PyArg_ParseTuple(args, "s#|nn", &sub, &sub_len, &start, &end))
+		return NULL;
+
+	if (!ZenContent_check(self))
+		return NULL;
+
+	if (start < 0)
+		start = MAX(start + self->length, 0);
+	if (end < 0)
+		end = MAX(end + self->length, 0);
+	end = MIN(end, self->length);
+
+	if (end - start < sub_len)
+		return PyInt_FromLong(-1);
+
+	if (sub_len == 0)
+		return PyInt_FromSsize_t(start);
+
+	for (found = self->data + start; found <= self->data + end - sub_len; found++)
+	{
+		found = memchr(found, sub[0], (self->data + end - sub_len + 1) - found);
+		if (found == NULL)
+			break;
+		if (memcmp(found, sub, sub_len) == 0)
+			return PyInt_FromSsize_t(found - self->data);
+	}
+
+	return PyInt_FromLong(-1);
+}
+
+
+static PyMethodDef ZenContent_methods[] = {
+	{"find", (PyCFunction)ZenContent_find, METH_VARARGS},
+	{NULL}
+};
+
+
+static PySequenceMethods ZenContent_as_sequence = {
+	(lenfunc)ZenContent_length,			/* sq_length */
+	0,									/* sq_concat */
+	0,									/* sq_repeat */
+	(ssizeargfunc)ZenContent_item,		/* sq_item */
+	(ssizessizeargfunc)ZenContent_slice, /* sq_slice */
+	0,									/* sq_ass_item */
+	0,									/* sq_ass_slice */
+	0,									/* sq_contains */
+};
+
+
+static PyBufferProcs ZenContent_as_buffer = {
+	(readbufferproc)ZenContent_get_read_buffer,	/* bf_getreadbuffer */
+	0,											/* bf_getwritebuffer */
+	(segcountproc)ZenContent_get_seg_count,		/* bf_getsegcount */
+	(charbufferproc)ZenContent_get_read_buffer,	/* bf_getcharbuffer */
+	(getbufferproc)ZenContent_get_buffer,		/* bf_getbuffer */
+	0,											/* bf_releasebuffer */
+};
+
+
+static PyTypeObject ZenContentType = {
+	PyObject_HEAD_INIT(NULL)
+	0,							/*ob_size*/
+	"geany.ZenContent",			/*tp_name*/
+	sizeof(ZenContent),			/*tp_basicsize*/
+	0,							/*tp_itemsize*/
+	(destructor)ZenContent_dealloc, /*tp_dealloc*/
+	0,							/*tp_print*/
+	0,							/*tp_getattr*/
+	0,							/*tp_setattr*/
+	0,							/*tp_compare*/
+	0,							/*tp_repr*/
+	0,							/*tp_as_number*/
+	&ZenContent_as_sequence,	/*tp_as_sequence*/
+	0,							/*tp_as_mapping*/
+	0,							/*tp_hash */
+	0,							/*tp_call*/
+	(reprfunc)ZenContent_str,	/*tp_str*/
+	0,							/*tp_getattro*/
+	0,							/*tp_setattro*/
+	&ZenContent_as_buffer,		/*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GETCHARBUFFER |
+		Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+	"Read-only view of a document's text, valid until it is modified", /* tp_doc */
+	0,							/* tp_traverse */
+	0,							/* tp_clear */
+	0,							/* tp_richcompare */
+	0,							/* tp_weaklistoffset */
+	0,							/* tp_iter */
+	0,							/* tp_iternext */
+	ZenContent_methods,			/* tp_methods */
+};
+
+
+static GeanyDocument *
+ZenEditor_get_context(ZenEditor *self)
+{
+	GeanyDocument *doc;
+
+	print_called();
+
+	if (self->context == NULL)
+		return NULL;
+
+	doc = (GeanyDocument *) PyLong_AsVoidPtr(self->context);
+	return DOC_VALID(doc) ? doc : NULL;
+}
+
+
+static ScintillaObject *
+ZenEditor_get_scintilla(ZenEditor *self)
+{
+	GeanyDocument *doc;
+
+	print_called();
+
+	doc = ZenEditor_get_context(self);
+	if (doc == NULL || doc->editor == NULL || doc->editor->sci == NULL)
+		return NULL;
+
+	return doc->editor->sci;
+}
+
+
+static PyObject *
+ZenEditor_get_selection_range(ZenEditor *self, PyObject *args)
+{
+	PyObject *result;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	result = Py_BuildValue("(ii)",
+				sci_get_selection_start(sci),
+				sci_get_selection_end(sci));
+	py_return_none_if_null(result);
+
+	return result;
+}
+
+
+static PyObject *
+ZenEditor_create_selection(ZenEditor *self, PyObject *args)
+{
+	gint sel_start = -1, sel_end = -1;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (PyArg_ParseTuple(args, "i|i", &sel_start, &sel_end))
+	{
+		if (sel_end == -1)
+			sci_set_current_position(sci, sel_start, TRUE);
+		else
+		{
+			sci_set_selection_start(sci, sel_start);
+			sci_set_selection_end(sci, sel_end);
+		}
+	}
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ZenEditor_get_current_line_range(ZenEditor *self, PyObject *args)
+{
+	PyObject *result;
+	gint line, line_start, line_end;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	line = sci_get_current_line(sci);
+	line_start = sci_get_position_from_line(sci, line);
+	line_end = sci_get_line_end_position(sci, line);
+
+	result = Py_BuildValue("ii", line_start, line_end);
+	return result;
+}
+
+
+static PyObject *
+ZenEditor_get_caret_pos(ZenEditor *self, PyObject *args)
+{
+	PyObject *result;
+	gint pos;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	pos = sci_get_current_position(sci);
+	result = Py_BuildValue("i", pos);
+
+	return result;
+}
+
+
+static PyObject *
+ZenEditor_set_caret_pos(ZenEditor *self, PyObject *args)
+{
+	gint pos;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (PyArg_ParseTuple(args, "i", &pos))
+		sci_set_current_position(sci, pos, TRUE);
+
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ZenEditor_get_current_line(ZenEditor *self, PyObject *args)
+{
+	PyObject *result;
+	gchar *line;
+	ScintillaObject *sci;
+
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	line = sci_get_line(sci, sci_get_current_line(sci));
+	result = Py_BuildValue("s", line);
+	g_free(line);
+
+	return result;
+}
+
+
+/*
+ * Copies the text between start and end (clamped to the document) straight
+ * into a new Python string using SCI_GETTEXTRANGE, so only the requested
+ * region is ever copied.
+ */
+static PyObject *
+ZenEditor_text_range(ScintillaObject *sci, gint start, gint end)
+{
+	PyObject *result;
+	struct Sci_TextRange tr;
+	gint length;
+
+	length = sci_get_length(sci);
+	start = CLAMP(start, 0, length);
+	end = CLAMP(end, start, length);
+
+	result = PyString_FromStringAndSize(NULL, end - start);
+	if (result == NULL)
+		return NULL;
+
+	if (end > start)
+	{
+		tr.chrg.cpMin = start;
+		tr.chrg.cpMax = end;
+		tr.lpstrText = PyString_AS_STRING(result);
+		scintilla_send_message(sci, SCI_GETTEXTRANGE, 0, (sptr_t) &tr);
+	}
+
+	return result;
+}
+
+
+static PyObject *
+ZenEditor_get_content_range(ZenEditor *self, PyObject *args)
+{
+	gint start, end;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (!PyArg_ParseTuple(args, "ii", &start, &end))
+		return NULL;
+
+	return ZenEditor_text_range(sci, start, end);
+}
+
+
+static PyObject *
+ZenEditor_char_at(ZenEditor *self, PyObject *args)
+{
+	gint pos;
+	gchar ch;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (!PyArg_ParseTuple(args, "i", &pos))
+		return NULL;
+
+	/* Like zencoding.utils.char_at(), out of range gives an empty string */
+	if (pos < 0 || pos >= sci_get_length(sci))
+		return PyString_FromString("");
+
+	ch = sci_get_char_at(sci, pos);
+	return PyString_FromStringAndSize(&ch, 1);
+}
+
+
+/*
+ * Returns the text of line number `line` without its line ending, or an
+ * empty string if there is no such line.
+ */
+static PyObject *
+ZenEditor_get_line(ZenEditor *self, PyObject *args)
+{
+	gint line;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (!PyArg_ParseTuple(args, "i", &line))
+		return NULL;
+
+	if (line < 0 || line >= sci_get_line_count(sci))
+		return PyString_FromString("");
+
+	return ZenEditor_text_range(sci, sci_get_position_from_line(sci, line),
+				sci_get_line_end_position(sci, line));
+}
+
+/*
+ * Output of replace_content() and replace_content_stream() on its way into
+ * the document.  Caret placeholders are removed and tabstops replaced as
+ * the text goes by, so it can arrive in chunks of any size:
+ *
+ *   ${1:value}  is replaced with value (which may contain other tabstops)
+ *   ${1}, $1    are replaced with the value of an earlier ${1:value}, and
+ *               left as they are without one
+ *   \$, \\, ...  are replaced with the escaped character
+ *
+ * This is the same syntax as zencoding.utils.process_text_before_paste(),
+ * so text taken from the document must go through
+ * zencoding.utils.escape_text() first, and expanded abbreviations, which
+ * the filters have unescaped already, through escape_output().  Every
+ * tabstop, including the mirrors, is appended to the tabstops array with
+ * its offset in the output.
+ *
+ * Example:
+ *   'border-radius: ${1:4px}; -moz-border-radius: $1;'
+ * becomes
+ *   'border-radius: 4px; -moz-border-radius: 4px;'
+ */
+struct _ZenEditorStream
+{
+	ScintillaObject *sci;
+	const gchar *placeholder;
+	gsize ph_len;
+	GArray *tabstops;		/* ZenEditorTabstop */
+	GArray *open;			/* tabstops index and brace depth of open values */
+	gint depth;
+	gint first_pos;			/* of the first caret placeholder, or -1 */
+	gint offset;			/* document position of the output */
+	gint written;			/* length of the output already in the document */
+	GString *pending;		/* input whose meaning depends on the next chunk */
+	GString *out;			/* output not yet in the document */
+	gboolean move_caret;	/* put the caret after the output by default */
+};
+
+
+/*
+ * Appends the output between start and end to stream->out again, reading
+ * the part that was already written from the document.
+ */
+static void
+ZenEditor_stream_copy(ZenEditorStream *stream, gint start, gint end)
+{
+	struct Sci_TextRange tr;
+	gsize len;
+
+	if (start < stream->written)
+	{
+		len = stream->out->len;
+		tr.chrg.cpMin = stream->offset + start;
+		tr.chrg.cpMax = stream->offset + MIN(end, stream->written);
+		g_string_set_size(stream->out, len + (tr.chrg.cpMax - tr.chrg.cpMin));
+		tr.lpstrText = stream->out->str + len;
+		scintilla_send_message(stream->sci, SCI_GETTEXTRANGE, 0, (sptr_t) &tr);
+		start = MIN(end, stream->written);
+	}
+
+	if (end > start)
+	{
+		g_string_append_len(stream->out,
+			stream->out->str + (start - stream->written), end - start);
+	}
+}
+
+
+/*
+ * Processes len bytes of the NUL-terminated text into stream->out and
+ * returns how many were used.  Unless this is the last chunk, a caret
+ * placeholder or tabstop that may continue in the next chunk is left
+ * unused at the end.
+ */
+static gsize
+ZenEditor_stream_process(ZenEditorStream *stream, const gchar *text,
+	gsize len, gboolean last)
+{
+	GString *out = stream->out;
+	ZenEditorTabstop tabstop, *ts;
+	const gchar *p, *end, *num_start, *num_end;
+	gboolean braced;
+	guint i;
+
+	end = text + len;
+
+	for (p = text; p < end; )
+	{
+		if (stream->ph_len > 0 && *p == stream->placeholder[0])
+		{
+			if ((gsize) (end - p) >= stream->ph_len)
+			{
+				if (strncmp(p, stream->placeholder, stream->ph_len) == 0)
+				{
+					if (stream->first_pos == -1)
+						stream->first_pos = stream->written + out->len;
+					p += stream->ph_len;
+					continue;
+				}
+			}
+			else if (!last && strncmp(p, stream->placeholder, end - p) == 0)
+				break;
+		}
+
+		if (*p == '\\')
+		{
+			/* an escaped character is copied as it is */
+			if (p + 1 < end)
+				p++;
+			else if (!last)
+				break;
+			g_string_append_c(out, *p);
+			p++;
+			continue;
+		}
+
+		if (*p == '$')
+		{
+			if (p + 1 == end && !last)
+				break;
+
+			braced = (p + 1 < end && p[1] == '{');
+			num_start = p + (braced ? 2 : 1);
+			for (num_end = num_start; num_end < end && g_ascii_isdigit(*num_end); num_end++)
+				;
+
+			/* the number, or what follows it, may be in the next chunk */
+			if (num_end >= end && !last)
+				break;
+
+			if (num_end > num_start &&
+				(!braced || (num_end < end && (*num_end == '}' || *num_end == ':'))))
+			{
+				tabstop.number = atoi(num_start);
+				tabstop.start = tabstop.end = stream->written + out->len;
+				tabstop.mirror = !braced || *num_end == '}';
+
+				if (tabstop.mirror)
+				{
+					/* copy the value of the tabstop it mirrors */
+					for (i = 0; i < stream->tabstops->len; i++)
+					{
+						ts = &g_array_index(stream->tabstops, ZenEditorTabstop, i);
+						if (ts->number == tabstop.number && !ts->mirror)
+							break;
+					}
+					/* without one it is just text, like the price in "$5.00" */
+					if (i == stream->tabstops->len)
+					{
+						num_end = braced ? num_end + 1 : num_end;
+						g_string_append_len(out, p, num_end - p);
+						p = num_end;
+						continue;
+					}
+					ZenEditor_stream_copy(stream, ts->start, ts->end);
+					tabstop.end = stream->written + out->len;
+					g_array_append_val(stream->tabstops, tabstop);
+					p = braced ? num_end + 1 : num_end;
+				}
+				else
+				{
+					/* the value is copied as it is scanned, the tabstop's
+					 * end is filled in at the matching '}' */
+					g_array_append_val(stream->tabstops, tabstop);
+					i = stream->tabstops->len - 1;
+					g_array_append_val(stream->open, i);
+					g_array_append_val(stream->open, stream->depth);
+					stream->depth = 0;
+					p = num_end + 1;
+				}
+				continue;
+			}
+		}
+		else if (stream->open->len > 0 && *p == '{')
+			stream->depth++;
+		else if (stream->open->len > 0 && *p == '}')
+		{
+			if (stream->depth == 0)
+			{
+				/* end of the innermost open tabstop value */
+				stream->depth = g_array_index(stream->open, gint, stream->open->len - 1);
+				i = g_array_index(stream->open, gint, stream->open->len - 2);
+				g_array_index(stream->tabstops, ZenEditorTabstop, i).end =
+					stream->written + out->len;
+				g_array_set_size(stream->open, stream->open->len - 2);
+				p++;
+				continue;
+			}
+			stream->depth--;
+		}
+
+		g_string_append_c(out, *p);
+		p++;
+	}
+
+	return p - text;
+}
+
+
+/* Processes the next chunk of text and inserts the result into the document */
+static void
+ZenEditor_stream_write(ZenEditorStream *stream, const gchar *text, gsize len,
+	gboolean last)
+{
+	gsize used;
+
+	if (stream->pending->len == 0)
+	{
+		used = ZenEditor_stream_process(stream, text, len, last);
+		g_string_append_len(stream->pending, text + used, len - used);
+	}
+	else
+	{
+		g_string_append_len(stream->pending, text, len);
+		used = ZenEditor_stream_process(stream, stream->pending->str,
+					stream->pending->len, last);
+		g_string_erase(stream->pending, 0, used);
+	}
+
+	if (stream->out->len > 0)
+	{
+		sci_insert_text(stream->sci, stream->offset + stream->written,
+			stream->out->str);
+		stream->written += stream->out->len;
+		g_string_truncate(stream->out, 0);
+	}
+}
+
+
+static void
+ZenEditor_clear_tabstops(ScintillaObject *sci)
+{
+	gint len = sci_get_length(sci);
+
+	scintilla_send_message(sci, SCI_SETINDICATORCURRENT,
+		ZEN_EDITOR_TABSTOP_INDICATOR, 0);
+	scintilla_send_message(sci, SCI_INDICATORCLEARRANGE, 0, len);
+	scintilla_send_message(sci, SCI_SETINDICATORCURRENT,
+		ZEN_EDITOR_EXPANSION_INDICATOR, 0);
+	scintilla_send_message(sci, SCI_INDICATORCLEARRANGE, 0, len);
+}
+
+
+/*
+ * Replaces the tabstop indicators in the document with the non-empty
+ * tabstops in the array, and marks start to end as the expansion they
+ * belong to.  Scintilla keeps them in place as the text around them is
+ * edited, so they can be navigated without parsing the text again.
+ * Neighbouring tabstops get different indicator values so their ranges
+ * don't merge.
+ */
+static void
+ZenEditor_mark_tabstops(ScintillaObject *sci, GArray *tabstops, gint start, gint end)
+{
+	ZenEditorTabstop *ts;
+	gboolean marked = FALSE;
+	guint i;
+
+	ZenEditor_clear_tabstops(sci);
+
+	if (tabstops->len == 0)
+		return;
+
+	scintilla_send_message(sci, SCI_INDICSETSTYLE,
+		ZEN_EDITOR_TABSTOP_INDICATOR, INDIC_DOTBOX);
+	scintilla_send_message(sci, SCI_SETINDICATORCURRENT,
+		ZEN_EDITOR_TABSTOP_INDICATOR, 0);
+
+	for (i = 0; i < tabstops->len; i++)
+	{
+		ts = &g_array_index(tabstops, ZenEditorTabstop, i);
+		if (ts->mirror || ts->end <= ts->start)
+			continue;
+		scintilla_send_message(sci, SCI_SETINDICATORVALUE, ts->number + 1, 0);
+		scintilla_send_message(sci, SCI_INDICATORFILLRANGE, ts->start,
+			ts->end - ts->start);
+		marked = TRUE;
+	}
+
+	if (marked && end > start)
+	{
+		scintilla_send_message(sci, SCI_INDICSETSTYLE,
+			ZEN_EDITOR_EXPANSION_INDICATOR, INDIC_HIDDEN);
+		scintilla_send_message(sci, SCI_SETINDICATORCURRENT,
+			ZEN_EDITOR_EXPANSION_INDICATOR, 0);
+		scintilla_send_message(sci, SCI_SETINDICATORVALUE, 1, 0);
+		scintilla_send_message(sci, SCI_INDICATORFILLRANGE, start, end - start);
+	}
+}
+
+
+/* TRUE if the caret should visit tabstop a before tabstop b */
+static gboolean
+ZenEditor_tabstop_before(const ZenEditorTabstop *a, const ZenEditorTabstop *b)
+{
+	/* $0 is the final caret position */
+	if ((a->number == 0) != (b->number == 0))
+		return b->number == 0;
+	if (a->number != b->number)
+		return a->number < b->number;
+	return b->mirror && !a->mirror;
+}
+
+
+/*
+ * Returns the tabstop the caret should go to first, or NULL if there are
+ * no tabstops.
+ */
+static ZenEditorTabstop *
+ZenEditor_first_tabstop(GArray *tabstops)
+{
+	ZenEditorTabstop *ts, *first = NULL;
+	guint i;
+
+	for (i = 0; i < tabstops->len; i++)
+	{
+		ts = &g_array_index(tabstops, ZenEditorTabstop, i);
+		if (first == NULL || ZenEditor_tabstop_before(ts, first))
+			first = ts;
+	}
+
+	return first;
+}
+
+/*
+ * Starts an undo action and removes the text the output replaces: the
+ * whole document if sel_start and sel_end are both -1, nothing if only
+ * sel_end is, else the text between them.  Returns FALSE, without touching
+ * the document, for any other combination.
+ */
+static gboolean
+ZenEditor_stream_begin(ZenEditor *self, ScintillaObject *sci, gint sel_start,
+	gint sel_end, ZenEditorStream *stream)
 {
-	GeanyDocument *doc;
-
-	print_called();
+	if (sel_start == -1 && sel_end != -1)
+	{
+		dbgf("Invalid arguments were supplied.");
+		return FALSE;
+	}
 
-	if (self->context == NULL)
-		return NULL;
+	g_array_set_size(self->tabstops, 0);
+
+	stream->sci = sci;
+	stream->placeholder = self->caret_placeholder;
+	stream->ph_len = (self->caret_placeholder != NULL) ?
+		strlen(self->caret_placeholder) : 0;
+	stream->tabstops = self->tabstops;
+	stream->open = g_array_new(FALSE, FALSE, sizeof(gint));
+	stream->depth = 0;
+	stream->first_pos = -1;
+	stream->offset = (sel_start == -1) ? 0 : sel_start;
+	stream->written = 0;
+	stream->pending = g_string_new(NULL);
+	stream->out = g_string_new(NULL);
+	stream->move_caret = (sel_end != -1);
+
+	scintilla_send_message(sci, SCI_BEGINUNDOACTION, 0, 0);
+
+	if (sel_start == -1)
+	{
+		/* replace whole editor content */
+		sci_set_text(sci, "");
+	}
+	else if (sel_end != -1)
+	{
+		/* replace from sel_start to sel_end */
+		sci_set_selection_start(sci, sel_start);
+		sci_set_selection_end(sci, sel_end);
+		sci_replace_sel(sci, "");
+	}
 
-	doc = (GeanyDocument *) PyLong_AsVoidPtr(self->context);
-	return DOC_VALID(doc) ? doc : NULL;
+	return TRUE;
 }
 
 
-static ScintillaObject *
-ZenEditor_get_scintilla(ZenEditor *self)
+/*
+ * Writes out whatever input is left, ends the undo action, marks the
+ * tabstops and places the caret.
+ */
+static void
+ZenEditor_stream_end(ZenEditorStream *stream)
 {
-	GeanyDocument *doc;
+	ZenEditorTabstop *ts;
+	guint i;
 
-	print_called();
+	if (stream->pending->len > 0)
+		ZenEditor_stream_write(stream, "", 0, TRUE);
 
-	doc = ZenEditor_get_context(self);
-	if (doc == NULL || doc->editor == NULL || doc->editor->sci == NULL)
-		return NULL;
+	scintilla_send_message(stream->sci, SCI_ENDUNDOACTION, 0, 0);
 
-	return doc->editor->sci;
+	/* unterminated values run to the end of the text */
+	for (i = 0; i < stream->open->len; i += 2)
+	{
+		g_array_index(stream->tabstops, ZenEditorTabstop,
+			g_array_index(stream->open, gint, i)).end = stream->written;
+	}
+
+	/* Make the tabstops document offsets */
+	for (i = 0; i < stream->tabstops->len; i++)
+	{
+		ts = &g_array_index(stream->tabstops, ZenEditorTabstop, i);
+		ts->start += stream->offset;
+		ts->end += stream->offset;
+	}
+
+	ZenEditor_mark_tabstops(stream->sci, stream->tabstops, stream->offset,
+		stream->offset + stream->written);
+
+	/* Select the first tabstop's value or move the cursor to it, else
+	 * to the first placeholder position, if found */
+	ts = ZenEditor_first_tabstop(stream->tabstops);
+	if (ts != NULL)
+	{
+		sci_set_current_position(stream->sci, ts->start, TRUE);
+		if (ts->end > ts->start)
+			sci_set_selection_end(stream->sci, ts->end);
+	}
+	else if (stream->first_pos > -1)
+		sci_set_current_position(stream->sci, stream->offset + stream->first_pos, TRUE);
+	else if (stream->move_caret)
+		sci_set_current_position(stream->sci, stream->offset + stream->written, TRUE);
+
+	g_array_free(stream->open, TRUE);
+	g_string_free(stream->pending, TRUE);
+	g_string_free(stream->out, TRUE);
 }
 
 
 static PyObject *
-ZenEditor_get_selection_range(ZenEditor *self, PyObject *args)
+ZenEditor_replace_content(ZenEditor *self, PyObject *args)
 {
-	PyObject *result;
+	gint sel_start = -1, sel_end = -1;
+	gchar *text;
+	ZenEditorStream stream;
 	ScintillaObject *sci;
 
 	print_called();
 	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
 
-	result = Py_BuildValue("(ii)",
-				sci_get_selection_start(sci),
-				sci_get_selection_end(sci));
-	py_return_none_if_null(result);
+	if (PyArg_ParseTuple(args, "s|ii", &text, &sel_start, &sel_end))
+	{
+		if (ZenEditor_stream_begin(self, sci, sel_start, sel_end, &stream))
+		{
+			ZenEditor_stream_write(&stream, text, strlen(text), TRUE);
+			ZenEditor_stream_end(&stream);
+		}
+	}
+	else
+	{
+		if (PyErr_Occurred())
+		{
+			PyErr_Print();
+			PyErr_Clear();
+		}
+	}
 
-	return result;
+	Py_RETURN_NONE;
 }
 
 
+/*
+ * Like replace_content(), but takes any iterable of strings and inserts
+ * them into the document as they come, in a single undo action, so the
+ * whole text is never held in memory at once.
+ */
 static PyObject *
-ZenEditor_create_selection(ZenEditor *self, PyObject *args)
+ZenEditor_replace_content_stream(ZenEditor *self, PyObject *args)
 {
 	gint sel_start = -1, sel_end = -1;
+	gchar *text;
+	PyObject *chunks, *iter, *item;
+	ZenEditorStream stream;
 	ScintillaObject *sci;
 
 	print_called();
 	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
 
-	if (PyArg_ParseTuple(args, "i|i", &sel_start, &sel_end))
+	if (PyArg_ParseTuple(args, "O|ii", &chunks, &sel_start, &sel_end) &&
+		(iter = PyObject_GetIter(chunks)) != NULL)
 	{
-		if (sel_end == -1)
-			sci_set_current_position(sci, sel_start, TRUE);
-		else
+		if (ZenEditor_stream_begin(self, sci, sel_start, sel_end, &stream))
 		{
-			sci_set_selection_start(sci, sel_start);
-			sci_set_selection_end(sci, sel_end);
+			while ((item = PyIter_Next(iter)) != NULL)
+			{
+				if (PyString_AsStringAndSize(item, &text, NULL) == 0)
+					ZenEditor_stream_write(&stream, text, strlen(text), FALSE);
+				Py_DECREF(item);
+				if (PyErr_Occurred())
+					break;
+			}
+			/* whatever was inserted before an error stays, it can be
+			 * undone in one go */
+			ZenEditor_stream_end(&stream);
 		}
+		Py_DECREF(iter);
+	}
+
+	if (PyErr_Occurred())
+	{
+		PyErr_Print();
+		PyErr_Clear();
 	}
 
 	Py_RETURN_NONE;
 }
 
 
-static PyObject *
-ZenEditor_get_current_line_range(ZenEditor *self, PyObject *args)
-{
-	PyObject *result;
-	gint line, line_start, line_end;
-	ScintillaObject *sci;
 
-	print_called();
-	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+/*
+ * Replaces text in the document like the editor's replace_content() method,
+ * for results computed away from the main thread.  Doesn't use the Python
+ * API, so it can be called without holding the GIL.
+ */
+void zen_editor_replace_text(PyObject *editor, GeanyDocument *doc,
+	const gchar *text, gint sel_start, gint sel_end)
+{
+	ZenEditorStream stream;
 
-	line = sci_get_current_line(sci);
-	line_start = sci_get_position_from_line(sci, line);
-	line_end = sci_get_line_end_position(sci, line);
+	g_return_if_fail(editor != NULL && DOC_VALID(doc));
 
-	result = Py_BuildValue("ii", line_start, line_end);
-	return result;
+	if (ZenEditor_stream_begin((ZenEditor *) editor, doc->editor->sci,
+			sel_start, sel_end, &stream))
+	{
+		ZenEditor_stream_write(&stream, text, strlen(text), TRUE);
+		ZenEditor_stream_end(&stream);
+	}
 }
 
 
-static PyObject *
-ZenEditor_get_caret_pos(ZenEditor *self, PyObject *args)
+/*
+ * Same as zen_editor_replace_text(), but the text is passed in chunks to
+ * zen_editor_stream_write(), which inserts each one as it comes, and
+ * zen_editor_stream_free() finishes the replacement.  The document
+ * mustn't be edited otherwise in between.  Returns NULL on invalid
+ * arguments.
+ */
+ZenEditorStream *zen_editor_stream_new(PyObject *editor, GeanyDocument *doc,
+	gint sel_start, gint sel_end)
 {
-	PyObject *result;
-	gint pos;
-	ScintillaObject *sci;
+	ZenEditorStream *stream;
 
-	print_called();
-	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+	g_return_val_if_fail(editor != NULL && DOC_VALID(doc), NULL);
 
-	pos = sci_get_current_position(sci);
-	result = Py_BuildValue("i", pos);
+	stream = g_new(ZenEditorStream, 1);
+	if (!ZenEditor_stream_begin((ZenEditor *) editor, doc->editor->sci,
+			sel_start, sel_end, stream))
+	{
+		g_free(stream);
+		return NULL;
+	}
 
-	return result;
+	return stream;
 }
 
 
-static PyObject *
-ZenEditor_set_caret_pos(ZenEditor *self, PyObject *args)
+void zen_editor_stream_write(ZenEditorStream *stream, const gchar *text)
 {
-	gint pos;
-	ScintillaObject *sci;
-
-	print_called();
-	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+	ZenEditor_stream_write(stream, text, strlen(text), FALSE);
+}
 
-	if (PyArg_ParseTuple(args, "i", &pos))
-		sci_set_current_position(sci, pos, TRUE);
 
-	Py_RETURN_NONE;
+void zen_editor_stream_free(ZenEditorStream *stream)
+{
+	ZenEditor_stream_end(stream);
+	g_free(stream);
 }
 
 
-static PyObject *
-ZenEditor_get_current_line(ZenEditor *self, PyObject *args)
+/* Syntax of each document by its filetype, see zen_editor_document_syntax() */
+static GHashTable *filetype_syntaxes = NULL;
+
+
+/* Returns the Zen Coding syntax for the filetype of doc */
+static const gchar *zen_editor_filetype_syntax(GeanyDocument *doc)
 {
-	PyObject *result;
-	gchar *line;
-	ScintillaObject *sci;
+	GeanyFiletype *ft = doc->file_type;
 
+	if (ft == NULL)
+		return "html";
 
-	print_called();
-	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+	switch (ft->id)
+	{
+		case GEANY_FILETYPES_CSS:
+			return "css";
+		case GEANY_FILETYPES_XML:
+			/* Geany has no filetype of its own for XSL */
+			if (doc->file_name != NULL &&
+				(g_str_has_suffix(doc->file_name, ".xsl") ||
+				 g_str_has_suffix(doc->file_name, ".xslt")))
+			{
+				return "xsl";
+			}
+			return "xml";
+		default:
+			if (ft->name != NULL && g_ascii_strcasecmp(ft->name, "haml") == 0)
+				return "haml";
+			/* also for filetypes Zen Coding knows nothing about */
+			return "html";
+	}
+}
 
-	line = sci_get_line(sci, sci_get_current_line(sci));
-	result = Py_BuildValue("s", line);
-	g_free(line);
 
-	return result;
+/*
+ * Whether pos is inside a <style> element, where the HTML lexer leaves
+ * the CSS unstyled.  Only start and end tags the lexer styled as tags
+ * count, so ones in comments, strings or scripts are skipped.
+ */
+static gboolean zen_editor_in_style_element(ScintillaObject *sci, gint pos)
+{
+	struct Sci_TextToFind ttf;
+	gint open_pos, close_pos, from = pos;
+	gchar ch;
+
+	/* nearest real <style start tag before pos */
+	for (;;)
+	{
+		ttf.chrg.cpMin = from;
+		ttf.chrg.cpMax = 0;
+		ttf.lpstrText = (gchar *) "<style";
+		open_pos = scintilla_send_message(sci, SCI_FINDTEXT, 0, (sptr_t) &ttf);
+		if (open_pos < 0)
+			return FALSE;
+
+		ch = sci_get_char_at(sci, open_pos + 6);
+		if (sci_get_style_at(sci, open_pos) == SCE_H_TAG &&
+			(ch == '>' || g_ascii_isspace(ch)))
+		{
+			break;
+		}
+		from = open_pos;
+	}
+
+	/* the start tag has to end before pos */
+	ttf.chrg.cpMin = open_pos;
+	ttf.chrg.cpMax = pos;
+	ttf.lpstrText = (gchar *) ">";
+	if (scintilla_send_message(sci, SCI_FINDTEXT, 0, (sptr_t) &ttf) < 0)
+		return FALSE;
+
+	/* and the element not before it */
+	for (from = pos; ; from = close_pos)
+	{
+		ttf.chrg.cpMin = from;
+		ttf.chrg.cpMax = open_pos;
+		ttf.lpstrText = (gchar *) "</style";
+		close_pos = scintilla_send_message(sci, SCI_FINDTEXT, 0, (sptr_t) &ttf);
+		if (close_pos < 0)
+			return TRUE;
+		if (sci_get_style_at(sci, close_pos) == SCE_H_TAG)
+			return FALSE;
+	}
 }
 
 
 /*
- * Removes caret placeholder from string and puts the position where the first
- * placeholder was in the location pointed to by first_pos.  The value for
- * first_pos will be -1 if there were no caret placeholders in the text.
- * Returns a newly allocated string containing the placeholder-free text.
+ * Returns the Zen Coding syntax name to use at the caret of doc, which may
+ * be NULL.  The filetype decides it, except that CSS in a <style> element
+ * of an HTML or PHP document is "css".  The filetype part is cached until
+ * zen_editor_forget_document() is called for doc.
  */
-static gchar *
-ZenEditor_replace_caret_placeholder(const gchar *placeholder,
-	const gchar *text, gint *first_pos)
+const gchar *zen_editor_document_syntax(GeanyDocument *doc)
 {
-	gint placeholder_pos, len;
-	gchar *new_text, **arr;
+	const gchar *syntax;
+	ScintillaObject *sci;
+	gint pos, style;
 
-	print_called();
+	if (!DOC_VALID(doc))
+		return "html";
 
-	arr = g_strsplit(text, placeholder, 0);
-	len = g_strv_length(arr);
+	if (filetype_syntaxes == NULL)
+		filetype_syntaxes = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-	if (len > 1)
+	syntax = g_hash_table_lookup(filetype_syntaxes, doc);
+	if (syntax == NULL)
 	{
-		placeholder_pos = strlen(arr[0]);
-		new_text = g_strjoinv(NULL, arr);
+		syntax = zen_editor_filetype_syntax(doc);
+		g_hash_table_insert(filetype_syntaxes, doc, (gpointer) syntax);
 	}
-	else
+
+	if (!g_str_equal(syntax, "html") || doc->file_type == NULL ||
+		(doc->file_type->id != GEANY_FILETYPES_HTML &&
+		 doc->file_type->id != GEANY_FILETYPES_PHP))
 	{
-		placeholder_pos = -1;
-		new_text = g_strdup(arr[0]);
+		return syntax;
 	}
 
-	g_strfreev(arr);
+	sci = doc->editor->sci;
+	pos = sci_get_current_position(sci);
 
-	if (first_pos != NULL)
-		*first_pos = placeholder_pos;
+	/* JavaScript, VBScript, Python and PHP code is never in a style element */
+	style = sci_get_style_at(sci, pos > 0 ? pos - 1 : pos);
+	if (style >= SCE_HJ_START)
+		return syntax;
 
-	return new_text;
+	return zen_editor_in_style_element(sci, pos) ? "css" : syntax;
 }
 
 
-/*
- * Takes a string containing a range (ie. ${0:1}) and replaces it in the new
- * string with the range end.  The returned string is a copy and should be
- * freed when no longer needed.
- *
- * Example:
- *   'some text here ${10:20} and more'
- * becomes
- *   'some text here 20 and more'
- */
-static gchar *
-ZenEditor_replace_range(const gchar *text)
+/* Drops what is cached about doc, when it's closed or its filetype changes */
+void zen_editor_forget_document(GeanyDocument *doc)
 {
-	gchar *start_str, *end_str;
-	gchar *repl;
-	regex_t re;
-	regmatch_t match[3] = {0};
+	if (filetype_syntaxes != NULL)
+		g_hash_table_remove(filetype_syntaxes, doc);
+}
 
-	if (regcomp(&re, "\\$\\{([0-9\\.]+):([0-9\\.\\-]+)\\}", REG_EXTENDED) != 0)
-		return g_strdup(text);
 
-	if (regexec(&re, text, 3, match, 0) == 0)
+void zen_editor_cleanup(void)
+{
+	if (filetype_syntaxes != NULL)
 	{
-		start_str = g_strndup(text + match[1].rm_so,
-						match[1].rm_eo - match[1].rm_so);
-		end_str = g_strndup(text + match[2].rm_so,
-						match[2].rm_eo - match[2].rm_so);
+		g_hash_table_destroy(filetype_syntaxes);
+		filetype_syntaxes = NULL;
+	}
+}
 
-		repl = g_malloc0(strlen(text) + 1);
 
-		strncpy(repl, text, match[0].rm_so + 1);
-		strncpy(repl + match[0].rm_so, end_str, match[2].rm_eo - match[2].rm_so);
-		strncpy(repl + match[0].rm_so + (match[2].rm_eo - match[2].rm_so),
-			text + match[0].rm_eo,
-			strlen(text) - match[0].rm_eo);
+#define tabstop_at(sci, pos) \
+	scintilla_send_message((sci), SCI_INDICATORVALUEAT, ZEN_EDITOR_TABSTOP_INDICATOR, (pos))
+#define tabstop_start(sci, pos) \
+	(gint) scintilla_send_message((sci), SCI_INDICATORSTART, ZEN_EDITOR_TABSTOP_INDICATOR, (pos))
+#define tabstop_end(sci, pos) \
+	(gint) scintilla_send_message((sci), SCI_INDICATOREND, ZEN_EDITOR_TABSTOP_INDICATOR, (pos))
 
-		g_free(start_str);
-		g_free(end_str);
-		regfree(&re);
 
-		return repl;
-	}
+/*
+ * Returns (start, end) of the first marked tabstop starting at or after
+ * pos, skipping the one pos is inside of, or None if there isn't one.
+ */
+static PyObject *
+ZenEditor_get_next_tabstop(ZenEditor *self, PyObject *args)
+{
+	gint pos, len;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	if (!PyArg_ParseTuple(args, "i", &pos))
+		return NULL;
+
+	len = sci_get_length(sci);
+	pos = CLAMP(pos, 0, len);
+
+	if (pos < len && tabstop_at(sci, pos) && tabstop_start(sci, pos) < pos)
+		pos = tabstop_end(sci, pos);
+	if (pos < len && !tabstop_at(sci, pos))
+		pos = tabstop_end(sci, pos);
+	if (pos >= len)
+		Py_RETURN_NONE;
 
-	regfree(&re);
-	return g_strdup(text);
+	return Py_BuildValue("(ii)", pos, tabstop_end(sci, pos));
 }
 
 
+/*
+ * Returns (start, end) of the last marked tabstop ending at or before pos,
+ * skipping the one pos is inside of, or None if there isn't one.
+ */
 static PyObject *
-ZenEditor_replace_content(ZenEditor *self, PyObject *args)
+ZenEditor_get_prev_tabstop(ZenEditor *self, PyObject *args)
 {
-	gint sel_start = -1, sel_end = -1, ph_pos;
-	gchar *text, *tmp, *tmp2;
+	gint pos;
 	ScintillaObject *sci;
 
 	print_called();
 	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
 
-	if (PyArg_ParseTuple(args, "s|ii", &text, &sel_start, &sel_end))
-	{
-		tmp = ZenEditor_replace_caret_placeholder(self->caret_placeholder, text, &ph_pos);
-		tmp2 = ZenEditor_replace_range(tmp);
-		g_free(tmp);
+	if (!PyArg_ParseTuple(args, "i", &pos))
+		return NULL;
 
-		if (sel_start == -1 && sel_end == -1)
-		{
-			/* replace whole editor content */
-			sci_set_text(sci, tmp2);
-		}
-		else if (sel_start != -1 && sel_end == -1)
-		{
-			/* insert text at sel_start */
-			sci_insert_text(sci, sel_start, tmp2);
-		}
-		else if (sel_start != -1 && sel_end != -1)
-		{
-			/* replace from sel_start to sel_end */
-			sci_set_selection_start(sci, sel_start);
-			sci_set_selection_end(sci, sel_end);
-			sci_replace_sel(sci, tmp2);
-		}
-		else
-		{
-			dbgf("Invalid arguments were supplied.");
-			g_free(tmp2);
-			Py_RETURN_NONE;
-		}
+	pos = CLAMP(pos, 0, sci_get_length(sci));
+
+	if (pos > 0 && tabstop_at(sci, pos - 1) && tabstop_end(sci, pos - 1) > pos)
+		pos = tabstop_start(sci, pos - 1);
+	if (pos > 0 && !tabstop_at(sci, pos - 1))
+		pos = tabstop_start(sci, pos - 1);
+	if (pos <= 0)
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("(ii)", tabstop_start(sci, pos - 1), pos);
+}
 
-		g_free(tmp2);
 
-		/* Move cursor to first placeholder position, if found */
-		if (ph_pos > -1)
-			sci_set_current_position(sci, sel_start + ph_pos, TRUE);
+#define expansion_at(sci, pos) \
+	scintilla_send_message((sci), SCI_INDICATORVALUEAT, ZEN_EDITOR_EXPANSION_INDICATOR, (pos))
+#define expansion_end(sci, pos) \
+	(gint) scintilla_send_message((sci), SCI_INDICATOREND, ZEN_EDITOR_EXPANSION_INDICATOR, (pos))
 
-	}
+
+/*
+ * Called for every editor notification, clears the tabstops of the last
+ * expansion once the caret moves out of it or text outside of it changes.
+ * Being next to either end of the expansion counts as inside.
+ */
+void zen_editor_notify(GeanyDocument *doc, SCNotification *nt)
+{
+	ScintillaObject *sci = doc->editor->sci;
+	gint start, end;
+
+#ifdef SC_UPDATE_SELECTION
+	/* Scintilla before 3.0 doesn't say what an update was for */
+	if (nt->nmhdr.code == SCN_UPDATEUI && (nt->updated & SC_UPDATE_SELECTION))
+		start = end = sci_get_current_position(sci);
 	else
+#endif
+	if (nt->nmhdr.code == SCN_MODIFIED &&
+		(nt->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)))
 	{
-		if (PyErr_Occurred())
-		{
-			PyErr_Print();
-			PyErr_Clear();
-		}
+		start = nt->position;
+		end = (nt->modificationType & SC_MOD_INSERTTEXT) ?
+			nt->position + nt->length : nt->position;
 	}
+	else
+		return;
 
-	Py_RETURN_NONE;
+	if ((start > 0 && expansion_at(sci, start - 1)) || expansion_at(sci, end))
+		return;
+
+	/* an indicator that was never set or is cleared ends at 0 */
+	if (expansion_at(sci, 0) || expansion_end(sci, 0) > 0)
+		ZenEditor_clear_tabstops(sci);
 }
 
 
@@ -391,11 +1538,34 @@ ZenEditor_get_content(ZenEditor *self, PyObject *args)
 	print_called();
 	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
 
-	text = sci_get_contents(sci, sci_get_length(sci) + 1);
+	/* One copy straight out of Scintilla's buffer, rather than copying it
+	 * into a temporary string first. */
+	text = (gchar *) scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
 	py_return_none_if_null(text);
 
-	result = PyString_FromString(text);
-	g_free(text);
+	result = PyString_FromStringAndSize(text, sci_get_length(sci));
+	py_return_none_if_null(result);
+
+	return result;
+}
+
+
+/*
+ * Returns a ZenContent object which reads the document text in place.  It
+ * supports len(), indexing, slicing, find() and the buffer interface (so it
+ * can be passed to the re module), but becomes invalid as soon as the
+ * document is modified.
+ */
+static PyObject *
+ZenEditor_get_content_view(ZenEditor *self, PyObject *args)
+{
+	PyObject *result;
+	ScintillaObject *sci;
+
+	print_called();
+	py_return_none_if_null(sci = ZenEditor_get_scintilla(self));
+
+	result = ZenContent_new_for_sci(ZenEditor_get_context(self), sci);
 	py_return_none_if_null(result);
 
 	return result;
@@ -558,86 +1728,11 @@ ZenEditor_set_profile_name(ZenEditor *self, PyObject *args)
 }
 
 
-/*
- * FIXME: Write this in C using GKeyFile */
-/* Reads all of the .conf files in the passed in directory, parses them into
- * Zen Coding profiles and then sets each of them up in using
- * zencoding.utils.setup_profile().
- */
-static PyObject *
-ZenEditor_init_profiles(ZenEditor *self, PyObject *args)
-{
-	gint result = -1;
-	gchar *profiles_dir = NULL, *runcode = NULL;
-	static gboolean has_run = 0;
-#define RUNFMT																		\
-	"import os\n"																	\
-	"from ConfigParser import SafeConfigParser\n"									\
-	"import zencoding.utils\n"														\
-	"for cfg_file in os.listdir('%s'):\n"											\
-	"	if cfg_file.endswith('.conf'):\n"											\
-	"		cfg_file = os.path.join('%s', cfg_file)\n"								\
-	"		p = SafeConfigParser()\n"												\
-	"		p.read(cfg_file)\n"														\
-	"		if p.has_section('profile') and p.has_option('profile', 'name'):\n"		\
-	"			d = {}\n"															\
-	"			name = p.get('profile', 'name')\n"									\
-	"			if not name: continue\n"											\
-	"			if p.has_option('profile', 'tag_case'):\n"							\
-	"				d['case'] = p.get('profile', 'tag_case').lower()\n"				\
-	"			if p.has_option('profile', 'attr_case'):\n"							\
-	"				d['attr_case'] = p.get('profile', 'attr_case').lower()\n"		\
-	"			if p.has_option('profile', 'attr_quotes'):\n"						\
-	"				d['attr_quotes'] = p.get('profile', 'attr_quotes').lower()\n"	\
-	"			if p.has_option('profile', 'tag_nl'):\n"							\
-	"				if p.get('profile', 'tag_nl').lower() == 'decide':\n"			\
-	"					d['tag_nl'] = 'decide'\n"									\
-	"				else:\n"														\
-	"					d['tag_nl'] = p.getboolean('profile', 'tag_nl')\n"			\
-	"			if p.has_option('profile', 'place_cursor'):\n"						\
-	"				d['place_cursor'] = p.getboolean('profile', 'place_cursor')\n"	\
-	"			if p.has_option('profile', 'indent'):\n"							\
-	"				d['indent'] = p.getboolean('profile', 'indent')\n"				\
-	"			if p.has_option('profile', 'self_closing_tag'):\n"					\
-	"				if p.get('profile', 'self_closing_tag').lower() == 'xhtml':\n"	\
-	"					d['self_closing_tag'] = 'xhtml'\n"							\
-	"				else:\n"														\
-	"					d['self_closing_tag'] = p.getboolean('profile', \n"			\
-	"												'self_closing_tag')\n"			\
-	"			d['filters'] = None\n"												\
-	"			zencoding.utils.setup_profile(name, d)\n"
-
-	print_called();
-
-	if (has_run)
-		Py_RETURN_TRUE;
-
-	if (PyArg_ParseTuple(args, "s", &profiles_dir))
-	{
-		py_return_none_if_null(profiles_dir);
-
-		runcode = g_strdup_printf(RUNFMT, profiles_dir, profiles_dir);
-		result = PyRun_SimpleString(runcode);
-		g_free(runcode);
-	}
-
-	if (result == 0)
-	{
-		has_run = TRUE;
-		Py_RETURN_TRUE;
-	}
-
-	Py_RETURN_FALSE;
-
-#undef RUNFMT
-}
-
-
 static PyObject *
 ZenEditor_get_syntax(ZenEditor *self, PyObject *args)
 {
 	print_called();
-	return PyString_FromString("html");
+	return PyString_FromString(zen_editor_document_syntax(ZenEditor_get_context(self)));
 }
 
 
@@ -648,6 +1743,8 @@ ZenEditor_dealloc(ZenEditor *self)
 	Py_XDECREF(self->active_profile);
 	Py_XDECREF(self->context);
 	g_free(self->caret_placeholder);
+	if (self->tabstops != NULL)
+		g_array_free(self->tabstops, TRUE);
 	self->ob_type->tp_free((PyObject *) self);
 }
 
@@ -675,6 +1772,8 @@ ZenEditor_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 			Py_XDECREF(self);
 			return NULL;
 		}
+
+		self->tabstops = g_array_new(FALSE, FALSE, sizeof(ZenEditorTabstop));
 	}
 	return (PyObject *) self;
 }
@@ -747,6 +1846,10 @@ ZenEditor_init(ZenEditor *self, PyObject *args, PyObject *kwds)
 
 	self->caret_placeholder = g_strstrip(g_strdup(ph));
 
+	/* tp_new is PyType_GenericNew, so ZenEditor_new() doesn't run */
+	if (self->tabstops == NULL)
+		self->tabstops = g_array_new(FALSE, FALSE, sizeof(ZenEditorTabstop));
+
 	return 0;
 }
 
@@ -760,14 +1863,20 @@ static PyMethodDef ZenEditor_methods[] = {
 	{"set_caret_pos", (PyCFunction)ZenEditor_set_caret_pos, METH_VARARGS},
 	{"get_current_line", (PyCFunction)ZenEditor_get_current_line, METH_VARARGS},
 	{"replace_content", (PyCFunction)ZenEditor_replace_content, METH_VARARGS},
+	{"replace_content_stream", (PyCFunction)ZenEditor_replace_content_stream, METH_VARARGS},
 	{"get_content", (PyCFunction)ZenEditor_get_content, METH_VARARGS},
+	{"get_content_view", (PyCFunction)ZenEditor_get_content_view, METH_VARARGS},
+	{"get_content_range", (PyCFunction)ZenEditor_get_content_range, METH_VARARGS},
+	{"char_at", (PyCFunction)ZenEditor_char_at, METH_VARARGS},
+	{"get_line", (PyCFunction)ZenEditor_get_line, METH_VARARGS},
+	{"get_next_tabstop", (PyCFunction)ZenEditor_get_next_tabstop, METH_VARARGS},
+	{"get_prev_tabstop", (PyCFunction)ZenEditor_get_prev_tabstop, METH_VARARGS},
 	{"get_syntax", (PyCFunction)ZenEditor_get_syntax, METH_VARARGS},
 	{"get_profile_name", (PyCFunction)ZenEditor_get_profile_name, METH_VARARGS},
 	{"set_profile_name", (PyCFunction)ZenEditor_set_profile_name, METH_VARARGS},
 	{"prompt", (PyCFunction)ZenEditor_prompt, METH_VARARGS},
 	{"get_selection", (PyCFunction)ZenEditor_get_selection, METH_VARARGS},
 	{"get_file_path", (PyCFunction)ZenEditor_get_file_path, METH_VARARGS},
-	{"init_profiles", (PyCFunction)ZenEditor_init_profiles, METH_VARARGS},
 	{NULL}
 };
 
@@ -824,7 +1933,21 @@ static PyTypeObject ZenEditorType = {
 
 };
 
-PyMethodDef Module_methods[] = { { NULL } };
+PyMethodDef Module_methods[] = {
+	{"find_pair", (PyCFunction)zen_matcher_py_find_pair, METH_VARARGS,
+		"Native version of zencoding.html_matcher._find_pair()."},
+	{"parse_abbreviation", (PyCFunction)zen_abbreviation_py_parse, METH_VARARGS,
+		"Native version of zencoding.parser.abbreviation.parse()."},
+	{"css_lex", (PyCFunction)zen_css_py_lex, METH_VARARGS,
+		"Native version of zencoding.parser.css.lex()."},
+	{"xml_lex", (PyCFunction)zen_xml_py_lex, METH_VARARGS,
+		"Native version of zencoding.parser.xml.lex()."},
+	{"image_size", (PyCFunction)zen_image_py_size, METH_VARARGS,
+		"Native version of zencoding.utils.get_image_size()."},
+	{"image_file_size", (PyCFunction)zen_image_py_file_size, METH_VARARGS,
+		"Native version of zencoding.utils.get_image_file_size()."},
+	{ NULL }
+};
 
 
 PyObject *zen_editor_module_init(void)
@@ -835,10 +1958,16 @@ PyObject *zen_editor_module_init(void)
 	if (PyType_Ready(&ZenEditorType) < 0)
 		return NULL;
 
+	if (PyType_Ready(&ZenContentType) < 0)
+		return NULL;
+
 	m = Py_InitModule3("geany", Module_methods, "Geany Zen Coding module");
 
 	Py_INCREF(&ZenEditorType);
 	PyModule_AddObject(m, "ZenEditor", (PyObject *) &ZenEditorType);
 
+	Py_INCREF(&ZenContentType);
+	PyModule_AddObject(m, "ZenContent", (PyObject *) &ZenContentType);
+
 	return m;
 }
@@ -30,7 +30,24 @@ extern "C" {
 /*#define ZEN_EDITOR_DEBUG 1*/
 
 
+typedef struct _ZenEditorStream ZenEditorStream;
+
+
 PyObject *zen_editor_module_init(void);
+void zen_editor_content_changed(void);
+void zen_editor_notify(GeanyDocument *doc, SCNotification *nt);
+GeanyDocument *zen_editor_content_document(PyObject *obj);
+PyObject *zen_editor_snapshot_view(PyObject *text, ZenTagIndex *index);
+ZenTagIndex *zen_editor_content_tag_index(PyObject *obj, gboolean take);
+void zen_editor_replace_text(PyObject *editor, GeanyDocument *doc,
+	const gchar *text, gint sel_start, gint sel_end);
+ZenEditorStream *zen_editor_stream_new(PyObject *editor, GeanyDocument *doc,
+	gint sel_start, gint sel_end);
+void zen_editor_stream_write(ZenEditorStream *stream, const gchar *text);
+void zen_editor_stream_free(ZenEditorStream *stream);
+const gchar *zen_editor_document_syntax(GeanyDocument *doc);
+void zen_editor_forget_document(GeanyDocument *doc);
+void zen_editor_cleanup(void);
 
 
 #ifdef __cplusplus
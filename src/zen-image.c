@@ -0,0 +1,449 @@
+/*
+ * zen-image.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file contains a native version of zencoding.utils.get_image_size()
+ * and get_image_file_size(), exposed to Python as geany.image_size() and
+ * geany.image_file_size().  Only the headers are read: the fixed fields
+ * of PNG, GIF, BMP and WebP files, the segments of JPEG files up to the
+ * first frame header, skipped by their length, and the start of SVG files
+ * up to the <svg> element.
+ */
+
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include <glib/gstdio.h>
+#include "zen-image.h"
+
+
+/* Header bytes read to tell the formats apart */
+#define ZEN_IMAGE_HEADER_SIZE 32
+
+/* How far into an SVG file to look for the <svg> element */
+#define ZEN_IMAGE_SVG_HEADER_SIZE 65536
+
+/* Non-IHDR chunks to skip before giving up on a PNG file */
+#define ZEN_IMAGE_MAX_PNG_CHUNKS 8
+
+
+#define be16(p) (((p)[0] << 8) | (p)[1])
+#define le16(p) ((p)[0] | ((p)[1] << 8))
+#define be32(p) (((guint32) (p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+#define le32(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((guint32) (p)[3] << 24))
+#define le24(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16))
+
+
+/* Reads either a file or a buffer in memory */
+typedef struct
+{
+	FILE *fp;
+	const guchar *data;
+	gsize len;
+	gsize pos;
+} ImageReader;
+
+
+/* Reads up to n bytes at pos, returns how many were read */
+static gsize reader_read_at(ImageReader *reader, gsize pos, guchar *buf, gsize n)
+{
+	if (reader->fp != NULL)
+	{
+		if (fseek(reader->fp, (long) pos, SEEK_SET) != 0)
+			return 0;
+		n = fread(buf, 1, n, reader->fp);
+	}
+	else
+	{
+		if (pos >= reader->len)
+			return 0;
+		n = MIN(n, reader->len - pos);
+		memcpy(buf, reader->data + pos, n);
+	}
+
+	reader->pos = pos + n;
+
+	return n;
+}
+
+
+/* Reads exactly n bytes at the current position */
+static gboolean reader_read(ImageReader *reader, guchar *buf, gsize n)
+{
+	return reader_read_at(reader, reader->pos, buf, n) == n;
+}
+
+
+static gboolean probe_png(ImageReader *reader, gint *width, gint *height)
+{
+	guchar chunk[16];
+	gsize pos = 8;
+	gint i;
+
+	/* IHDR should be the first chunk, but some encoders put others first */
+	for (i = 0; i <= ZEN_IMAGE_MAX_PNG_CHUNKS; i++)
+	{
+		if (reader_read_at(reader, pos, chunk, 16) != 16)
+			return FALSE;
+
+		if (memcmp(chunk + 4, "IHDR", 4) == 0)
+		{
+			*width = (gint) be32(chunk + 8);
+			*height = (gint) be32(chunk + 12);
+			return TRUE;
+		}
+
+		/* length, type, data and CRC */
+		pos += 12 + be32(chunk);
+	}
+
+	return FALSE;
+}
+
+
+/* SOF0 to SOF15, except DHT, JPG and DAC */
+#define is_jpeg_sof(m) ((m) >= 0xC0 && (m) <= 0xCF && (m) != 0xC4 && (m) != 0xC8 && (m) != 0xCC)
+/* TEM and RST0 to RST7 have no length */
+#define is_jpeg_standalone(m) ((m) == 0x01 || ((m) >= 0xD0 && (m) <= 0xD7))
+
+
+static gboolean probe_jpeg(ImageReader *reader, gint *width, gint *height)
+{
+	guchar buf[7];
+	guchar marker;
+	gsize pos = 2;
+
+	for (;;)
+	{
+		if (reader_read_at(reader, pos, buf, 1) != 1 || buf[0] != 0xFF)
+			return FALSE;
+
+		/* markers can be padded with any number of 0xFF */
+		do
+		{
+			if (!reader_read(reader, &marker, 1))
+				return FALSE;
+		}
+		while (marker == 0xFF);
+
+		if (is_jpeg_standalone(marker))
+		{
+			pos = reader->pos;
+			continue;
+		}
+
+		/* the image data starts before any frame header */
+		if (marker == 0xD9 || marker == 0xDA)
+			return FALSE;
+
+		if (!reader_read(reader, buf, is_jpeg_sof(marker) ? 7 : 2))
+			return FALSE;
+
+		if (is_jpeg_sof(marker))
+		{
+			/* length, precision, height and width */
+			*height = be16(buf + 3);
+			*width = be16(buf + 5);
+			return TRUE;
+		}
+
+		if (be16(buf) < 2)
+			return FALSE;
+
+		pos = reader->pos - 2 + be16(buf);
+	}
+}
+
+
+static gboolean probe_webp(const guchar *header, gint *width, gint *height)
+{
+	if (memcmp(header + 12, "VP8 ", 4) == 0)
+	{
+		/* key frame start code */
+		if (header[23] != 0x9D || header[24] != 0x01 || header[25] != 0x2A)
+			return FALSE;
+		*width = le16(header + 26) & 0x3FFF;
+		*height = le16(header + 28) & 0x3FFF;
+	}
+	else if (memcmp(header + 12, "VP8L", 4) == 0)
+	{
+		if (header[20] != 0x2F)
+			return FALSE;
+		*width = 1 + (((header[22] & 0x3F) << 8) | header[21]);
+		*height = 1 + (((header[24] & 0x0F) << 10) | (header[23] << 2) | ((header[22] & 0xC0) >> 6));
+	}
+	else if (memcmp(header + 12, "VP8X", 4) == 0)
+	{
+		*width = 1 + le24(header + 24);
+		*height = 1 + le24(header + 27);
+	}
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+
+static gboolean probe_bmp(const guchar *header, gint *width, gint *height)
+{
+	/* OS/2 bitmaps have 16 bit sizes */
+	if (le32(header + 14) == 12)
+	{
+		*width = le16(header + 18);
+		*height = le16(header + 20);
+	}
+	else
+	{
+		*width = ABS((gint32) le32(header + 18));
+		/* negative for top-down bitmaps */
+		*height = ABS((gint32) le32(header + 22));
+	}
+
+	return TRUE;
+}
+
+
+/* Parses a length in user units, which are pixels */
+static gboolean parse_svg_length(const gchar *value, gint *length)
+{
+	gchar *end;
+	gdouble num = g_ascii_strtod(value, &end);
+
+	if (end == value || num < 0 || (*end != '\0' && strcmp(end, "px") != 0))
+		return FALSE;
+
+	*length = (gint) (num + 0.5);
+
+	return TRUE;
+}
+
+
+/* Returns the value of the named attribute in the attributes of a tag, up
+ * to its closing ">" */
+static gchar *get_svg_attribute(const gchar *attrs, const gchar *name)
+{
+	gsize name_len = strlen(name);
+	const gchar *p = attrs, *value;
+	gchar quote;
+
+	while (*p != '\0' && *p != '>')
+	{
+		if (g_ascii_isspace(*p) && strncmp(p + 1, name, name_len) == 0)
+		{
+			value = p + 1 + name_len;
+			while (g_ascii_isspace(*value))
+				value++;
+			if (*value == '=')
+			{
+				value++;
+				while (g_ascii_isspace(*value))
+					value++;
+				quote = *value;
+				if ((quote == '"' || quote == '\'') && strchr(value + 1, quote) != NULL)
+					return g_strndup(value + 1, strchr(value + 1, quote) - value - 1);
+			}
+		}
+		/* skip values, they can contain anything */
+		else if (*p == '"' || *p == '\'')
+		{
+			quote = *p;
+			if ((p = strchr(p + 1, quote)) == NULL)
+				break;
+		}
+		p++;
+	}
+
+	return NULL;
+}
+
+
+static gboolean probe_svg(ImageReader *reader, gint *width, gint *height)
+{
+	gchar *buf, *svg, *value;
+	gchar **view_box = NULL;
+	gsize len;
+	gboolean has_width, has_height;
+
+	buf = g_malloc(ZEN_IMAGE_SVG_HEADER_SIZE + 1);
+	len = reader_read_at(reader, 0, (guchar *) buf, ZEN_IMAGE_SVG_HEADER_SIZE);
+	buf[len] = '\0';
+
+	svg = strstr(buf, "<svg");
+	while (svg != NULL && !g_ascii_isspace(svg[4]) && svg[4] != '>')
+		svg = strstr(svg + 4, "<svg");
+
+	if (svg == NULL)
+	{
+		g_free(buf);
+		return FALSE;
+	}
+
+	value = get_svg_attribute(svg + 4, "width");
+	has_width = value != NULL && parse_svg_length(g_strstrip(value), width);
+	g_free(value);
+
+	value = get_svg_attribute(svg + 4, "height");
+	has_height = value != NULL && parse_svg_length(g_strstrip(value), height);
+	g_free(value);
+
+	/* relative sizes depend on the page, use the size of the drawing */
+	if (!has_width || !has_height)
+	{
+		value = get_svg_attribute(svg + 4, "viewBox");
+		if (value != NULL)
+		{
+			g_strdelimit(value, ",\t\r\n", ' ');
+			view_box = g_strsplit(g_strstrip(value), " ", 0);
+			g_free(value);
+		}
+	}
+
+	if (view_box != NULL)
+	{
+		gchar *parts[4];
+		gint i, n = 0;
+
+		/* skip the empty strings between repeated spaces */
+		for (i = 0; view_box[i] != NULL && n < 4; i++)
+		{
+			if (view_box[i][0] != '\0')
+				parts[n++] = view_box[i];
+		}
+
+		if (n == 4)
+		{
+			if (!has_width)
+				has_width = parse_svg_length(parts[2], width);
+			if (!has_height)
+				has_height = parse_svg_length(parts[3], height);
+		}
+		g_strfreev(view_box);
+	}
+
+	g_free(buf);
+
+	return has_width && has_height;
+}
+
+
+static gboolean probe_image(ImageReader *reader, gint *width, gint *height)
+{
+	guchar header[ZEN_IMAGE_HEADER_SIZE];
+	gsize len, i;
+
+	memset(header, 0, sizeof(header));
+	len = reader_read_at(reader, 0, header, sizeof(header));
+
+	if (len >= 8 && memcmp(header, "\211PNG\r\n\032\n", 8) == 0)
+		return probe_png(reader, width, height);
+
+	if (len >= 10 && memcmp(header, "GIF8", 4) == 0)
+	{
+		*width = le16(header + 6);
+		*height = le16(header + 8);
+		return TRUE;
+	}
+
+	if (len >= 2 && header[0] == 0xFF && header[1] == 0xD8)
+		return probe_jpeg(reader, width, height);
+
+	if (len >= 30 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WEBP", 4) == 0)
+		return probe_webp(header, width, height);
+
+	if (len >= 26 && header[0] == 'B' && header[1] == 'M')
+		return probe_bmp(header, width, height);
+
+	/* markup, maybe after a byte order mark */
+	i = (len >= 3 && memcmp(header, "\357\273\277", 3) == 0) ? 3 : 0;
+	while (i < len && g_ascii_isspace(header[i]))
+		i++;
+	if (i < len && header[i] == '<')
+		return probe_svg(reader, width, height);
+
+	return FALSE;
+}
+
+
+gboolean zen_image_probe_file(const gchar *path, gint *width, gint *height)
+{
+	ImageReader reader = { NULL, NULL, 0, 0 };
+	gboolean res;
+
+	reader.fp = g_fopen(path, "rb");
+	if (reader.fp == NULL)
+		return FALSE;
+
+	res = probe_image(&reader, width, height);
+	fclose(reader.fp);
+
+	return res;
+}
+
+
+gboolean zen_image_probe_data(const guchar *data, gsize len, gint *width, gint *height)
+{
+	ImageReader reader = { NULL, data, len, 0 };
+
+	return probe_image(&reader, width, height);
+}
+
+
+static PyObject *size_to_python(gboolean found, gint width, gint height)
+{
+	if (!found)
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("{sisi}", "width", width, "height", height);
+}
+
+
+PyObject *zen_image_py_size(PyObject *self, PyObject *args)
+{
+	const gchar *data;
+	gint len, width = 0, height = 0;
+	gboolean found;
+
+	if (!PyArg_ParseTuple(args, "s#", &data, &len))
+		return NULL;
+
+	found = zen_image_probe_data((const guchar *) data, len, &width, &height);
+
+	return size_to_python(found, width, height);
+}
+
+
+PyObject *zen_image_py_file_size(PyObject *self, PyObject *args)
+{
+	const gchar *path;
+	gint width = 0, height = 0;
+	gboolean found;
+
+	if (!PyArg_ParseTuple(args, "s", &path))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	found = zen_image_probe_file(path, &width, &height);
+	Py_END_ALLOW_THREADS
+
+	return size_to_python(found, width, height);
+}
@@ -0,0 +1,40 @@
+/*
+ * zen-image.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_IMAGE_H
+#define ZEN_IMAGE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+gboolean zen_image_probe_file(const gchar *path, gint *width, gint *height);
+gboolean zen_image_probe_data(const guchar *data, gsize len, gint *width, gint *height);
+
+PyObject *zen_image_py_size(PyObject *self, PyObject *args);
+PyObject *zen_image_py_file_size(PyObject *self, PyObject *args);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_IMAGE_H */
@@ -0,0 +1,539 @@
+/*
+ * zen-matcher.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file contains a native version of the tag pair matching done by
+ * zencoding/html_matcher.py.  It scans the text in place (any object with
+ * the buffer interface, including the editor's content view), without
+ * making substring copies or running regular expressions, and is exposed to
+ * Python as geany.find_pair().  The matching rules mirror the start_tag and
+ * end_tag patterns and the _find_pair() algorithm in html_matcher.py, so
+ * both give the same results.
+ */
+
+#include <Python.h>
+#include <geanyplugin.h>
+#include "zen-matcher.h"
+#include "zen-tag-index.h"
+#include "zen-editor.h"
+
+
+/* Longest tag name looked up in the empty elements map */
+#define ZEN_MATCHER_NAME_MAX 64
+
+/* Give up on tags with more attributes than this rather than recursing */
+#define ZEN_MATCHER_MAX_ATTRS 4096
+
+
+/* [\w\:\-] */
+#define is_name_char(c) (g_ascii_isalnum(c) || (c) == '_' || (c) == ':' || (c) == '-')
+/* \s */
+#define is_space(c) (g_ascii_isspace(c))
+
+
+static gint skip_spaces(const gchar *buf, gint len, gint pos)
+{
+	while (pos < len && is_space(buf[pos]))
+		pos++;
+	return pos;
+}
+
+
+static gboolean has_match(const gchar *buf, gint len, gint pos, const gchar *str)
+{
+	gint str_len = strlen(str);
+
+	if (pos < 0 || pos + str_len > len)
+		return FALSE;
+
+	return strncmp(buf + pos, str, str_len) == 0;
+}
+
+
+/* Same as html.find(str, pos) */
+static gint find_str(const gchar *buf, gint len, gint pos, const gchar *str)
+{
+	const gchar *p;
+	gint str_len = strlen(str);
+
+	for (p = buf + pos; p + str_len <= buf + len; p++)
+	{
+		p = memchr(p, str[0], (buf + len - str_len + 1) - p);
+		if (p == NULL)
+			break;
+		if (strncmp(p, str, str_len) == 0)
+			return p - buf;
+	}
+
+	return -1;
+}
+
+
+/* \s*(\/?)> */
+static gint match_tag_tail(const gchar *buf, gint len, gint pos, gboolean *slash,
+	gint *horizon)
+{
+	pos = skip_spaces(buf, len, pos);
+	*horizon = MAX(*horizon, pos + 1);
+
+	if (pos + 1 < len && buf[pos] == '/' && buf[pos + 1] == '>')
+	{
+		*slash = TRUE;
+		return pos + 2;
+	}
+	else if (pos < len && buf[pos] == '>')
+	{
+		*slash = FALSE;
+		return pos + 1;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Matches the attribute list and the end of a start tag:
+ *
+ *   ((?:\s+[\w\-:]+(?:\s*=\s*(?:(?:"[^"]*")|(?:'[^']*')|[^>\s]+))?)*)\s*(\/?)>
+ *
+ * trying the alternatives in the same order as the regex engine does, so
+ * that malformed tags (like unbalanced quotes) match the same text.  Each
+ * recursion matches one more attribute.  Positions the rest of the pattern
+ * is known to fail from are remembered in `failed` so that backtracking
+ * stays linear.  `horizon` is raised to the furthest offset looked at.
+ * Returns the position after the '>' or -1.
+ */
+static gint match_attributes(const gchar *buf, gint len, gint pos, gint depth,
+	gboolean *slash, gint *horizon, GHashTable **failed)
+{
+	gint name_end, value, end, result;
+	gchar quote;
+
+	if (*failed != NULL && g_hash_table_lookup(*failed, GINT_TO_POINTER(pos + 1)))
+		return -1;
+
+	name_end = skip_spaces(buf, len, pos);
+	if (name_end > pos && name_end < len && is_name_char(buf[name_end]) &&
+		depth < ZEN_MATCHER_MAX_ATTRS)
+	{
+		while (name_end < len && is_name_char(buf[name_end]))
+			name_end++;
+
+		/* attribute with a value */
+		value = skip_spaces(buf, len, name_end);
+		*horizon = MAX(*horizon, value);
+		if (value < len && buf[value] == '=')
+		{
+			value = skip_spaces(buf, len, value + 1);
+			*horizon = MAX(*horizon, value);
+
+			if (value < len && (buf[value] == '"' || buf[value] == '\''))
+			{
+				quote = buf[value];
+				end = value + 1;
+				while (end < len && buf[end] != quote)
+					end++;
+				*horizon = MAX(*horizon, end);
+				if (end < len)
+				{
+					result = match_attributes(buf, len, end + 1, depth + 1, slash,
+						horizon, failed);
+					if (result != -1)
+						return result;
+				}
+			}
+
+			end = value;
+			while (end < len && buf[end] != '>' && !is_space(buf[end]))
+				end++;
+			*horizon = MAX(*horizon, end);
+			if (end > value)
+			{
+				result = match_attributes(buf, len, end, depth + 1, slash,
+					horizon, failed);
+				if (result != -1)
+					return result;
+			}
+		}
+
+		/* attribute without a value */
+		result = match_attributes(buf, len, name_end, depth + 1, slash,
+			horizon, failed);
+		if (result != -1)
+			return result;
+	}
+
+	result = match_tag_tail(buf, len, pos, slash, horizon);
+	if (result == -1)
+	{
+		if (*failed == NULL)
+			*failed = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(*failed, GINT_TO_POINTER(pos + 1), GINT_TO_POINTER(TRUE));
+	}
+
+	return result;
+}
+
+
+/*
+ * Matches html_matcher.start_tag at `pos`.  The `unary` field is only set
+ * for self-closing tags, use zen_matcher_is_empty() for html mode.  If
+ * `horizon` isn't NULL it receives the furthest offset the result depends
+ * on, whether the tag matched or not.
+ */
+gboolean zen_matcher_start_tag(const gchar *buf, gint len, gint pos,
+	ZenMatcherTag *tag, gint *horizon)
+{
+	gint name_end, end, furthest = pos + 1;
+	gboolean slash = FALSE;
+	GHashTable *failed = NULL;
+
+	if (horizon != NULL)
+		*horizon = furthest;
+
+	if (pos < 0 || pos + 1 >= len || buf[pos] != '<' || !is_name_char(buf[pos + 1]))
+		return FALSE;
+
+	name_end = pos + 1;
+	while (name_end < len && is_name_char(buf[name_end]))
+		name_end++;
+
+	furthest = MAX(furthest, name_end);
+	end = match_attributes(buf, len, name_end, 0, &slash, &furthest, &failed);
+	if (failed != NULL)
+		g_hash_table_destroy(failed);
+
+	if (horizon != NULL)
+		*horizon = furthest;
+
+	if (end == -1)
+		return FALSE;
+
+	tag->start = pos;
+	tag->end = end;
+	tag->name_start = pos + 1;
+	tag->name_len = name_end - (pos + 1);
+	tag->closing = FALSE;
+	tag->self_closing = slash;
+	tag->unary = slash;
+
+	return TRUE;
+}
+
+
+/* Matches html_matcher.end_tag at `pos`, see zen_matcher_start_tag() */
+gboolean zen_matcher_end_tag(const gchar *buf, gint len, gint pos,
+	ZenMatcherTag *tag, gint *horizon)
+{
+	gint name_end;
+	const gchar *close;
+
+	if (horizon != NULL)
+		*horizon = pos + 2;
+
+	if (pos < 0 || pos + 2 >= len || buf[pos] != '<' || buf[pos + 1] != '/' ||
+		!is_name_char(buf[pos + 2]))
+	{
+		return FALSE;
+	}
+
+	name_end = pos + 2;
+	while (name_end < len && is_name_char(buf[name_end]))
+		name_end++;
+
+	close = memchr(buf + name_end, '>', len - name_end);
+	if (horizon != NULL)
+		*horizon = close != NULL ? close - buf : len;
+	if (close == NULL)
+		return FALSE;
+
+	tag->start = pos;
+	tag->end = (close - buf) + 1;
+	tag->name_start = pos + 2;
+	tag->name_len = name_end - (pos + 2);
+	tag->closing = TRUE;
+	tag->self_closing = FALSE;
+	tag->unary = FALSE;
+
+	return TRUE;
+}
+
+
+/* Tag names are compared lower-cased, like html_matcher.Tag.name */
+gboolean zen_matcher_tag_names_equal(const gchar *buf, const ZenMatcherTag *a,
+	const ZenMatcherTag *b)
+{
+	return a->name_len == b->name_len &&
+		g_ascii_strncasecmp(buf + a->name_start, buf + b->name_start, a->name_len) == 0;
+}
+
+
+gboolean zen_matcher_is_empty(const gchar *buf, const ZenMatcherTag *tag,
+	ZenMatcherEmptyFunc is_empty, gpointer data)
+{
+	gchar name[ZEN_MATCHER_NAME_MAX];
+	gint i;
+
+	if (is_empty == NULL || tag->name_len >= ZEN_MATCHER_NAME_MAX)
+		return FALSE;
+
+	for (i = 0; i < tag->name_len; i++)
+		name[i] = g_ascii_tolower(buf[tag->name_start + i]);
+	name[i] = '\0';
+
+	return is_empty(name, data);
+}
+
+
+static gint find_comment_start(const gchar *buf, gint len, gint pos)
+{
+	while (pos > 0)
+	{
+		if (buf[pos] == '<' && has_match(buf, len, pos, "<!--"))
+			break;
+		pos--;
+	}
+	return pos;
+}
+
+
+#define last_tag(stack) (&g_array_index((stack), ZenMatcherTag, (stack)->len - 1))
+
+
+/*
+ * Searches for the tag pair around `start_ix` like html_matcher._find_pair():
+ * first backwards for the nearest unclosed opening tag, then forwards for
+ * its closing tag.  `is_empty` is NULL in xhtml mode, otherwise it decides
+ * which elements are always unary.
+ */
+ZenMatchType zen_matcher_find_pair(const gchar *buf, gint len, gint start_ix,
+	ZenMatcherEmptyFunc is_empty, gpointer data, ZenMatch *match)
+{
+	GArray *stack;
+	ZenMatcherTag tag, opening = { 0 }, closing = { 0 };
+	gboolean have_opening = FALSE, have_closing = FALSE;
+	gint ix, end_ix;
+
+	match->type = ZEN_MATCH_NONE;
+	match->start = match->end = -1;
+	match->close_start = match->close_end = -1;
+
+	start_ix = MIN(start_ix, len);
+	stack = g_array_new(FALSE, FALSE, sizeof(ZenMatcherTag));
+
+	/* find opening tag */
+	for (ix = start_ix - 1; ix >= 0; ix--)
+	{
+		if (buf[ix] == '<')
+		{
+			if (zen_matcher_end_tag(buf, len, ix, &tag, NULL))
+			{
+				if (tag.start < start_ix && tag.end > start_ix)
+				{
+					/* direct hit on searched closing tag */
+					closing = tag;
+					have_closing = TRUE;
+				}
+				else
+					g_array_append_val(stack, tag);
+			}
+			else if (zen_matcher_start_tag(buf, len, ix, &tag, NULL))
+			{
+				if (!tag.unary)
+					tag.unary = zen_matcher_is_empty(buf, &tag, is_empty, data);
+
+				if (tag.unary)
+				{
+					if (tag.start < start_ix && tag.end > start_ix)
+					{
+						/* exact match */
+						match->type = ZEN_MATCH_TAG;
+						match->start = tag.start;
+						match->end = tag.end;
+						break;
+					}
+				}
+				else if (stack->len > 0 &&
+					zen_matcher_tag_names_equal(buf, last_tag(stack), &tag))
+				{
+					g_array_set_size(stack, stack->len - 1);
+				}
+				else
+				{
+					/* found nearest unclosed tag */
+					opening = tag;
+					have_opening = TRUE;
+					break;
+				}
+			}
+			else if (has_match(buf, len, ix, "<!--"))
+			{
+				/* found comment start */
+				end_ix = find_str(buf, len, ix, "-->");
+				end_ix = (end_ix != -1 ? end_ix : ix - 1) + 3;
+				if (ix < start_ix && end_ix >= start_ix)
+				{
+					match->type = ZEN_MATCH_COMMENT;
+					match->start = ix;
+					match->end = end_ix;
+					break;
+				}
+			}
+		}
+		else if (buf[ix] == '-' && has_match(buf, len, ix, "-->"))
+		{
+			/* found comment end, search left until comment start is reached */
+			ix = find_comment_start(buf, len, ix);
+		}
+	}
+
+	if (match->type != ZEN_MATCH_NONE || !have_opening)
+	{
+		g_array_free(stack, TRUE);
+		return match->type;
+	}
+
+	/* find closing tag */
+	g_array_set_size(stack, 0);
+	for (ix = start_ix; !have_closing && ix < len; ix++)
+	{
+		if (buf[ix] == '<')
+		{
+			if (zen_matcher_start_tag(buf, len, ix, &tag, NULL))
+			{
+				if (!tag.unary && !zen_matcher_is_empty(buf, &tag, is_empty, data))
+					g_array_append_val(stack, tag);
+			}
+			else if (zen_matcher_end_tag(buf, len, ix, &tag, NULL))
+			{
+				if (stack->len > 0 && zen_matcher_tag_names_equal(buf, last_tag(stack), &tag))
+					g_array_set_size(stack, stack->len - 1);
+				else
+				{
+					/* found matched closing tag */
+					closing = tag;
+					have_closing = TRUE;
+				}
+			}
+			else if (has_match(buf, len, ix, "<!--"))
+			{
+				/* skip comment, the loop increment lands on the '>' of '-->' */
+				end_ix = find_str(buf, len, ix, "-->");
+				ix += (end_ix != -1 ? end_ix - ix : -1) + 1;
+			}
+		}
+		else if (buf[ix] == '-' && has_match(buf, len, ix, "-->"))
+		{
+			/* looks like cursor was inside comment with invalid HTML */
+			match->type = ZEN_MATCH_COMMENT;
+			match->start = find_comment_start(buf, len, ix);
+			match->end = ix + 3;
+			break;
+		}
+	}
+
+	g_array_free(stack, TRUE);
+
+	if (match->type == ZEN_MATCH_NONE)
+	{
+		match->type = ZEN_MATCH_TAG;
+		match->start = opening.start;
+		match->end = opening.end;
+		if (have_closing)
+		{
+			match->close_start = closing.start;
+			match->close_end = closing.end;
+		}
+	}
+
+	return match->type;
+}
+
+
+static gboolean py_dict_has_name(const gchar *name, gpointer data)
+{
+	return PyDict_GetItemString((PyObject *) data, name) != NULL;
+}
+
+
+/*
+ * geany.find_pair(html, start_ix, empty=None)
+ *
+ * `html` is anything supporting the buffer interface and `empty` is the
+ * html_matcher.empty map in html mode, or None in xhtml mode.  Content views
+ * from ZenEditor.get_content_view() are searched through the document's
+ * tag index instead of being scanned, and snapshot views through the copy
+ * taken with the snapshot.  Returns None
+ * if no pair was found, ('comment', start, end) for a comment or
+ * ('tag', opening_start, closing_start) where closing_start is -1 for
+ * unary or unclosed tags.
+ */
+PyObject *zen_matcher_py_find_pair(PyObject *self, PyObject *args)
+{
+	PyObject *html, *empty = Py_None;
+	GeanyDocument *doc;
+	ZenTagIndex *index;
+	const void *buf;
+	Py_ssize_t len;
+	gint start_ix;
+	ZenMatch match;
+
+	if (!PyArg_ParseTuple(args, "Oi|O", &html, &start_ix, &empty))
+		return NULL;
+
+	if (empty != Py_None && !PyDict_Check(empty))
+	{
+		PyErr_SetString(PyExc_TypeError, "empty elements must be a dict or None");
+		return NULL;
+	}
+
+	if (PyObject_AsReadBuffer(html, &buf, &len) != 0)
+		return NULL;
+
+	doc = zen_editor_content_document(html);
+	index = zen_editor_content_tag_index(html, FALSE);
+	if (doc != NULL)
+	{
+		zen_tag_index_find_pair(doc, (const gchar *) buf, len, start_ix,
+			empty != Py_None ? py_dict_has_name : NULL, empty, &match);
+	}
+	else if (index != NULL)
+	{
+		zen_tag_index_search(index, (const gchar *) buf, len, start_ix,
+			empty != Py_None ? py_dict_has_name : NULL, empty, &match);
+	}
+	else
+	{
+		zen_matcher_find_pair((const gchar *) buf, len, start_ix,
+			empty != Py_None ? py_dict_has_name : NULL, empty, &match);
+	}
+
+	switch (match.type)
+	{
+		case ZEN_MATCH_TAG:
+			return Py_BuildValue("(sii)", "tag", match.start, match.close_start);
+		case ZEN_MATCH_COMMENT:
+			return Py_BuildValue("(sii)", "comment", match.start, match.end);
+		default:
+			Py_RETURN_NONE;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * zen-matcher.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_MATCHER_H
+#define ZEN_MATCHER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ZenMatcherTag ZenMatcherTag;
+
+struct _ZenMatcherTag
+{
+	gint start;
+	gint end;
+	gint name_start;
+	gint name_len;
+	gboolean closing;
+	gboolean self_closing;	/* opening tag written as <name ... /> */
+	gboolean unary;			/* self_closing, or an empty element in html mode */
+};
+
+
+typedef enum
+{
+	ZEN_MATCH_NONE,
+	ZEN_MATCH_TAG,
+	ZEN_MATCH_COMMENT
+}
+ZenMatchType;
+
+
+typedef struct _ZenMatch ZenMatch;
+
+struct _ZenMatch
+{
+	ZenMatchType type;
+	gint start;			/* opening tag or comment */
+	gint end;
+	gint close_start;	/* closing tag, -1 if unary or not found */
+	gint close_end;
+};
+
+
+/* Returns TRUE if the lower-cased tag name is an empty element (like <br>) */
+typedef gboolean (*ZenMatcherEmptyFunc) (const gchar *name, gpointer data);
+
+
+gboolean zen_matcher_start_tag(const gchar *buf, gint len, gint pos,
+	ZenMatcherTag *tag, gint *horizon);
+gboolean zen_matcher_end_tag(const gchar *buf, gint len, gint pos,
+	ZenMatcherTag *tag, gint *horizon);
+gboolean zen_matcher_tag_names_equal(const gchar *buf, const ZenMatcherTag *a,
+	const ZenMatcherTag *b);
+gboolean zen_matcher_is_empty(const gchar *buf, const ZenMatcherTag *tag,
+	ZenMatcherEmptyFunc is_empty, gpointer data);
+ZenMatchType zen_matcher_find_pair(const gchar *buf, gint len, gint start_ix,
+	ZenMatcherEmptyFunc is_empty, gpointer data, ZenMatch *match);
+
+PyObject *zen_matcher_py_find_pair(PyObject *self, PyObject *args);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_MATCHER_H */
@@ -0,0 +1,280 @@
+/*
+ * zen-profiles.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file reads the output profiles in the profiles directory.  The same
+ * parsed profiles fill the "Set Profile" menu and are handed to
+ * zencoding.utils.setup_profile() once Zen Coding is loaded, so the
+ * directory is read once and no Python runs until then.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include "zen-profiles.h"
+
+
+#define PROFILE_GROUP "profile"
+
+
+/* Reads a boolean like ConfigParser.getboolean() does */
+static gint zen_profile_parse_boolean(const gchar *value)
+{
+	static const gchar *true_values[] = { "1", "yes", "true", "on", NULL };
+	static const gchar *false_values[] = { "0", "no", "false", "off", NULL };
+	gint i;
+
+	for (i = 0; true_values[i] != NULL; i++)
+	{
+		if (g_str_equal(value, true_values[i]))
+			return ZEN_PROFILE_TRUE;
+	}
+
+	for (i = 0; false_values[i] != NULL; i++)
+	{
+		if (g_str_equal(value, false_values[i]))
+			return ZEN_PROFILE_FALSE;
+	}
+
+	return ZEN_PROFILE_UNSET;
+}
+
+
+/* Returns the lower cased value of key, or NULL if it isn't set */
+static gchar *zen_profile_get_lower(GKeyFile *kf, const gchar *key)
+{
+	gchar *value, *lower;
+
+	value = g_key_file_get_string(kf, PROFILE_GROUP, key, NULL);
+	if (value == NULL)
+		return NULL;
+
+	lower = g_ascii_strdown(g_strstrip(value), -1);
+	g_free(value);
+
+	return lower;
+}
+
+
+/*
+ * Returns the ZenProfileOption for a boolean key, which may also be set to
+ * the special word, meaning special_value.
+ */
+static gint zen_profile_get_option(GKeyFile *kf, const gchar *fn,
+	const gchar *key, const gchar *special, gint special_value)
+{
+	gchar *value;
+	gint result;
+
+	value = zen_profile_get_lower(kf, key);
+	if (value == NULL)
+		return ZEN_PROFILE_UNSET;
+
+	if (special != NULL && g_str_equal(value, special))
+		result = special_value;
+	else if ((result = zen_profile_parse_boolean(value)) == ZEN_PROFILE_UNSET)
+		g_warning("Ignoring invalid value '%s' of '%s' in '%s'.", value, key, fn);
+
+	g_free(value);
+
+	return result;
+}
+
+
+/* Returns the profile in fn, or NULL if it has none */
+static ZenProfile *zen_profile_load(const gchar *fn)
+{
+	GKeyFile *kf;
+	GError *error = NULL;
+	ZenProfile *profile = NULL;
+	gchar *label;
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_file(kf, fn, G_KEY_FILE_NONE, &error))
+	{
+		g_warning("Unable to read profile '%s': %s", fn, error->message);
+		g_error_free(error);
+		g_key_file_free(kf);
+		return NULL;
+	}
+
+	label = g_key_file_get_string(kf, PROFILE_GROUP, "name", NULL);
+	if (label != NULL && *g_strstrip(label) != '\0')
+	{
+		profile = g_new0(ZenProfile, 1);
+		profile->label = label;
+		profile->name = g_ascii_strdown(label, -1);
+		profile->tag_case = zen_profile_get_lower(kf, "tag_case");
+		profile->attr_case = zen_profile_get_lower(kf, "attr_case");
+		profile->attr_quotes = zen_profile_get_lower(kf, "attr_quotes");
+		profile->tag_nl = zen_profile_get_option(kf, fn, "tag_nl",
+							"decide", ZEN_PROFILE_DECIDE);
+		profile->place_cursor = zen_profile_get_option(kf, fn, "place_cursor",
+							NULL, ZEN_PROFILE_UNSET);
+		profile->indent = zen_profile_get_option(kf, fn, "indent",
+							NULL, ZEN_PROFILE_UNSET);
+		profile->self_closing_tag = zen_profile_get_option(kf, fn, "self_closing_tag",
+							"xhtml", ZEN_PROFILE_XHTML);
+	}
+	else
+		g_free(label);
+
+	g_key_file_free(kf);
+
+	return profile;
+}
+
+
+void zen_profile_free(ZenProfile *profile)
+{
+	if (profile == NULL)
+		return;
+
+	g_free(profile->name);
+	g_free(profile->label);
+	g_free(profile->tag_case);
+	g_free(profile->attr_case);
+	g_free(profile->attr_quotes);
+	g_free(profile);
+}
+
+
+static gint zen_profiles_compare_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **) a, *(const gchar **) b);
+}
+
+
+/*
+ * Reads the .conf files in dir, in the order of their names.  Returns an
+ * array of ZenProfile that frees them with it, empty if dir can't be read.
+ */
+GPtrArray *zen_profiles_load(const gchar *dir)
+{
+	GPtrArray *profiles, *names;
+	ZenProfile *profile;
+	GDir *gdir;
+	const gchar *ent;
+	gchar *fn;
+	guint i;
+
+	profiles = g_ptr_array_new_with_free_func((GDestroyNotify) zen_profile_free);
+
+	gdir = g_dir_open(dir, 0, NULL);
+	if (gdir == NULL)
+		return profiles;
+
+	names = g_ptr_array_new_with_free_func(g_free);
+	while ((ent = g_dir_read_name(gdir)) != NULL)
+	{
+		if (g_str_has_suffix(ent, ".conf"))
+			g_ptr_array_add(names, g_strdup(ent));
+	}
+	g_dir_close(gdir);
+
+	g_ptr_array_sort(names, zen_profiles_compare_names);
+
+	for (i = 0; i < names->len; i++)
+	{
+		fn = g_build_filename(dir, g_ptr_array_index(names, i), NULL);
+		if ((profile = zen_profile_load(fn)) != NULL)
+			g_ptr_array_add(profiles, profile);
+		g_free(fn);
+	}
+
+	g_ptr_array_free(names, TRUE);
+
+	return profiles;
+}
+
+
+static PyObject *zen_profile_option_to_py(gint option)
+{
+	switch (option)
+	{
+		case ZEN_PROFILE_DECIDE:
+			return PyString_FromString("decide");
+		case ZEN_PROFILE_XHTML:
+			return PyString_FromString("xhtml");
+		default:
+			return PyBool_FromLong(option == ZEN_PROFILE_TRUE);
+	}
+}
+
+
+/* Adds value to dict, stealing the reference to it */
+static gboolean zen_profile_dict_add(PyObject *dict, const gchar *key, PyObject *value)
+{
+	gint result;
+
+	if (value == NULL)
+		return FALSE;
+
+	result = PyDict_SetItemString(dict, key, value);
+	Py_DECREF(value);
+
+	return result == 0;
+}
+
+
+/*
+ * Returns the options dict zencoding.utils.setup_profile() takes for
+ * profile, without the options it doesn't set so Zen Coding's defaults
+ * are used for those.  Needs the GIL.
+ */
+PyObject *zen_profile_to_dict(const ZenProfile *profile)
+{
+	PyObject *dict;
+	gboolean ok = TRUE;
+
+	dict = PyDict_New();
+	if (dict == NULL)
+		return NULL;
+
+	if (ok && profile->tag_case != NULL)
+		ok = zen_profile_dict_add(dict, "tag_case", PyString_FromString(profile->tag_case));
+	if (ok && profile->attr_case != NULL)
+		ok = zen_profile_dict_add(dict, "attr_case", PyString_FromString(profile->attr_case));
+	if (ok && profile->attr_quotes != NULL)
+		ok = zen_profile_dict_add(dict, "attr_quotes", PyString_FromString(profile->attr_quotes));
+	if (ok && profile->tag_nl != ZEN_PROFILE_UNSET)
+		ok = zen_profile_dict_add(dict, "tag_nl", zen_profile_option_to_py(profile->tag_nl));
+	if (ok && profile->place_cursor != ZEN_PROFILE_UNSET)
+		ok = zen_profile_dict_add(dict, "place_cursor", zen_profile_option_to_py(profile->place_cursor));
+	if (ok && profile->indent != ZEN_PROFILE_UNSET)
+		ok = zen_profile_dict_add(dict, "indent", zen_profile_option_to_py(profile->indent));
+	if (ok && profile->self_closing_tag != ZEN_PROFILE_UNSET)
+		ok = zen_profile_dict_add(dict, "self_closing_tag", zen_profile_option_to_py(profile->self_closing_tag));
+	if (ok)
+	{
+		Py_INCREF(Py_None);
+		ok = zen_profile_dict_add(dict, "filters", Py_None);
+	}
+
+	if (!ok)
+	{
+		Py_DECREF(dict);
+		return NULL;
+	}
+
+	return dict;
+}
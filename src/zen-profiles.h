@@ -0,0 +1,68 @@
+/*
+ * zen-profiles.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_PROFILES_H
+#define ZEN_PROFILES_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Values of the profile options that aren't plain strings */
+typedef enum
+{
+	ZEN_PROFILE_UNSET = -1,		/* not in the file, Zen Coding's default is used */
+	ZEN_PROFILE_FALSE,
+	ZEN_PROFILE_TRUE,
+	ZEN_PROFILE_DECIDE,			/* tag_nl only */
+	ZEN_PROFILE_XHTML			/* self_closing_tag only */
+}
+ZenProfileOption;
+
+
+typedef struct _ZenProfile ZenProfile;
+
+/* An output profile read from a .conf file, see data/example.conf */
+struct _ZenProfile
+{
+	gchar *name;		/* lower case, as Zen Coding looks it up */
+	gchar *label;		/* as written in the file, for the menu */
+	gchar *tag_case;	/* NULL when unset, like the other strings */
+	gchar *attr_case;
+	gchar *attr_quotes;
+	gint tag_nl;		/* ZenProfileOption */
+	gint place_cursor;
+	gint indent;
+	gint self_closing_tag;
+};
+
+
+GPtrArray *zen_profiles_load(const gchar *dir);
+void zen_profile_free(ZenProfile *profile);
+
+PyObject *zen_profile_to_dict(const ZenProfile *profile);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_PROFILES_H */
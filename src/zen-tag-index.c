@@ -0,0 +1,882 @@
+/*
+ * zen-tag-index.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file keeps an index of the tag structure of each document so that
+ * matching a tag pair doesn't have to scan and re-match the whole text
+ * around the caret every time.
+ *
+ * The only places zen_matcher_find_pair() ever looks at are '<' characters
+ * and the '-' starting a "-->", so the index is a sorted array of those
+ * offsets.  What is found at each offset (start tag, end tag, comment start
+ * or end, or nothing) is worked out the first time a search needs it and
+ * cached, along with the furthest offset that result depends on.
+ *
+ * Scintilla modification notifications keep the index up to date: entries
+ * after an edit are shifted, entries inside deleted text are dropped, new
+ * candidates are picked up from inserted text and only cached results
+ * that read across the edited offset are forgotten.  Searches then jump
+ * between entries instead of visiting every character, and follow exactly
+ * the same rules as zen_matcher_find_pair(), so both give the same results.
+ *
+ * Like Scintilla's own partitioning, the shift is applied lazily: entries
+ * from a boundary on are stored short of their offsets by a pending delta,
+ * and an edit only moves the boundary to itself, so typing costs the
+ * entries between two edits rather than all the entries after each one.
+ *
+ * A search also links each tag whose partner it finds to that partner, so
+ * the next search that walks up to the tag steps over the whole element.
+ * Links depend on the text and on which tags are empty, so they are only
+ * used until the next edit or a search with another empty check.  A search
+ * still walks over the siblings of each element enclosing the caret, it
+ * just doesn't walk into them again.
+ *
+ * The index for a document is created by its first search, so documents
+ * that are never searched cost nothing but a hash table lookup per edit.
+ *
+ * Actions running on the worker thread search a copy of the index taken
+ * with the snapshot of the document.  What they find out is kept: the
+ * copy replaces the document's index if the text is still the same once
+ * the action is done.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include "zen-matcher.h"
+#include "zen-tag-index.h"
+
+
+typedef enum
+{
+	ZEN_TAG_ENTRY_UNKNOWN,
+	ZEN_TAG_ENTRY_NONE,
+	ZEN_TAG_ENTRY_START_TAG,
+	ZEN_TAG_ENTRY_END_TAG,
+	ZEN_TAG_ENTRY_COMMENT_START,
+	ZEN_TAG_ENTRY_COMMENT_END
+}
+ZenTagEntryType;
+
+
+typedef struct
+{
+	gint pos;			/* offset of the '<' or of the '-' of "-->" */
+	gint end;			/* end of the tag, valid for tags only */
+	gint horizon;		/* furthest offset the cached type depends on */
+	gint name_len;
+	guint link;			/* entry of the partner tag, if link_stamp is current */
+	gint link_reach;	/* end tags only: furthest caret the link is wrong for */
+	guint link_stamp;
+	guint8 type;		/* ZenTagEntryType */
+	guint8 self_closing;
+}
+ZenTagEntry;
+
+
+struct _ZenTagIndex
+{
+	GArray *entries;	/* ZenTagEntry sorted by pos */
+	gint length;		/* length of the text described, -1 to rebuild */
+	gint max_span;		/* largest horizon - pos of any cached entry */
+
+	/* pos, end and horizon of entries from shift_first on are shift_delta short */
+	guint shift_first;
+	gint shift_delta;
+
+	/* links are valid for this stamp and empty check, an edit moves it on */
+	guint stamp;
+	ZenMatcherEmptyFunc is_empty;
+	gpointer is_empty_data;
+};
+
+
+/* GeanyDocument -> ZenTagIndex */
+static GHashTable *tag_indexes = NULL;
+
+
+#define entry_at(index, i) (&g_array_index((index)->entries, ZenTagEntry, (i)))
+/* `i` is always a valid entry index, some callers just keep it in a gint */
+#define entry_shift(index, i) ((guint) (i) >= (index)->shift_first ? (index)->shift_delta : 0)
+#define entry_pos(index, i) (entry_at((index), (i))->pos + entry_shift((index), (i)))
+#define entry_linked(index, entry) ((entry)->link_stamp == (index)->stamp)
+
+
+static gboolean has_comment_end(const gchar *buf, gint len, gint pos)
+{
+	return pos + 3 <= len && buf[pos] == '-' && buf[pos + 1] == '-' &&
+		buf[pos + 2] == '>';
+}
+
+
+static ZenTagIndex *tag_index_new(void)
+{
+	ZenTagIndex *index;
+
+	index = g_slice_new(ZenTagIndex);
+	index->entries = g_array_new(FALSE, FALSE, sizeof(ZenTagEntry));
+	index->length = -1;
+	index->max_span = 0;
+	index->shift_first = 0;
+	index->shift_delta = 0;
+	index->stamp = 1;
+	index->is_empty = NULL;
+	index->is_empty_data = NULL;
+
+	return index;
+}
+
+
+void zen_tag_index_free(ZenTagIndex *index)
+{
+	g_array_free(index->entries, TRUE);
+	g_slice_free(ZenTagIndex, index);
+}
+
+
+/* Forgets all links */
+static void tag_index_unlink(ZenTagIndex *index)
+{
+	guint i;
+
+	/* stamp 0 is never current, so old stamps can't come back */
+	if (++index->stamp == 0)
+	{
+		for (i = 0; i < index->entries->len; i++)
+			entry_at(index, i)->link_stamp = 0;
+		index->stamp = 1;
+	}
+}
+
+
+static void tag_index_build(ZenTagIndex *index, const gchar *buf, gint len)
+{
+	ZenTagEntry entry = { 0 };
+	gint pos;
+
+	g_array_set_size(index->entries, 0);
+	entry.type = ZEN_TAG_ENTRY_UNKNOWN;
+
+	for (pos = 0; pos < len; pos++)
+	{
+		if (buf[pos] == '<' || has_comment_end(buf, len, pos))
+		{
+			entry.pos = pos;
+			g_array_append_val(index->entries, entry);
+		}
+	}
+
+	index->length = len;
+	index->max_span = 0;
+	index->shift_first = 0;
+	index->shift_delta = 0;
+	tag_index_unlink(index);
+}
+
+
+/* Index of the first entry at or after `pos` */
+static guint tag_index_lower_bound(ZenTagIndex *index, gint pos)
+{
+	guint lo = 0, hi = index->entries->len, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (entry_pos(index, mid) < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+/*
+ * Forgets the cached types before entry `first` that read past `pos`, the
+ * shift has to be settled up to `first`.
+ */
+static void tag_index_invalidate(ZenTagIndex *index, guint first, gint pos)
+{
+	ZenTagEntry *entry;
+	guint i;
+
+	for (i = first; i > 0; i--)
+	{
+		entry = entry_at(index, i - 1);
+		if (entry->pos < pos - index->max_span)
+			break;
+		if (entry->type != ZEN_TAG_ENTRY_UNKNOWN && entry->horizon >= pos)
+			entry->type = ZEN_TAG_ENTRY_UNKNOWN;
+	}
+}
+
+
+static void tag_index_shift_range(ZenTagIndex *index, guint from, guint to, gint delta)
+{
+	ZenTagEntry *entry;
+	guint i;
+
+	for (i = from; i < to; i++)
+	{
+		entry = entry_at(index, i);
+		entry->pos += delta;
+		entry->end += delta;
+		entry->horizon += delta;
+	}
+}
+
+
+/* Moves the boundary of the pending shift to entry `first` */
+static void tag_index_settle(ZenTagIndex *index, guint first)
+{
+	if (first > index->shift_first)
+	{
+		tag_index_shift_range(index, index->shift_first, first, index->shift_delta);
+		index->shift_first = first;
+	}
+	else if (first < index->shift_first)
+	{
+		tag_index_shift_range(index, first, index->shift_first, -index->shift_delta);
+		index->shift_first = first;
+	}
+}
+
+
+/* Shifts the entries from `first` on by `delta` */
+static void tag_index_shift(ZenTagIndex *index, guint first, gint delta)
+{
+	tag_index_settle(index, first);
+	index->shift_delta += delta;
+}
+
+
+/* Inserts `n` new entries at `i`, which can't be after the shift boundary */
+static void tag_index_insert(ZenTagIndex *index, guint i, const ZenTagEntry *entries,
+	guint n)
+{
+	g_return_if_fail(i <= index->shift_first);
+
+	g_array_insert_vals(index->entries, i, entries, n);
+	index->shift_first += n;
+}
+
+
+/* Adds an entry for `pos` unless there already is one */
+static void tag_index_ensure(ZenTagIndex *index, gint pos)
+{
+	ZenTagEntry entry = { 0 };
+	guint i;
+
+	i = tag_index_lower_bound(index, pos);
+	if (i < index->entries->len && entry_pos(index, i) == pos)
+		return;
+
+	entry.pos = pos;
+	entry.type = ZEN_TAG_ENTRY_UNKNOWN;
+	tag_index_insert(index, i, &entry, 1);
+}
+
+
+/* Reads from the inserted text when possible, saves a message per char */
+static gchar inserted_char_at(ScintillaObject *sci, gint pos, gint length,
+	const gchar *text, gint at)
+{
+	if (text != NULL && at >= pos && at < pos + length)
+		return text[at - pos];
+	return sci_get_char_at(sci, at);
+}
+
+
+static gboolean inserted_comment_end(ScintillaObject *sci, gint pos,
+	gint length, const gchar *text, gint at)
+{
+	return inserted_char_at(sci, pos, length, text, at) == '-' &&
+		inserted_char_at(sci, pos, length, text, at + 1) == '-' &&
+		inserted_char_at(sci, pos, length, text, at + 2) == '>';
+}
+
+
+static void tag_index_insert_text(ZenTagIndex *index, ScintillaObject *sci,
+	gint pos, gint length, const gchar *text)
+{
+	GArray *added;
+	ZenTagEntry entry = { 0 };
+	guint first;
+	gint at;
+
+	first = tag_index_lower_bound(index, pos);
+	tag_index_settle(index, first);
+	tag_index_invalidate(index, first, pos);
+	tag_index_shift(index, first, length);
+	index->length += length;
+
+	/* a "-->" can be completed by text inserted just after "-" or "--" */
+	for (at = MAX(0, pos - 2); at < pos; at++)
+	{
+		if (inserted_comment_end(sci, pos, length, text, at))
+			tag_index_ensure(index, at);
+	}
+
+	added = g_array_new(FALSE, FALSE, sizeof(ZenTagEntry));
+	entry.type = ZEN_TAG_ENTRY_UNKNOWN;
+	for (at = pos; at < pos + length; at++)
+	{
+		if (inserted_char_at(sci, pos, length, text, at) == '<' ||
+			inserted_comment_end(sci, pos, length, text, at))
+		{
+			entry.pos = at;
+			g_array_append_val(added, entry);
+		}
+	}
+
+	if (added->len > 0)
+	{
+		tag_index_insert(index, tag_index_lower_bound(index, pos),
+			(const ZenTagEntry *) added->data, added->len);
+	}
+	g_array_free(added, TRUE);
+}
+
+
+static void tag_index_delete_text(ZenTagIndex *index, ScintillaObject *sci,
+	gint pos, gint length)
+{
+	guint first, last;
+	gint at;
+
+	first = tag_index_lower_bound(index, pos);
+	last = tag_index_lower_bound(index, pos + length);
+	tag_index_settle(index, first);
+	if (last > first)
+		g_array_remove_range(index->entries, first, last - first);
+
+	tag_index_invalidate(index, first, pos);
+	tag_index_shift(index, first, -length);
+	index->length -= length;
+
+	/* joining the text on both sides can make a new "-->" */
+	for (at = MAX(0, pos - 2); at < pos; at++)
+	{
+		if (inserted_comment_end(sci, pos, 0, NULL, at))
+			tag_index_ensure(index, at);
+	}
+}
+
+
+/*
+ * Called for every editor notification, keeps the index of `doc` (if it
+ * has one) in step with text insertions and deletions.
+ */
+void zen_tag_index_notify(GeanyDocument *doc, SCNotification *nt)
+{
+	ZenTagIndex *index;
+
+	if (tag_indexes == NULL || nt->nmhdr.code != SCN_MODIFIED)
+		return;
+
+	index = g_hash_table_lookup(tag_indexes, doc);
+	if (index == NULL || index->length < 0)
+		return;
+
+	if (nt->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))
+		tag_index_unlink(index);
+
+	if (nt->modificationType & SC_MOD_INSERTTEXT)
+	{
+		tag_index_insert_text(index, doc->editor->sci, nt->position,
+			nt->length, nt->text);
+	}
+	else if (nt->modificationType & SC_MOD_DELETETEXT)
+		tag_index_delete_text(index, doc->editor->sci, nt->position, nt->length);
+}
+
+
+void zen_tag_index_remove(GeanyDocument *doc)
+{
+	if (tag_indexes != NULL)
+		g_hash_table_remove(tag_indexes, doc);
+}
+
+
+void zen_tag_index_cleanup(void)
+{
+	if (tag_indexes != NULL)
+	{
+		g_hash_table_destroy(tag_indexes);
+		tag_indexes = NULL;
+	}
+}
+
+
+static ZenTagIndex *tag_index_get(GeanyDocument *doc)
+{
+	ZenTagIndex *index;
+
+	if (tag_indexes == NULL)
+	{
+		tag_indexes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) zen_tag_index_free);
+	}
+
+	index = g_hash_table_lookup(tag_indexes, doc);
+	if (index == NULL)
+	{
+		index = tag_index_new();
+		g_hash_table_insert(tag_indexes, doc, index);
+	}
+
+	return index;
+}
+
+
+/*
+ * Returns a copy of the index of `doc` for searching a snapshot of its
+ * `len` long text away from the main thread, or an empty index built by
+ * its first search if `doc` has none for that text.
+ */
+ZenTagIndex *zen_tag_index_copy(GeanyDocument *doc, gint len)
+{
+	ZenTagIndex *index, *copy;
+
+	copy = tag_index_new();
+
+	index = (tag_indexes != NULL) ? g_hash_table_lookup(tag_indexes, doc) : NULL;
+	if (index != NULL && index->length == len)
+	{
+		g_array_append_vals(copy->entries, index->entries->data, index->entries->len);
+		copy->length = index->length;
+		copy->max_span = index->max_span;
+		copy->shift_first = index->shift_first;
+		copy->shift_delta = index->shift_delta;
+		copy->stamp = index->stamp;
+		copy->is_empty = index->is_empty;
+		copy->is_empty_data = index->is_empty_data;
+	}
+
+	return copy;
+}
+
+
+/*
+ * Makes `index`, a copy searched since, the index of `doc` again.  Only
+ * valid if the text of `doc` didn't change after the copy was taken.
+ */
+void zen_tag_index_adopt(GeanyDocument *doc, ZenTagIndex *index)
+{
+	ZenTagIndex *old;
+
+	/* a copy that was never searched has nothing new */
+	if (index->length < 0)
+	{
+		zen_tag_index_free(index);
+		return;
+	}
+
+	old = tag_index_get(doc);
+	g_array_free(old->entries, TRUE);
+	*old = *index;
+	g_slice_free(ZenTagIndex, index);
+}
+
+
+/* Returns entry `i`, working out what is at its offset if not known yet */
+static ZenTagEntry *tag_index_entry(ZenTagIndex *index, const gchar *buf,
+	gint len, guint i)
+{
+	ZenTagEntry *entry = entry_at(index, i);
+	ZenMatcherTag tag;
+	gint pos, end_horizon, start_horizon;
+
+	if (entry->type != ZEN_TAG_ENTRY_UNKNOWN)
+		return entry;
+
+	/* worked out at the real offset, stored as short as pos is */
+	pos = entry_pos(index, i);
+	entry->end = -1;
+	entry->name_len = 0;
+	entry->self_closing = FALSE;
+
+	if (pos < len && buf[pos] == '<')
+	{
+		/* tried in the same order as zen_matcher_find_pair() does */
+		entry->horizon = pos + 3;
+		if (zen_matcher_end_tag(buf, len, pos, &tag, &end_horizon))
+			entry->type = ZEN_TAG_ENTRY_END_TAG;
+		else if (zen_matcher_start_tag(buf, len, pos, &tag, &start_horizon))
+		{
+			entry->type = ZEN_TAG_ENTRY_START_TAG;
+			entry->horizon = MAX(entry->horizon, start_horizon);
+		}
+		else
+		{
+			entry->type = (pos + 4 <= len && strncmp(buf + pos, "<!--", 4) == 0) ?
+				ZEN_TAG_ENTRY_COMMENT_START : ZEN_TAG_ENTRY_NONE;
+			entry->horizon = MAX(entry->horizon, start_horizon);
+		}
+		entry->horizon = MAX(entry->horizon, end_horizon);
+
+		if (entry->type == ZEN_TAG_ENTRY_START_TAG ||
+			entry->type == ZEN_TAG_ENTRY_END_TAG)
+		{
+			entry->end = tag.end - (pos - entry->pos);
+			entry->name_len = tag.name_len;
+			entry->self_closing = tag.self_closing;
+		}
+	}
+	else
+	{
+		entry->type = has_comment_end(buf, len, pos) ?
+			ZEN_TAG_ENTRY_COMMENT_END : ZEN_TAG_ENTRY_NONE;
+		entry->horizon = pos + 2;
+	}
+
+	index->max_span = MAX(index->max_span, entry->horizon - pos);
+	entry->horizon -= pos - entry->pos;
+
+	return entry;
+}
+
+
+static void tag_index_entry_to_tag(ZenTagIndex *index, guint i, ZenMatcherTag *tag)
+{
+	const ZenTagEntry *entry = entry_at(index, i);
+	gint shift = entry_shift(index, i);
+
+	tag->closing = (entry->type == ZEN_TAG_ENTRY_END_TAG);
+	tag->start = entry->pos + shift;
+	tag->end = entry->end + shift;
+	tag->name_start = tag->start + (tag->closing ? 2 : 1);
+	tag->name_len = entry->name_len;
+	tag->self_closing = entry->self_closing;
+	tag->unary = entry->self_closing;
+}
+
+
+/* Same as html.find('-->', pos) for the '<' of entry `i`, -1 if none */
+static gint tag_index_find_comment_end(ZenTagIndex *index, const gchar *buf,
+	gint len, guint i, guint *found)
+{
+	guint j;
+
+	for (j = i + 1; j < index->entries->len; j++)
+	{
+		if (tag_index_entry(index, buf, len, j)->type == ZEN_TAG_ENTRY_COMMENT_END)
+		{
+			*found = j;
+			return entry_pos(index, j);
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * Nearest "<!--" before entry `i` and after offset 0, like find_comment_start()
+ * in html_matcher.py.  Returns its entry index or -1 for offset 0.
+ */
+static gint tag_index_find_comment_start(ZenTagIndex *index, const gchar *buf,
+	gint len, guint i)
+{
+	ZenTagEntry *entry;
+
+	while (i > 0)
+	{
+		entry = tag_index_entry(index, buf, len, --i);
+		if (entry_pos(index, i) <= 0)
+			break;
+		if (entry->type == ZEN_TAG_ENTRY_COMMENT_START)
+			return i;
+	}
+
+	return -1;
+}
+
+
+#define last_tag(stack) (&g_array_index((stack), ZenMatcherTag, (stack)->len - 1))
+
+
+/* An open element of a search: the entry of its first tag found */
+typedef struct
+{
+	guint entry;
+	gint reach;			/* furthest caret its inside is looked at differently for */
+}
+ZenTagLevel;
+
+
+#define last_level(levels) (&g_array_index((levels), ZenTagLevel, (levels)->len - 1))
+
+
+/* Notes that the inside of the innermost open element depends on carets up to `reach` */
+static void tag_index_reach(GArray *levels, gint reach)
+{
+	if (levels->len > 0)
+		last_level(levels)->reach = MAX(last_level(levels)->reach, reach);
+}
+
+
+static void tag_index_push_level(GArray *levels, guint entry)
+{
+	ZenTagLevel level;
+
+	level.entry = entry;
+	level.reach = -1;
+	g_array_append_val(levels, level);
+}
+
+
+/* Links the tag of the innermost open element to its partner at entry `i` */
+static void tag_index_pop_level(ZenTagIndex *index, GArray *levels, guint i)
+{
+	ZenTagLevel level = *last_level(levels);
+	ZenTagEntry *entry = entry_at(index, level.entry);
+
+	g_array_set_size(levels, levels->len - 1);
+	entry->link = i;
+	entry->link_reach = level.reach;
+	entry->link_stamp = index->stamp;
+	tag_index_reach(levels, level.reach);
+}
+
+
+/*
+ * Same as zen_matcher_find_pair() for the text of `doc`, where `buf` and
+ * `len` are the document's current text.
+ */
+ZenMatchType zen_tag_index_find_pair(GeanyDocument *doc, const gchar *buf,
+	gint len, gint start_ix, ZenMatcherEmptyFunc is_empty, gpointer data,
+	ZenMatch *match)
+{
+	return zen_tag_index_search(tag_index_get(doc), buf, len, start_ix,
+				is_empty, data, match);
+}
+
+
+/*
+ * Same as zen_matcher_find_pair() for the text `index` describes, where
+ * `buf` and `len` are that text.
+ */
+ZenMatchType zen_tag_index_search(ZenTagIndex *index, const gchar *buf,
+	gint len, gint start_ix, ZenMatcherEmptyFunc is_empty, gpointer data,
+	ZenMatch *match)
+{
+	ZenTagEntry *entry;
+	GArray *stack, *levels;
+	ZenMatcherTag tag, opening = { 0 }, closing = { 0 };
+	gboolean have_opening = FALSE, have_closing = FALSE;
+	guint first, i, found;
+	gint comment, end_ix;
+
+	match->type = ZEN_MATCH_NONE;
+	match->start = match->end = -1;
+	match->close_start = match->close_end = -1;
+
+	/* also catches any change made while notifications weren't seen */
+	if (index->length != len)
+		tag_index_build(index, buf, len);
+
+	/* which tags are empty decides what pairs up */
+	if (index->is_empty != is_empty || index->is_empty_data != data)
+	{
+		tag_index_unlink(index);
+		index->is_empty = is_empty;
+		index->is_empty_data = data;
+	}
+
+	start_ix = MIN(start_ix, len);
+	first = tag_index_lower_bound(index, start_ix);
+	stack = g_array_new(FALSE, FALSE, sizeof(ZenMatcherTag));
+	levels = g_array_new(FALSE, FALSE, sizeof(ZenTagLevel));
+
+	/* find opening tag */
+	for (i = first; i > 0; i--)
+	{
+		entry = tag_index_entry(index, buf, len, i - 1);
+		switch (entry->type)
+		{
+			case ZEN_TAG_ENTRY_END_TAG:
+				tag_index_entry_to_tag(index, i - 1, &tag);
+				if (tag.start < start_ix && tag.end > start_ix)
+				{
+					/* direct hit on searched closing tag */
+					closing = tag;
+					have_closing = TRUE;
+					tag_index_reach(levels, G_MAXINT);
+				}
+				else if (entry_linked(index, entry) && entry->link_reach < start_ix)
+				{
+					/* step over the element to its start tag, which pops this */
+					tag_index_reach(levels, MAX(tag.end - 1, entry->link_reach));
+					i = entry->link + 1;
+				}
+				else
+				{
+					tag_index_reach(levels, tag.end - 1);
+					g_array_append_val(stack, tag);
+					tag_index_push_level(levels, i - 1);
+				}
+				break;
+
+			case ZEN_TAG_ENTRY_START_TAG:
+				tag_index_entry_to_tag(index, i - 1, &tag);
+				if (!tag.unary)
+					tag.unary = zen_matcher_is_empty(buf, &tag, is_empty, data);
+
+				if (tag.unary)
+				{
+					if (tag.start < start_ix && tag.end > start_ix)
+					{
+						/* exact match */
+						match->type = ZEN_MATCH_TAG;
+						match->start = tag.start;
+						match->end = tag.end;
+					}
+					tag_index_reach(levels, tag.end - 1);
+				}
+				else if (stack->len > 0 &&
+					zen_matcher_tag_names_equal(buf, last_tag(stack), &tag))
+				{
+					g_array_set_size(stack, stack->len - 1);
+					tag_index_pop_level(index, levels, i - 1);
+				}
+				else
+				{
+					/* found nearest unclosed tag */
+					opening = tag;
+					have_opening = TRUE;
+				}
+				break;
+
+			case ZEN_TAG_ENTRY_COMMENT_START:
+				end_ix = tag_index_find_comment_end(index, buf, len, i - 1, &found);
+				end_ix = (end_ix != -1 ? end_ix : entry_pos(index, i - 1) - 1) + 3;
+				if (entry_pos(index, i - 1) < start_ix && end_ix >= start_ix)
+				{
+					match->type = ZEN_MATCH_COMMENT;
+					match->start = entry_pos(index, i - 1);
+					match->end = end_ix;
+				}
+				tag_index_reach(levels, end_ix);
+				break;
+
+			case ZEN_TAG_ENTRY_COMMENT_END:
+				/* search left until comment start is reached */
+				comment = tag_index_find_comment_start(index, buf, len, i - 1);
+				i = (comment != -1) ? (guint) comment + 1 : 1;
+				break;
+
+			default:
+				break;
+		}
+
+		if (match->type != ZEN_MATCH_NONE || have_opening)
+			break;
+	}
+
+	if (match->type != ZEN_MATCH_NONE || !have_opening)
+	{
+		g_array_free(levels, TRUE);
+		g_array_free(stack, TRUE);
+		return match->type;
+	}
+
+	/* find closing tag, what pairs up here doesn't depend on the caret */
+	g_array_set_size(stack, 0);
+	g_array_set_size(levels, 0);
+	for (i = first; !have_closing && i < index->entries->len; i++)
+	{
+		entry = tag_index_entry(index, buf, len, i);
+		switch (entry->type)
+		{
+			case ZEN_TAG_ENTRY_START_TAG:
+				tag_index_entry_to_tag(index, i, &tag);
+				if (!tag.unary && !zen_matcher_is_empty(buf, &tag, is_empty, data))
+				{
+					if (entry_linked(index, entry))
+					{
+						/* step over the element to its end tag */
+						i = entry->link;
+					}
+					else
+					{
+						g_array_append_val(stack, tag);
+						tag_index_push_level(levels, i);
+					}
+				}
+				break;
+
+			case ZEN_TAG_ENTRY_END_TAG:
+				tag_index_entry_to_tag(index, i, &tag);
+				if (stack->len > 0 && zen_matcher_tag_names_equal(buf, last_tag(stack), &tag))
+				{
+					g_array_set_size(stack, stack->len - 1);
+					tag_index_pop_level(index, levels, i);
+				}
+				else
+				{
+					/* found matched closing tag */
+					closing = tag;
+					have_closing = TRUE;
+				}
+				break;
+
+			case ZEN_TAG_ENTRY_COMMENT_START:
+				/* skip comment, nothing can start inside the "-->" itself */
+				if (tag_index_find_comment_end(index, buf, len, i, &found) != -1)
+					i = found;
+				break;
+
+			case ZEN_TAG_ENTRY_COMMENT_END:
+				/* looks like cursor was inside comment with invalid HTML */
+				comment = tag_index_find_comment_start(index, buf, len, i);
+				match->type = ZEN_MATCH_COMMENT;
+				match->start = (comment != -1) ? entry_pos(index, comment) : 0;
+				match->end = entry_pos(index, i) + 3;
+				break;
+
+			default:
+				break;
+		}
+
+		if (match->type != ZEN_MATCH_NONE)
+			break;
+	}
+
+	g_array_free(levels, TRUE);
+	g_array_free(stack, TRUE);
+
+	if (match->type == ZEN_MATCH_NONE)
+	{
+		match->type = ZEN_MATCH_TAG;
+		match->start = opening.start;
+		match->end = opening.end;
+		if (have_closing)
+		{
+			match->close_start = closing.start;
+			match->close_end = closing.end;
+		}
+	}
+
+	return match->type;
+}
@@ -0,0 +1,52 @@
+/*
+ * zen-tag-index.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_TAG_INDEX_H
+#define ZEN_TAG_INDEX_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ZenTagIndex ZenTagIndex;
+
+
+void zen_tag_index_notify(GeanyDocument *doc, SCNotification *nt);
+void zen_tag_index_remove(GeanyDocument *doc);
+void zen_tag_index_cleanup(void);
+
+ZenMatchType zen_tag_index_find_pair(GeanyDocument *doc, const gchar *buf,
+	gint len, gint start_ix, ZenMatcherEmptyFunc is_empty, gpointer data,
+	ZenMatch *match);
+
+ZenTagIndex *zen_tag_index_copy(GeanyDocument *doc, gint len);
+ZenMatchType zen_tag_index_search(ZenTagIndex *index, const gchar *buf,
+	gint len, gint start_ix, ZenMatcherEmptyFunc is_empty, gpointer data,
+	ZenMatch *match);
+void zen_tag_index_adopt(GeanyDocument *doc, ZenTagIndex *index);
+void zen_tag_index_free(ZenTagIndex *index);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_TAG_INDEX_H */
@@ -0,0 +1,374 @@
+/*
+ * zen-xml.c
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * This file contains a native version of the XML tokenizer and parser in
+ * zencoding/parser/xml.py, exposed to Python as geany.xml_lex().  It gives
+ * the same token styles as xml.parse(), including the tag and attribute
+ * names and the errors the parser marks, but returns them as a flat array
+ * of (style, start, end) offsets into the source instead of token dicts.
+ * Like the Python tokenizer, the end of a token doesn't include the
+ * whitespace that follows it.
+ *
+ * Comments, CDATA sections, doctypes and processing instructions make the
+ * Python version fail or behave oddly, so the native lexer gives up on
+ * them and lets xml.py handle the source.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <geanyplugin.h>
+#include "zen-xml.h"
+#include "zen-css.h"
+
+
+/* is_white_space() in xml.py */
+#define is_white_space(c) ((c) != '\n' && g_ascii_isspace(c))
+/* [^\s=<>\"\'\/?] */
+#define is_name_char(c) (!g_ascii_isspace(c) && strchr("=<>\"'/?", (c)) == NULL)
+
+#define content_is(src, tok, str) \
+	((tok)[2] - (tok)[1] == (gint) strlen(str) && \
+	strncmp((src) + (tok)[1], (str), (tok)[2] - (tok)[1]) == 0)
+
+
+/* Tokenizer states, the in_*() functions of tokenize_xml() */
+typedef enum
+{
+	STATE_TEXT,
+	STATE_TAG,
+	STATE_ATTRIBUTE
+} LexState;
+
+
+/* Parser steps, the functions parse() pushes to its cc list */
+typedef enum
+{
+	STEP_BASE,
+	STEP_ELEMENT,
+	STEP_TAGNAME,
+	STEP_CLOSETAGNAME,
+	STEP_ATTRIBUTES,
+	STEP_ATTRIBUTE,
+	STEP_VALUE,
+	STEP_ENDTAG,
+	STEP_ENDTAG_FACTORY,	/* endtag itself, pushed without calling it */
+	STEP_EXPECT_GT
+} ParseStep;
+
+
+typedef struct
+{
+	const gchar *source;
+	gsize len;
+	gsize pos;
+	LexState state;
+	gchar quote;
+	GArray *steps;
+} XmlLexer;
+
+
+#define push_step(lex, step) G_STMT_START { \
+		ParseStep step_ = (step); \
+		g_array_append_val((lex)->steps, step_); \
+	} G_STMT_END
+
+
+/* Reads the next token into token[0..2], style 0 at the end of the source.
+ * Returns FALSE for the sources xml.py can't tokenize. */
+static gboolean next_token(XmlLexer *lex, gint *token)
+{
+	const gchar *src = lex->source;
+	gchar ch;
+
+	token[0] = 0;
+	token[1] = (gint) lex->pos;
+
+	if (lex->pos >= lex->len)
+		return TRUE;
+
+	if (src[lex->pos] == '\n')
+	{
+		lex->pos++;
+		token[0] = ZEN_XML_WHITESPACE;
+		token[2] = (gint) lex->pos;
+		return TRUE;
+	}
+
+	if (is_white_space(src[lex->pos]))
+		token[0] = ZEN_XML_WHITESPACE;
+
+	while (token[0] == 0)
+	{
+		switch (lex->state)
+		{
+			case STATE_TEXT:
+				ch = src[lex->pos++];
+				if (ch == '<')
+				{
+					if (lex->pos < lex->len && (src[lex->pos] == '!' || src[lex->pos] == '?'))
+						return FALSE;
+					if (lex->pos < lex->len && src[lex->pos] == '/')
+						lex->pos++;
+					lex->state = STATE_TAG;
+					token[0] = ZEN_XML_PUNCTUATION;
+				}
+				else if (ch == '&')
+				{
+					while (lex->pos < lex->len && src[lex->pos] != '\n')
+					{
+						if (src[lex->pos++] == ';')
+							break;
+					}
+					token[0] = ZEN_XML_ENTITY;
+				}
+				else
+				{
+					while (lex->pos < lex->len && src[lex->pos] != '&' &&
+						src[lex->pos] != '<' && src[lex->pos] != '\n')
+					{
+						lex->pos++;
+					}
+					token[0] = ZEN_XML_TEXT;
+				}
+				break;
+
+			case STATE_TAG:
+				ch = src[lex->pos++];
+				if (ch == '>')
+				{
+					lex->state = STATE_TEXT;
+					token[0] = ZEN_XML_PUNCTUATION;
+				}
+				else if ((ch == '?' || ch == '/') && lex->pos < lex->len && src[lex->pos] == '>')
+				{
+					lex->pos++;
+					lex->state = STATE_TEXT;
+					token[0] = ZEN_XML_PUNCTUATION;
+				}
+				else if (ch == '=')
+					token[0] = ZEN_XML_PUNCTUATION;
+				else if (ch == '"' || ch == '\'')
+				{
+					/* no token yet, the attribute value starts with the quote */
+					lex->state = STATE_ATTRIBUTE;
+					lex->quote = ch;
+				}
+				else
+				{
+					while (lex->pos < lex->len && is_name_char(src[lex->pos]))
+						lex->pos++;
+					token[0] = ZEN_XML_NAME;
+				}
+				break;
+
+			case STATE_ATTRIBUTE:
+				while (lex->pos < lex->len && src[lex->pos] != '\n')
+				{
+					if (src[lex->pos++] == lex->quote)
+					{
+						lex->state = STATE_TAG;
+						break;
+					}
+				}
+				token[0] = ZEN_XML_ATTRIBUTE;
+				break;
+		}
+	}
+
+	token[2] = (gint) lex->pos;
+
+	/* whitespace after the token belongs to it, but not to its content */
+	while (lex->pos < lex->len && is_white_space(src[lex->pos]))
+		lex->pos++;
+
+	return TRUE;
+}
+
+
+/* Runs the token through the steps parse() has queued, which may rename
+ * its style or mark it as an error */
+static void parse_token(XmlLexer *lex, gint *token)
+{
+	GArray *steps = lex->steps;
+	gboolean consumed = FALSE;
+	ParseStep step;
+
+	if (token[0] == ZEN_XML_WHITESPACE)
+		return;
+
+	while (!consumed)
+	{
+		step = g_array_index(steps, ParseStep, steps->len - 1);
+		g_array_set_size(steps, steps->len - 1);
+
+		switch (step)
+		{
+			case STEP_BASE:
+				push_step(lex, STEP_BASE);
+				push_step(lex, STEP_ELEMENT);
+				break;
+
+			case STEP_ELEMENT:
+				if (content_is(lex->source, token, "<"))
+				{
+					push_step(lex, STEP_ENDTAG);
+					push_step(lex, STEP_ATTRIBUTES);
+					push_step(lex, STEP_TAGNAME);
+				}
+				else if (content_is(lex->source, token, "</"))
+				{
+					push_step(lex, STEP_EXPECT_GT);
+					push_step(lex, STEP_CLOSETAGNAME);
+				}
+				else if (token[0] != ZEN_XML_TEXT && token[0] != ZEN_XML_ENTITY)
+					token[0] += ZEN_XML_ERROR;
+				consumed = TRUE;
+				break;
+
+			case STEP_TAGNAME:
+				if (token[0] == ZEN_XML_NAME)
+				{
+					token[0] = ZEN_XML_TAGNAME;
+					consumed = TRUE;
+				}
+				break;
+
+			case STEP_CLOSETAGNAME:
+				/* parse() never remembers the name of the open tag, so closing
+				 * tag names never match */
+				if (token[0] == ZEN_XML_NAME)
+					token[0] = ZEN_XML_TAGNAME + ZEN_XML_ERROR;
+				consumed = TRUE;
+				break;
+
+			case STEP_ATTRIBUTES:
+				if (token[0] == ZEN_XML_NAME)
+				{
+					token[0] = ZEN_XML_ATTNAME;
+					push_step(lex, STEP_ATTRIBUTES);
+					push_step(lex, STEP_ATTRIBUTE);
+					consumed = TRUE;
+				}
+				break;
+
+			case STEP_ATTRIBUTE:
+				if (content_is(lex->source, token, "="))
+				{
+					push_step(lex, STEP_VALUE);
+					consumed = TRUE;
+				}
+				else if (content_is(lex->source, token, ">") ||
+					content_is(lex->source, token, "/>"))
+				{
+					push_step(lex, STEP_ENDTAG_FACTORY);
+				}
+				break;
+
+			case STEP_VALUE:
+				if (token[0] == ZEN_XML_ATTRIBUTE)
+				{
+					push_step(lex, STEP_VALUE);
+					consumed = TRUE;
+				}
+				break;
+
+			case STEP_ENDTAG:
+				if (!content_is(lex->source, token, ">") &&
+					!content_is(lex->source, token, "/>"))
+				{
+					token[0] += ZEN_XML_ERROR;
+				}
+				consumed = TRUE;
+				break;
+
+			case STEP_ENDTAG_FACTORY:
+				break;
+
+			case STEP_EXPECT_GT:
+				if (content_is(lex->source, token, ">"))
+					consumed = TRUE;
+				else
+					token[0] += ZEN_XML_ERROR;
+				break;
+		}
+	}
+}
+
+
+/*
+ * Appends a (style, start, end) triple of gints to tokens for each token
+ * in source.  Returns FALSE if the source should be left to xml.py,
+ * tokens then only contains the tokens before that point.
+ */
+gboolean zen_xml_lex(const gchar *source, gsize len, GArray *tokens)
+{
+	XmlLexer lex = { source, len, 0, STATE_TEXT, '\0', NULL };
+	gboolean res = TRUE;
+	gint token[3];
+
+	lex.steps = g_array_new(FALSE, FALSE, sizeof(ParseStep));
+	push_step(&lex, STEP_BASE);
+
+	while ((res = next_token(&lex, token)) && token[0] != 0)
+	{
+		parse_token(&lex, token);
+		g_array_append_vals(tokens, token, 3);
+	}
+
+	g_array_free(lex.steps, TRUE);
+
+	return res;
+}
+
+
+PyObject *zen_xml_py_lex(PyObject *self, PyObject *args)
+{
+	PyObject *source, *result;
+	const void *buf;
+	Py_ssize_t len;
+	GArray *tokens;
+
+	if (!PyArg_ParseTuple(args, "O", &source))
+		return NULL;
+
+	/* offsets into unicode strings are left to the Python version */
+	if (PyUnicode_Check(source))
+		Py_RETURN_NONE;
+
+	if (PyObject_AsReadBuffer(source, &buf, &len) != 0)
+		return NULL;
+
+	tokens = g_array_sized_new(FALSE, FALSE, sizeof(gint), 3 * (len / 4 + 1));
+
+	if (zen_xml_lex((const gchar *) buf, len, tokens))
+		result = zen_css_py_token_array(tokens);
+	else
+	{
+		result = Py_None;
+		Py_INCREF(result);
+	}
+
+	g_array_free(tokens, TRUE);
+
+	return result;
+}
@@ -0,0 +1,62 @@
+/*
+ * zen-xml.h
+ *
+ * Copyright 2011 Matthew Brush <mbrush@codebrainz.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA.
+ *
+ */
+
+#ifndef ZEN_XML_H
+#define ZEN_XML_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Token styles, same values as the STYLE_* constants in
+ * zencoding/parser/xml.py.  Each " xml-error" the parser appends to a style
+ * adds ZEN_XML_ERROR to it.
+ */
+typedef enum
+{
+	ZEN_XML_WHITESPACE = 1,
+	ZEN_XML_PUNCTUATION,
+	ZEN_XML_NAME,
+	ZEN_XML_TAGNAME,
+	ZEN_XML_ATTNAME,
+	ZEN_XML_ATTRIBUTE,
+	ZEN_XML_TEXT,
+	ZEN_XML_ENTITY,
+	ZEN_XML_COMMENT,
+	ZEN_XML_CDATA,
+	ZEN_XML_DOCTYPE,
+	ZEN_XML_PROCESSING
+} ZenXmlTokenStyle;
+
+#define ZEN_XML_ERROR 16
+
+
+gboolean zen_xml_lex(const gchar *source, gsize len, GArray *tokens);
+
+PyObject *zen_xml_py_lex(PyObject *self, PyObject *args);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* ZEN_XML_H */
@@ -1,4 +1,5 @@
 import utils
+import resources
 import re
 import os
 import imp
@@ -7,6 +8,15 @@ __actions = {}
 __filters = {}
 __imported = []
 
+expansion_cache_size = 64
+"Number of expanded abbreviations to remember, 0 disables the cache"
+
+output_chunk_size = 64 * 1024
+"Size of the chunks expand_abbreviation_chunks() yields, in characters"
+
+__expansion_cache = {}
+__expansion_cache_state = {'generation': None, 'tick': 0, 'hits': 0, 'misses': 0}
+
 def action(name=None, action_func=None):
 	"Decorator for Zen Coding actions"
 	if name == None and action_func == None:
@@ -49,12 +59,14 @@ def filter(name=None, filter_func=None):
 	elif name != None and filter_func != None:
 		# zencoding.filter('somename', somefunc)
 		__filters[name] = filter_func
+		resources.settings_changed()
 		return filter_func
 	else:
 		raise "Unsupported arguments to Zen Filter: (%r, %r)", (name, filter_func)
 
 def filter_function(func):
 	__filters[getattr(func, "_decorated_function", func).__name__] = func
+	resources.settings_changed()
 	return func
 
 def run_action(name, *args, **kwargs):
@@ -70,11 +82,22 @@ def run_action(name, *args, **kwargs):
 	 zencoding.run_actions('expand_abbreviation', zen_editor)
 	 zencoding.run_actions('wrap_with_abbreviation', zen_editor, 'div')  
 	"""
-	import zencoding.actions
-	if name in __actions:
-		return __actions[name](*args, **kwargs)
+	action_func = get_action(name)
+	if action_func:
+		return action_func(*args, **kwargs)
 	
 	return False
+
+def get_action(name):
+	"""
+	 Returns the function of Zen Coding action, so it can be called without
+	 looking it up again
+	 @param name: Action name
+	 @type name: str
+	 @return: function or None if there is no such action
+	"""
+	import zencoding.actions
+	return __actions.get(name)
 		
 def run_filters(tree, profile, filter_list):
 	"""
@@ -98,9 +121,77 @@ def run_filters(tree, profile, filter_list):
 			
 	return tree
 
+def _cache_key(abbr, syntax, profile_name):
+	"""
+	Returns the expansion cache key for passed arguments, or None if their
+	expansion shouldn't be cached. Drops the cache if settings have changed
+	since it was filled
+	@return: tuple
+	"""
+	if not expansion_cache_size or callable(utils.caret_placeholder) or \
+		not isinstance(profile_name, basestring):
+		# output may differ between calls or the profile isn't a name
+		return None
+	
+	state = __expansion_cache_state
+	if state['generation'] != resources.settings_generation:
+		__expansion_cache.clear()
+		state['generation'] = resources.settings_generation
+	
+	return (abbr, syntax, profile_name)
+
+def _cache_get(key):
+	"""
+	Returns cached expansion or None
+	@type key: tuple
+	@return: str
+	"""
+	state = __expansion_cache_state
+	state['tick'] += 1
+	entry = __expansion_cache.get(key)
+	if entry is not None:
+		state['hits'] += 1
+		entry[0] = state['tick']
+		return entry[1]
+	
+	state['misses'] += 1
+	return None
+
+def _cache_put(key, result):
+	"""
+	Remembers expansion, dropping the least recently used one if the cache
+	is full
+	@type key: tuple
+	@type result: str
+	"""
+	if len(__expansion_cache) >= expansion_cache_size:
+		oldest = min(__expansion_cache, key=lambda k: __expansion_cache[k][0])
+		del __expansion_cache[oldest]
+	
+	__expansion_cache[key] = [__expansion_cache_state['tick'], result]
+
 def expand_abbreviation(abbr, syntax='html', profile_name='plain'):
 	"""
-	Expands abbreviation into a XHTML tag string
+	Expands abbreviation into a XHTML tag string. The most recently used
+	expansions are cached until the settings change, see
+	<code>expansion_cache_size</code>
+	@type abbr: str
+	@return: str
+	"""
+	key = _cache_key(abbr, syntax, profile_name)
+	if key is None:
+		return _expand_abbreviation(abbr, syntax, profile_name)
+	
+	result = _cache_get(key)
+	if result is None:
+		result = _expand_abbreviation(abbr, syntax, profile_name)
+		_cache_put(key, result)
+	
+	return result
+
+def _expand_abbreviation(abbr, syntax='html', profile_name='plain'):
+	"""
+	Expands abbreviation into a XHTML tag string, bypassing the cache
 	@type abbr: str
 	@return: str
 	"""
@@ -112,6 +203,61 @@ def expand_abbreviation(abbr, syntax='html', profile_name='plain'):
 	
 	return ''
 
+def expand_abbreviation_chunks(abbr, syntax='html', profile_name='plain', chunk_size=None):
+	"""
+	Expands abbreviation like <code>expand_abbreviation()</code>, but yields
+	the output in chunks of about <code>chunk_size</code> characters
+	(<code>output_chunk_size</code> by default), so a huge expansion is never
+	held as one string. Only expansions that fit in a single chunk are cached
+	@type abbr: str
+	@type chunk_size: int
+	@return: generator of str
+	"""
+	chunk_size = chunk_size or output_chunk_size
+	key = _cache_key(abbr, syntax, profile_name)
+	result = key and _cache_get(key)
+	if result is not None:
+		for i in xrange(0, len(result), chunk_size):
+			yield result[i:i + chunk_size]
+		return
+	
+	tree_root = utils.parse_into_tree(abbr, syntax)
+	chunks = []
+	if tree_root:
+		tree = utils.rollout_tree(tree_root)
+		utils.apply_filters(tree, syntax, profile_name, tree_root.filters)
+		for chunk in utils.chunk_output(tree.iter_output(), chunk_size):
+			if chunks is not None:
+				if chunks:
+					chunks = None
+				else:
+					chunks.append(chunk)
+			yield chunk
+	
+	if key and chunks is not None:
+		_cache_put(key, ''.join(chunks))
+
+def get_expansion_cache_stats():
+	"""
+	Returns hit and miss counts of the expansion cache, along with its
+	current and maximum size, to help choosing <code>expansion_cache_size</code>
+	@return: dict
+	"""
+	state = __expansion_cache_state
+	return {
+		'hits': state['hits'],
+		'misses': state['misses'],
+		'size': len(__expansion_cache),
+		'max_size': expansion_cache_size
+	}
+
+def clear_expansion_cache():
+	"""
+	Drops all cached expansions and resets the hit and miss counts
+	"""
+	__expansion_cache.clear()
+	__expansion_cache_state.update(hits=0, misses=0)
+
 def wrap_with_abbreviation(abbr, text, syntax='html', profile='plain'):
 	"""
 	Wraps passed text with abbreviation. Text will be placed inside last
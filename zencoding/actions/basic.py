@@ -12,6 +12,7 @@ import zencoding.utils
 import zencoding.html_matcher as html_matcher
 import zencoding.interface.file as zen_file
 import base64
+import itertools
 import re
 
 mime_types = {
@@ -34,11 +35,11 @@ def find_abbreviation(editor):
 	start, end = editor.get_selection_range()
 	if start != end:
 		# abbreviation is selected by user
-		return editor.get_content()[start:end];
+		return editor.get_content_range(start, end)
 	
 	# search for new abbreviation from current caret position
 	cur_line_start, cur_line_end = editor.get_current_line_range()
-	return zencoding.utils.extract_abbreviation(editor.get_content()[cur_line_start:start])
+	return zencoding.utils.extract_abbreviation(editor.get_content_range(cur_line_start, start))
 
 @zencoding.action
 def expand_abbreviation(editor, syntax=None, profile_name=None):
@@ -57,18 +58,21 @@ def expand_abbreviation(editor, syntax=None, profile_name=None):
 	
 	range_start, caret_pos = editor.get_selection_range()
 	abbr = find_abbreviation(editor)
-	content = ''
 		
 	if abbr:
-		content = zencoding.expand_abbreviation(abbr, syntax, profile_name)
-		if content:
-			editor.replace_content(content, caret_pos - len(abbr), caret_pos)
+		# huge expansions go into the editor chunk by chunk
+		chunks = zencoding.expand_abbreviation_chunks(abbr, syntax, profile_name)
+		first = next(chunks, '')
+		if first:
+			chunks = itertools.imap(zencoding.utils.escape_output,
+					itertools.chain((first,), chunks))
+			editor.replace_content_stream(chunks, caret_pos - len(abbr), caret_pos)
 			return True
 	
 	return False
 
 @zencoding.action
-def expand_abbreviation_with_tab(editor, syntax, profile_name='xhtml'):
+def expand_abbreviation_with_tab(editor, syntax=None, profile_name=None):
 	"""
 	A special version of <code>expandAbbreviation</code> function: if it can't
 	find abbreviation, it will place Tab character at caret position
@@ -98,7 +102,7 @@ def match_pair(editor, direction='out', syntax=None):
 	
 	range_start, range_end = editor.get_selection_range()
 	cursor = range_end
-	content = editor.get_content()
+	content = editor.get_content_view()
 	rng = None
 	
 	old_open_tag = html_matcher.last_match['opening_tag']
@@ -120,7 +124,7 @@ def match_pair(editor, direction='out', syntax=None):
 			else:
 				rng = (old_open_tag.end, old_close_tag.start)
 		else:
-			new_cursor = content[0:old_close_tag.start].find('<', old_open_tag.end)
+			new_cursor = content.find('<', old_open_tag.end, old_close_tag.start)
 			search_pos = new_cursor + 1 if new_cursor != -1 else old_open_tag.end
 			rng = html_matcher.match(content, search_pos, syntax)
 	else:
@@ -183,7 +187,7 @@ def wrap_with_abbreviation(editor, abbr=None, syntax=None, profile_name=None):
 	if profile_name is None: profile_name = editor.get_profile_name()
 	
 	start_offset, end_offset = editor.get_selection_range()
-	content = editor.get_content()
+	content = editor.get_content_view()
 	
 	if start_offset == end_offset:
 		# no selection, find tag pair
@@ -202,7 +206,7 @@ def wrap_with_abbreviation(editor, abbr=None, syntax=None, profile_name=None):
 	result = zencoding.wrap_with_abbreviation(abbr, zencoding.utils.unindent_text(new_content, padding), syntax, profile_name)
 	
 	if result:
-		editor.replace_content(result, start_offset, end_offset)
+		editor.replace_content(zencoding.utils.escape_output(result), start_offset, end_offset)
 		return True
 	
 	return False
@@ -217,25 +221,24 @@ def find_new_edit_point(editor, inc=1, offset=0):
 	@return: -1 if insertion point wasn't found
 	"""
 	cur_point = editor.get_caret_pos() + offset
-	content = editor.get_content()
-	max_len = len(content)
+	max_len = len(editor.get_content_view())
 	next_point = -1
 	re_empty_line = r'^\s+$'
 	
 	def get_line(ix):
 		start = ix
 		while start >= 0:
-			c = content[start]
+			c = editor.char_at(start)
 			if c == '\n' or c == '\r': break
 			start -= 1
 		
-		return content[start:ix]
+		return start >= 0 and editor.get_content_range(start, ix) or ''
 		
 	while cur_point < max_len and cur_point > 0:
 		cur_point += inc
-		cur_char = zencoding.utils.char_at(content, cur_point)
-		next_char = zencoding.utils.char_at(content, cur_point + 1)
-		prev_char = zencoding.utils.char_at(content, cur_point - 1)
+		cur_char = editor.char_at(cur_point)
+		next_char = editor.char_at(cur_point + 1)
+		prev_char = editor.char_at(cur_point - 1)
 		
 		if cur_char in '"\'':
 			if next_char == cur_char and prev_char == '=':
@@ -260,12 +263,21 @@ def prev_edit_point(editor):
 	@param editor: Editor instance
 	@type editor: ZenEditor
 	"""
-	cur_pos = editor.get_caret_pos()
-	new_point = find_new_edit_point(editor, -1)
+	sel_start = editor.get_selection_range()[0]
+	tabstop = editor.get_prev_tabstop(sel_start)
+	
+	# search from before a selected tabstop, not from inside of it
+	offset = sel_start - editor.get_caret_pos()
+	new_point = find_new_edit_point(editor, -1, offset)
 		
-	if new_point == cur_pos:
+	if new_point == sel_start:
 		# we're still in the same point, try searching from the other place
-		new_point = find_new_edit_point(editor, -1, -2)
+		new_point = find_new_edit_point(editor, -1, offset - 2)
+	
+	# go to whichever of the two is nearer
+	if tabstop and tabstop[0] >= new_point:
+		editor.create_selection(tabstop[0], tabstop[1])
+		return True
 	
 	if new_point != -1:
 		editor.set_caret_pos(new_point)
@@ -280,7 +292,15 @@ def next_edit_point(editor):
 	@param editor: Editor instance
 	@type editor: ZenEditor
 	""" 
-	new_point = find_new_edit_point(editor, 1)
+	sel_end = editor.get_selection_range()[1]
+	tabstop = editor.get_next_tabstop(sel_end)
+	new_point = find_new_edit_point(editor, 1, sel_end - editor.get_caret_pos())
+	
+	# go to whichever of the two is nearer
+	if tabstop and (new_point == -1 or tabstop[0] <= new_point):
+		editor.create_selection(tabstop[0], tabstop[1])
+		return True
+	
 	if new_point != -1:
 		editor.set_caret_pos(new_point)
 		return True
@@ -302,7 +322,7 @@ def insert_formatted_newline(editor, mode='html'):
 		
 	if mode == 'html':
 		# let's see if we're breaking newly created tag
-		pair = html_matcher.get_tags(editor.get_content(), editor.get_caret_pos(), editor.get_profile_name())
+		pair = html_matcher.get_tags(editor.get_content_view(), editor.get_caret_pos(), editor.get_profile_name())
 		
 		if pair[0] and pair[1] and pair[0].type == 'tag' and pair[0].end == caret_pos and pair[1].start == caret_pos:
 			editor.replace_content(nl + pad + zencoding.utils.get_caret_placeholder() + nl, caret_pos)
@@ -331,7 +351,7 @@ def go_to_matching_pair(editor):
 	@param editor: Editor instance
 	@type editor: ZenEditor
 	"""
-	content = editor.get_content()
+	content = editor.get_content_view()
 	caret_pos = editor.get_caret_pos()
 	
 	if content[caret_pos] == '<': 
@@ -365,16 +385,16 @@ def merge_lines(editor):
 	start, end = editor.get_selection_range()
 	if start == end:
 		# find matching tag
-		pair = html_matcher.match(editor.get_content(), editor.get_caret_pos(), editor.get_profile_name())
+		pair = html_matcher.match(editor.get_content_view(), editor.get_caret_pos(), editor.get_profile_name())
 		if pair and pair[0] is not None:
 			start, end = pair
 	
 	if start != end:
 		# got range, merge lines
-		text = editor.get_content()[start:end]
+		text = editor.get_content_view()[start:end]
 		lines = map(lambda s: re.sub(r'^\s+', '', s), zencoding.utils.split_by_lines(text))
 		text = re.sub(r'\s{2,}', ' ', ''.join(lines))
-		editor.replace_content(text, start, end)
+		editor.replace_content(zencoding.utils.escape_text(text), start, end)
 		editor.create_selection(start, start + len(text))
 		return True
 	
@@ -392,7 +412,7 @@ def toggle_comment(editor):
 		# current token, we have to make sure that cursor is not inside
 		# 'style' attribute of html element
 		caret_pos = editor.get_caret_pos()
-		pair = html_matcher.get_tags(editor.get_content(),caret_pos)
+		pair = html_matcher.get_tags(editor.get_content_view(),caret_pos)
 		if pair and pair[0] and pair[0].type == 'tag' and pair[0].start <= caret_pos and pair[0].end >= caret_pos:
 			syntax = 'html'
 	
@@ -408,7 +428,7 @@ def toggle_html_comment(editor):
 	@return: True if comment was toggled
 	"""
 	start, end = editor.get_selection_range()
-	content = editor.get_content()
+	content = editor.get_content_view()
 		
 	if start == end:
 		# no selection, find matching tag
@@ -432,7 +452,7 @@ def toggle_css_comment(editor):
 		start, end = editor.get_current_line_range()
 
 		# adjust start index till first non-space character
-		start, end = narrow_to_non_space(editor.get_content(), start, end)
+		start, end = narrow_to_non_space(editor.get_content_view(), start, end)
 	
 	return generic_comment_toggle(editor, '/*', '*/', start, end)
 
@@ -494,7 +514,7 @@ def generic_comment_toggle(editor, comment_start, comment_end, range_start, rang
 	@type range_end: int
 	@return: bool
 	"""
-	content = editor.get_content()
+	content = editor.get_content_view()
 	caret_pos = [editor.get_caret_pos()]
 	new_content = None
 		
@@ -532,7 +552,9 @@ def generic_comment_toggle(editor, comment_start, comment_end, range_start, rang
 	# replace editor content
 	if new_content is not None:
 		d = caret_pos[0] - range_start
-		new_content = new_content[0:d] + zencoding.utils.get_caret_placeholder() + new_content[d:]
+		new_content = zencoding.utils.escape_text(new_content[0:d]) + \
+			zencoding.utils.get_caret_placeholder() + \
+			zencoding.utils.escape_text(new_content[d:])
 		editor.replace_content(zencoding.utils.unindent(editor, new_content), range_start, range_end)
 		return True
 	
@@ -554,7 +576,7 @@ def split_join_tag(editor, profile_name=None):
 	caret = zencoding.utils.get_caret_placeholder()
 
 	# find tag at current position
-	pair = html_matcher.get_tags(editor.get_content(), caret_pos, profile_name or editor.get_profile_name())
+	pair = html_matcher.get_tags(editor.get_content_view(), caret_pos, profile_name or editor.get_profile_name())
 	if pair and pair[0]:
 		new_content = pair[0].full_tag
 		
@@ -569,10 +591,11 @@ def split_join_tag(editor, profile_name=None):
 			
 			# add caret placeholder
 			if len(new_content) + pair[0].start < caret_pos:
-				new_content += caret
+				new_content = zencoding.utils.escape_text(new_content) + caret
 			else:
 				d = caret_pos - pair[0].start
-				new_content = new_content[0:d] + caret + new_content[d:]
+				new_content = zencoding.utils.escape_text(new_content[0:d]) + caret + \
+					zencoding.utils.escape_text(new_content[d:])
 			
 			editor.replace_content(new_content, pair[0].start, pair[1].end)
 		else: # split tag
@@ -582,7 +605,7 @@ def split_join_tag(editor, profile_name=None):
 			# define tag content depending on profile
 			tag_content = profile['tag_nl'] is True and nl + pad + caret + nl or caret
 			
-			new_content = '%s%s</%s>' % (re.sub(r'\s*\/>$', '>', new_content), tag_content, pair[0].name)
+			new_content = '%s%s</%s>' % (zencoding.utils.escape_text(re.sub(r'\s*\/>$', '>', new_content)), tag_content, pair[0].name)
 			editor.replace_content(new_content, pair[0].start, pair[0].end)
 		
 		return True
@@ -622,7 +645,7 @@ def remove_tag(editor):
 	@type editor: ZenEditor
 	"""
 	caret_pos = editor.get_caret_pos()
-	content = editor.get_content()
+	content = editor.get_content_view()
 		
 	# search for tag
 	pair = zencoding.html_matcher.get_tags(content, caret_pos, editor.get_profile_name())
@@ -633,11 +656,11 @@ def remove_tag(editor):
 		else:
 			tag_content_range = narrow_to_non_space(content, pair[0].end, pair[1].start)
 			start_line_bounds = get_line_bounds(content, tag_content_range[0])
-			start_line_pad = zencoding.utils.get_line_padding(content[start_line_bounds[0]:start_line_bounds[1]])
-			tag_content = content[tag_content_range[0]:tag_content_range[1]]
+			start_line_pad = zencoding.utils.get_line_padding(editor.get_content_range(*start_line_bounds))
+			tag_content = editor.get_content_range(*tag_content_range)
 				
 			tag_content = zencoding.utils.unindent_text(tag_content, start_line_pad)
-			editor.replace_content(zencoding.utils.get_caret_placeholder() + tag_content, pair[0].start, pair[1].end)
+			editor.replace_content(zencoding.utils.get_caret_placeholder() + zencoding.utils.escape_text(tag_content), pair[0].start, pair[1].end)
 		
 		return True
 	else:
@@ -659,6 +682,14 @@ def starts_with(token, text, pos=0):
 	"""
 	return text[pos] == token[0] and text[pos:pos + len(token)] == token
 	
+re_image_src = re.compile(r'(src=(["\'])?)([^\'"<>\s]+)\1?')
+re_image_url = re.compile(r'(url\(([\'"])?)([^\'"\)\s]+)\1?')
+re_data_url_header = re.compile(r'data\:.+?;.+?,')
+re_not_base64 = re.compile(r'[^A-Za-z0-9+/=]+')
+
+base64_chunk = 3 * 64 * 1024
+"Bytes encoded at once, a multiple of 3 so the chunks have no padding"
+
 @zencoding.action
 def encode_decode_base64(editor):
 	"""
@@ -671,19 +702,17 @@ def encode_decode_base64(editor):
 		
 	if not data:
 #		no selection, try to find image bounds from current caret position
-		text = editor.get_content()
+		text = editor.get_content_view()
 		
 		while caret_pos >= 0:
-			text[caret_pos:]
-			
 			if starts_with('src=', text, caret_pos): # found <img src="">
-				m = re.match(r'^(src=(["\'])?)([^\'"<>\s]+)\1?', text[caret_pos:])
+				m = re_image_src.match(text, caret_pos)
 				if m:
 					data = m.group(3)
 					caret_pos += len(m.group(1))
 				break
 			elif starts_with('url(', text, caret_pos): # found CSS url() pattern
-				m = re.match(r'^(url\(([\'"])?)([^\'"\)\s]+)\1?', text[caret_pos:])
+				m = re_image_url.match(text, caret_pos)
 				if m:
 					data = m.group(3)
 					caret_pos += len(m.group(1))
@@ -701,7 +730,8 @@ def encode_decode_base64(editor):
 
 def encode_to_base64(editor, img_path, pos):
 	"""
-	Encodes image to base64
+	Encodes image to base64. The file is read, encoded and written into the
+	editor in chunks
 	@requires: zen_file
 	
 	@type editor: ZenEditor
@@ -723,19 +753,49 @@ def encode_to_base64(editor, img_path, pos):
 	if real_img_path is None:
 		raise zencoding.utils.ZenError("Can't find '%s' file" % img_path)
 	
-	b64 = base64.b64encode(zen_file.read(real_img_path))
-	if not b64:
+	try:
+		chunks = zen_file.read_chunks(real_img_path, base64_chunk)
+		first = next(chunks, None)
+	except IOError:
+		first = None
+	
+	if not first:
 		raise zencoding.utils.ZenError("Can't encode file content to base64")
 	
 	
-	b64 = 'data:' + (mime_types[zen_file.get_ext(real_img_path)] or default_mime_type) + ';base64,' + b64
+	header = 'data:' + mime_types.get(zen_file.get_ext(real_img_path), default_mime_type) + ';base64,'
+	b64 = itertools.imap(base64.b64encode, itertools.chain([first], chunks))
 	
-	editor.replace_content('$0' + b64, pos, pos + len(img_path))
+	editor.replace_content_stream(itertools.chain([header], b64), pos, pos + len(img_path))
+	editor.set_caret_pos(pos)
 	return True
 
+def decode_base64_chunks(data, start=0):
+	"""
+	Decodes base64 data from <code>start</code> on, a chunk at a time.
+	Like <code>base64.b64decode()</code>, anything but base64 characters
+	(such as line breaks) is skipped.
+	@type data: str
+	@type start: int
+	@return: generator of decoded strings
+	"""
+	# 4 base64 characters make 3 bytes, so only whole groups of 4 decode
+	# on their own, the rest is carried over to the next chunk
+	size = base64_chunk / 3 * 4
+	rest = ''
+	for i in xrange(start, len(data), size):
+		chunk = rest + re_not_base64.sub('', data[i:i + size])
+		end = len(chunk) - len(chunk) % 4
+		rest = chunk[end:]
+		yield base64.b64decode(chunk[:end])
+	
+	if rest:
+		# not a whole group, fails the same way decoding it all at once does
+		yield base64.b64decode(rest)
+
 def decode_from_base64(editor, data, pos):
 	"""
-	Decodes base64 string back to file.
+	Decodes base64 string back to file, in chunks.
 	@requires: zen_editor.prompt
 	@requires: zen_file
 	 
@@ -754,9 +814,12 @@ def decode_from_base64(editor, data, pos):
 	if not abs_path:
 		raise zencoding.utils.ZenError("Can't save file")
 	
+	m = re_data_url_header.match(data)
+	start = m.end() if m else 0
+	
+	zen_file.save_chunks(abs_path, decode_base64_chunks(data, start))
 	
-	zen_file.save(abs_path, base64.b64decode( re.sub(r'^data\:.+?;.+?,', '', data) ))
-	editor.replace_content('$0' + file_path, pos, pos + len(data))
+	editor.replace_content(zencoding.utils.get_caret_placeholder() + zencoding.utils.escape_text(file_path), pos, pos + len(data))
 	return True
 				
 def find_expression_bounds(editor, fn):
@@ -771,9 +834,11 @@ def find_expression_bounds(editor, fn):
 	@return: If expression found, returns array with start and end 
 	positions 
 	"""
-	content = editor.get_content()
+	# expressions never span lines, so only the current line is read
+	line_start, line_end = editor.get_current_line_range()
+	content = editor.get_content_range(line_start, line_end)
 	il = len(content)
-	expr_start = editor.get_caret_pos() - 1
+	expr_start = editor.get_caret_pos() - line_start - 1
 	expr_end = expr_start + 1
 		
 	# start by searching left
@@ -782,7 +847,7 @@ def find_expression_bounds(editor, fn):
 	# then search right
 	while expr_end < il and fn(content[expr_end], expr_end, content): expr_end += 1
 	
-	return expr_end > expr_start and (expr_start + 1, expr_end) or None
+	return expr_end > expr_start and (line_start + expr_start + 1, line_start + expr_end) or None
 
 @zencoding.action
 def increment_number(editor, step):
@@ -793,7 +858,6 @@ def increment_number(editor, step):
 	@param step: Increment step (may be negative)
 	@type step: int
 	"""
-	content = editor.get_content()
 	has_sign = [False]
 	has_decimal = [False]
 	
@@ -818,7 +882,7 @@ def increment_number(editor, step):
 	r = find_expression_bounds(editor, _bounds)
 	if r:
 		try:
-			num = content[r[0]:r[1]]
+			num = editor.get_content_range(r[0], r[1])
 			num = zencoding.utils.prettify_number(float(num) + float(step))
 			# mark result as selection
 			editor.replace_content('${0:%s}' % num, r[0], r[1]);
@@ -859,7 +923,6 @@ def evaluate_math_expression(editor):
 	Evaluates simple math expresison under caret
 	@param editor: ZenEditor
 	"""
-	content = editor.get_content()
 	chars = '.+-*/\\'
 		
 	r = find_expression_bounds(editor, lambda ch, start, content: ch.isdigit() or ch in chars)
@@ -867,7 +930,7 @@ def evaluate_math_expression(editor):
 	
 	if r:
 		# replace integral division: 11\2 => Math.round(11/2)
-		expr = re.sub(r'([\d\.\-]+)\\([\d\.\-]+)', 'round($1/$2)', content[r[0]:r[1]]) 
+		expr = re.sub(r'([\d\.\-]+)\\([\d\.\-]+)', 'round($1/$2)', editor.get_content_range(r[0], r[1])) 
 		
 		try:
 			result = zencoding.utils.prettify_number(eval(expr))
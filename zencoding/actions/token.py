@@ -7,14 +7,20 @@ Created on Jan 21, 2011
 @author: sergey
 '''
 from zencoding.actions.basic import starts_with
+from zencoding.actions.traverse import re_start_tag
 from zencoding.utils import prettify_number
 import base64
+import bisect
 import math
 import re
+import threading
 import zencoding
 import zencoding.interface.file as zen_file
 import zencoding.parser.utils as parser_utils
 
+_image_threads = 4
+"Threads reading images for <code>update_all_image_sizes()</code>"
+
 @zencoding.action
 def reflect_css_value(editor):
 	"""
@@ -43,23 +49,139 @@ def update_image_size(editor):
 
 def compound_update(editor, data):
 	if data:
-		text = data['data']
+		text = zencoding.utils.escape_text(data['data'])
 		
 		sel_start, sel_end = editor.get_selection_range()
 		
 		# try to preserve caret position
-		if data['caret'] < data['start'] + len(text):
+		if data['caret'] < data['start'] + len(data['data']):
 			relative_pos = data['caret'] - data['start']
 			if relative_pos >= 0:
-				text = text[:relative_pos] + zencoding.utils.get_caret_placeholder() + text[relative_pos:]
+				text = zencoding.utils.escape_text(data['data'][:relative_pos]) + \
+					zencoding.utils.get_caret_placeholder() + \
+					zencoding.utils.escape_text(data['data'][relative_pos:])
 		
-		editor.replace_content(text, data['start'], data['end'], True)
+		editor.replace_content(text, data['start'], data['end'])
 #		editor.replace_content(zencoding.utils.unindent(editor, text), data['start'], data['end'])
 		editor.create_selection(data['caret'], data['caret'] + sel_end - sel_start)
 		return True
 	
 	return False
 
+@zencoding.action
+def update_all_image_sizes(editor):
+	"""
+	Update all image sizes: updates dimensions of every image tag, or of
+	every CSS rule with an image, inside selection or the whole document.
+	Images are located and read in parallel
+	@type editor: ZenEditor
+	"""
+	if editor.get_file_path() is None:
+		raise zencoding.utils.ZenError("You should save your file before using this action")
+	
+	content = editor.get_content()
+	sel_start, sel_end = editor.get_selection_range()
+	caret_pos = editor.get_caret_pos()
+	if sel_start == sel_end:
+		start, end = 0, len(content)
+	else:
+		start, end = sel_start, sel_end
+	
+	if editor.get_syntax() == 'css':
+		images = _find_css_images(content, start, end)
+	else:
+		images = _find_html_images(content, start, end)
+	
+	if not images:
+		return False
+	
+	sizes = get_image_sizes_for_sources(editor, [src for src, update in images])
+	updates = []
+	for src, update in images:
+		if sizes.get(src):
+			updates.append(update(sizes[src]))
+	
+	if not updates:
+		return False
+	
+	# replace from the end, so positions of the remaining updates stay valid
+	updates.sort(key=lambda u: u[0], reverse=True)
+	for u_start, u_end, data in updates:
+		editor.replace_content(zencoding.utils.escape_text(data), u_start, u_end)
+	
+	def moved(pos):
+		for u_start, u_end, data in updates:
+			if u_end <= pos:
+				pos += len(data) - u_end + u_start
+		return pos
+	
+	if sel_start == sel_end:
+		editor.set_caret_pos(moved(caret_pos))
+	else:
+		editor.create_selection(moved(sel_start), moved(sel_end))
+	
+	return True
+
+def _find_html_images(content, start, end):
+	"""
+	Finds image tags between <code>start</code> and <code>end</code>
+	@return: List of (src, update) tuples, <code>update(size)</code> returns
+	(start, end, new tag)
+	"""
+	images = []
+	
+	def updater(tag_start, tag):
+		def update(size):
+			new_tag = _replace_or_append(tag, 'width', size['width'])
+			new_tag = _replace_or_append(new_tag, 'height', size['height'])
+			return tag_start, tag_start + len(tag), new_tag
+		return update
+	
+	pos = content.find('<', start, end)
+	while pos != -1:
+		m = re_start_tag.match(content, pos, end)
+		if m and m.group(1).lower() == 'img':
+			src = re.search(r'src=(["\'])(.+?)\1', m.group(2), re.IGNORECASE)
+			if src:
+				images.append((src.group(2), updater(pos, m.group(0))))
+		pos = content.find('<', pos + 1, end)
+	
+	return images
+
+def _find_css_images(content, start, end):
+	"""
+	Finds CSS rules with an image between <code>start</code> and <code>end</code>
+	@return: List of (src, update) tuples, <code>update(size)</code> returns
+	(start, end, new rule content)
+	"""
+	images = []
+	index = parser_utils.index_css_rules(content)
+	opens = index[0]
+	
+	def updater(css, cur_token):
+		def update(size):
+			data = _css_image_size_update(content, css, cur_token, size, 0)
+			return data['start'], data['end'], data['data']
+		return update
+	
+	i = bisect.bisect_left(opens, start)
+	while i < len(opens) and opens[i] < end:
+		rule = parser_utils.extract_css_rule(content, opens[i] + 1, True, index)
+		i += 1
+		if not rule or rule[1] > end:
+			continue
+		
+		css = parser_utils.parse_css(content[rule[0]:rule[1]], rule[0])
+		for j, token in enumerate(css):
+			if token['type'] == 'identifier':
+				src = _css_image_source(css, j)
+				if src:
+					# one image per rule, it gets the rule's size
+					images.append((src, updater(css, j)))
+					break
+	
+	return images
+
 def update_image_size_html(editor):
 	"""
 	Updates image size of &lt;img src=""&gt; tag
@@ -100,22 +222,61 @@ def get_image_size_for_source(editor, src):
 	@param {String} src Image source (path or data:url)
 	"""
 	if src:
-		# check if it is data:url
-		if starts_with('data:', src):
-			f_content = base64.b64decode( re.sub(r'^data\:.+?;.+?,', '', src) )
-		else:
-			editor_file = editor.get_file_path()
-			
-			if editor_file is None:
-				raise zencoding.utils.ZenError("You should save your file before using this action")
-			
-			abs_src = zen_file.locate_file(editor_file, src)
-			if not abs_src:
-				raise zencoding.utils.ZenError("Can't locate '%s' file" % src)
-			
-			f_content = zen_file.read(abs_src)
-		
+		return _image_size_for_source(editor.get_file_path(), src)
+
+def get_image_sizes_for_sources(editor, sources):
+	"""
+	Returns image dimentions for a list of sources. The images are located
+	and read on a pool of threads, as that is mostly waiting for the disk
+	@param {zen_editor} editor
+	@param sources: Image sources (paths or data:urls)
+	@type sources: list
+	@return: dict of sizes by source, None for images that can't be read
+	"""
+	editor_file = editor.get_file_path()
+	sources = list(set(sources))
+	
+	def probe(src):
+		try:
+			return _image_size_for_source(editor_file, src)
+		except (zencoding.utils.ZenError, TypeError):
+			# missing file or broken data:url, the others are still updated
+			return None
+	
+	sizes = {}
+	def work():
+		# list.pop() is atomic, so each source is taken by one thread only
+		while True:
+			try:
+				src = sources.pop()
+			except IndexError:
+				return
+			sizes[src] = probe(src)
+	
+	threads = [threading.Thread(target=work) for i in xrange(min(len(sources), _image_threads))]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	
+	return sizes
+
+def _image_size_for_source(editor_file, src):
+	"Same as <code>get_image_size_for_source()</code>, for the file of the editor"
+	# check if it is data:url
+	if starts_with('data:', src):
+		f_content = base64.b64decode( re.sub(r'^data\:.+?;.+?,', '', src) )
 		return zencoding.utils.get_image_size(f_content)
+	else:
+		if editor_file is None:
+			raise zencoding.utils.ZenError("You should save your file before using this action")
+		
+		abs_src = zen_file.locate_file(editor_file, src)
+		if not abs_src:
+			raise zencoding.utils.ZenError("Can't locate '%s' file" % src)
+		
+		# only the image headers are read
+		return zencoding.utils.get_image_file_size(abs_src)
 
 def _replace_or_append(img_tag, attr_name, attr_value):
 	"""
@@ -216,70 +377,92 @@ def update_image_size_css(editor):
 	if rule:
 		css = parser_utils.parse_css(content[rule[0]:rule[1]], rule[0])
 		cur_token = find_token_from_position(css, caret_pos, 'identifier')
-		value = find_value_token(css, cur_token + 1)
-			
-		if not value: return False
-		
-		# find insertion point
-		ins_point = find_css_insertion_point(css, cur_token)
-		
-		m = re.match(r'url\((["\']?)(.+?)\1\)', value['content'], re.I)
-		if m:
-			size = get_image_size_for_source(editor, m.group(2))
+		src = _css_image_source(css, cur_token)
+		if src:
+			size = get_image_size_for_source(editor, src)
 			if size:
-				wh = {'width': None, 'height': None}
-				updates = []
-				styler = learn_css_style(css, cur_token)
-				
-				for i, item in enumerate(css):
-					if item['type'] == 'identifier' and item['content'] in wh:
-						wh[item['content']] = i
-					
-				def update(name, val):
-					v = None
-					if wh[name] is not None:
-						v = find_value_token(css, wh[name] + 1)
-						
-					if v:
-						updates.append([v['start'], v['end'], '%spx' % val])
-					else:
-						updates.append([ins_point['token']['end'], ins_point['token']['end'], styler(name, '%spx' % val)])
-						
-				
-				update('width', size['width'])
-				update('height', size['height'])
-				
-				if updates:
-					updates.sort(lambda a,b: a[0] - b[0])
-#					updates = sorted(updates, key=lambda a: a[0]) 
-					
-					# some editors do not provide easy way to replace multiple code 
-					# fragments so we have to squash all replace operations into one
-					offset = updates[0][0]
-					offset_end = updates[-1][1]
-					data = content[offset:offset_end]
-					
-					updates.reverse()
-					for u in updates:
-						data = replace_substring(data, u[0] - offset, u[1] - offset, u[2])
-							
-						# also calculate new caret position
-						if u[0] < caret_pos:
-							caret_pos += len(u[2]) - u[1] + u[0]
-						
-					
-					if ins_point['need_col']:
-						data = replace_substring(data, ins_point['token']['end'] - offset, ins_point['token']['end'] - offset, ';')
-					
-					return {
-						'data': data,
-						'start': offset,
-						'end': offset_end,
-						'caret': caret_pos
-					};
+				return _css_image_size_update(content, css, cur_token, size, caret_pos)
 					
 	return None
 
+def _css_image_source(css, cur_token):
+	"""
+	Returns image path of the <code>url()</code> value of CSS property
+	@param css: Parsed CSS rule
+	@param cur_token: Index of the property's identifier token
+	@return: str or None
+	"""
+	value = find_value_token(css, cur_token + 1)
+	if value:
+		m = re.match(r'url\((["\']?)(.+?)\1\)', value['content'], re.I)
+		if m:
+			return m.group(2)
+	
+	return None
+
+def _css_image_size_update(content, css, cur_token, size, caret_pos):
+	"""
+	Sets width and height properties of CSS rule to image size
+	@param content: Document content
+	@param css: Parsed CSS rule
+	@param cur_token: Index of the image property's identifier token
+	@param size: Image size
+	@param caret_pos: Caret position to keep in place
+	@return: dict with replacement data, its bounds and new caret position
+	"""
+	# find insertion point
+	ins_point = find_css_insertion_point(css, cur_token)
+	
+	wh = {'width': None, 'height': None}
+	updates = []
+	styler = learn_css_style(css, cur_token)
+	
+	for i, item in enumerate(css):
+		if item['type'] == 'identifier' and item['content'] in wh:
+			wh[item['content']] = i
+		
+	def update(name, val):
+		v = None
+		if wh[name] is not None:
+			v = find_value_token(css, wh[name] + 1)
+			
+		if v:
+			updates.append([v['start'], v['end'], '%spx' % val])
+		else:
+			updates.append([ins_point['token']['end'], ins_point['token']['end'], styler(name, '%spx' % val)])
+			
+	
+	update('width', size['width'])
+	update('height', size['height'])
+	
+	updates.sort(lambda a,b: a[0] - b[0])
+#	updates = sorted(updates, key=lambda a: a[0]) 
+	
+	# some editors do not provide easy way to replace multiple code 
+	# fragments so we have to squash all replace operations into one
+	offset = updates[0][0]
+	offset_end = updates[-1][1]
+	data = content[offset:offset_end]
+	
+	updates.reverse()
+	for u in updates:
+		data = replace_substring(data, u[0] - offset, u[1] - offset, u[2])
+			
+		# also calculate new caret position
+		if u[0] < caret_pos:
+			caret_pos += len(u[2]) - u[1] + u[0]
+		
+	
+	if ins_point['need_col']:
+		data = replace_substring(data, ins_point['token']['end'] - offset, ins_point['token']['end'] - offset, ';')
+	
+	return {
+		'data': data,
+		'start': offset,
+		'end': offset_end,
+		'caret': caret_pos
+	};
+
 def learn_css_style(tokens, pos):
 	"""
 	Learns formatting style from parsed tokens
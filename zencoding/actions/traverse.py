@@ -7,36 +7,119 @@ Created on Jan 21, 2011
 
 @author: sergey
 '''
+import bisect
 import re
 import zencoding
 import zencoding.parser.utils as parser_utils
 
 start_tag = re.compile('^<([\w\:\-]+)((?:\s+[\w\-:]+(?:\s*=\s*(?:(?:"[^"]*")|(?:\'[^\']*\')|[^>\s]+))?)*)\s*(\/?)>')
+# same as start_tag, for matching in place with match(html, pos)
+re_start_tag = re.compile(start_tag.pattern[1:])
 known_xml_types = ['xml-tagname','xml-attname', 'xml-attribute']
 known_css_types = ['selector', 'identifier', 'value']
 
+_item_index = (None, None, None)
+"Content, syntax and item index of the last traversed document"
+
+def get_item_index(content, syntax):
+	"""
+	Returns item index of the document, built once for each content
+	@param content: Document content
+	@type content: str
+	@param syntax: 'css' for CSS rules, 'html' for opening tags
+	@type syntax: str
+	"""
+	global _item_index
+	cached_content, cached_syntax, index = _item_index
+	if cached_syntax != syntax or cached_content != content:
+		if syntax == 'css':
+			index = parser_utils.index_css_rules(content)
+		else:
+			index = index_opening_tags(content)
+		_item_index = (content, syntax, index)
+	
+	return index
+
+def index_opening_tags(html):
+	"""
+	Collects all opening tags in HTML, including the ones that start inside
+	other tags
+	@param html: Where to search tags
+	@type html: str
+	@return: Sorted lists of tag start and end indexes
+	"""
+	starts = []
+	ends = []
+	pos = html.find('<')
+	while pos != -1:
+		m = re_start_tag.match(html, pos)
+		if m:
+			starts.append(pos)
+			ends.append(m.end())
+		pos = html.find('<', pos + 1)
+	
+	return starts, ends
+
+def html_items(content, pos, is_backward):
+	"""
+	Generates opening tags to look for items in, starting with the tag at
+	or before pos, then following the search direction
+	"""
+	starts, ends = get_item_index(content, 'html')
+	i = bisect.bisect_right(starts, pos) - 1
+	if is_backward:
+		while i >= 0:
+			yield starts[i], ends[i]
+			i -= 1
+	else:
+		i = max(i, 0)
+		while i < len(starts):
+			yield starts[i], ends[i]
+			# skip tags that start inside this one
+			i = bisect.bisect_left(starts, ends[i], i + 1)
+
+def css_items(content, pos, is_backward):
+	"""
+	Generates CSS rules to look for items in, starting with the rule
+	<code>extract_css_rule()</code> finds at pos, then following the search
+	direction
+	"""
+	index = get_item_index(content, 'css')
+	opens, closes, braces = index
+	while 0 <= pos < len(content):
+		item = parser_utils.extract_css_rule(content, pos, is_backward, index)
+		if item:
+			yield item
+			if is_backward:
+				pos = item[0] - 1
+			else:
+				pos = item[1]
+		elif is_backward:
+			# the same rule is found down to the previous opening brace
+			i = bisect.bisect_right(opens, pos) - 1
+			if i < 0:
+				break
+			pos = opens[i] - 1
+		else:
+			# the same rule is found up to the next brace
+			i = bisect.bisect_right(braces, pos)
+			if i == len(braces):
+				break
+			pos = braces[i]
+
 def find_next_html_item(editor):
 	"""
 	Find next HTML item
 	@param editor: ZenEditor
 	"""
-	is_first = [True]
-	
-	def fn(content, search_pos, is_backward=False):
-		if is_first[0]:
-			is_first[0] = False
-			return find_opening_tag_from_position(content, search_pos)
-		else:
-			return get_opening_tag_from_position(content, search_pos)
-	
-	return find_item(editor, False, fn, get_range_for_next_item_in_html)
+	return find_item(editor, False, html_items, get_range_for_next_item_in_html)
 
 def find_prev_html_item(editor):
 	"""
 	Find previous HTML item
 	@param editor: ZenEditor
 	"""
-	return find_item(editor, True, get_opening_tag_from_position, get_range_for_prev_item_in_html)
+	return find_item(editor, True, html_items, get_range_for_prev_item_in_html)
 
 def get_range_for_next_item_in_html(tag, offset, sel_start, sel_end):
 	"""
@@ -162,9 +245,9 @@ def get_opening_tag_from_position(html, pos, is_backward=False):
 	@return: List with tag indexes if valid opening tag was found, None otherwise
 	"""
 	if html[pos] == '<':
-		m = re.search(start_tag, html[pos:])
+		m = re_start_tag.match(html, pos)
 		if m:
-			return [pos, pos + len(m.group(0))]
+			return [pos, m.end()]
 		
 	return None
 
@@ -172,55 +255,48 @@ def get_opening_tag_from_position(html, pos, is_backward=False):
 def is_quote(ch):
 	return ch == '"' or ch == "'"
 
-def find_item(editor, is_backward, extract_fn, range_fn):
+def find_item(editor, is_backward, items_fn, range_fn):
 	"""
 	@type editor: ZenEditor
 	
 	@param is_backward: Search backward (search forward otherwise)
 	@type is_backward: boolean
 	
-	@param extract_fn: Function that extracts item content
-	@type extract_fn: function
+	@param items_fn: Function that generates (start, end) ranges of items
+	to search, like <code>html_items()</code>
+	@type items_fn: function
 	
 	@param range_rn: Function that search for next token range
 	@type range_rn: function
 	"""
 	content = editor.get_content()
-	c_len = len(content)
-	loop = 100000 # endless loop protection
-	prev_range = [-1, -1]
+	prev_range = None
 	_sel_start, _sel_end = editor.get_selection_range()
 	sel_start = min(_sel_start, _sel_end)
 	sel_end = max(_sel_start, _sel_end)
+	
+	if sel_start < 0 or sel_start >= len(content):
+		return False
+	
+	for item in items_fn(content, sel_start, is_backward):
+		if prev_range == item:
+			break
 		
-	search_pos = sel_start
-	while search_pos >= 0 and search_pos < c_len and loop > 0:
-		loop -= 1
-		item = extract_fn(content, search_pos, is_backward)
-		if item:
-			if prev_range[0] == item[0] and prev_range[1] == item[1]:
-				break
+		prev_range = item
+		item_def = content[item[0]:item[1]]
+		rng = range_fn(item_def, item[0], sel_start, sel_end)
 			
-			prev_range[0] = item[0]
-			prev_range[1] = item[1]
-			item_def = content[item[0]:item[1]]
-			rng = range_fn(item_def, item[0], sel_start, sel_end)
-				
-			if rng:
-				editor.create_selection(rng[0], rng[1])
-				return True
-			else:
-				search_pos = is_backward and item[0] or item[1] - 1
-		
-		search_pos += is_backward and -1 or 1
+		if rng:
+			editor.create_selection(rng[0], rng[1])
+			return True
 	
 	return False
 
 def find_next_css_item(editor):
-	return find_item(editor, False, parser_utils.extract_css_rule, get_range_for_next_item_in_css)
+	return find_item(editor, False, css_items, get_range_for_next_item_in_css)
 
 def find_prev_css_item(editor):
-	return find_item(editor, True, parser_utils.extract_css_rule, get_range_for_prev_item_in_css)
+	return find_item(editor, True, css_items, get_range_for_prev_item_in_css)
 
 
 def get_range_for_next_item_in_css(rule, offset, sel_start, sel_end):
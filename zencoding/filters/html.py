@@ -158,11 +158,15 @@ def process(tree, profile, level=0):
 	
 		# replace counters
 		counter = zencoding.utils.get_counter_for_node(item)
-		item.start = zencoding.utils.unescape_text(zencoding.utils.replace_counter(item.start, counter))
-		item.end = zencoding.utils.unescape_text(zencoding.utils.replace_counter(item.end, counter))
-		item.content = zencoding.utils.unescape_text(zencoding.utils.replace_counter(item.content, counter));
+		item.start = zencoding.utils.replace_counter(item.start, counter)
+		item.end = zencoding.utils.replace_counter(item.end, counter)
+		item.content = zencoding.utils.replace_counter(item.content, counter)
 		
+		# escaped '$' are no tabstops, so unescape only once they're upgraded
 		tabstops[0] += zencoding.utils.upgrade_tabstops(item, tabstops[0]) + 1
+		item.start = zencoding.utils.unescape_text(item.start)
+		item.end = zencoding.utils.unescape_text(item.end)
+		item.content = zencoding.utils.unescape_text(item.content)
 		
 		process(item, profile, level + 1)
 		
@@ -14,10 +14,21 @@ dictionary for later use.
 '''
 import re
 
+try:
+	# native scanner provided by the Geany plugin, see src/zen-matcher.c
+	from geany import find_pair as _native_find_pair
+except ImportError:
+	_native_find_pair = None
+
 start_tag = r'<([\w\:\-]+)((?:\s+[\w\-:]+(?:\s*=\s*(?:(?:"[^"]*")|(?:\'[^\']*\')|[^>\s]+))?)*)\s*(\/?)>'
 end_tag = r'<\/([\w\:\-]+)[^>]*>'
 attr = r'([\w\-:]+)(?:\s*=\s*(?:(?:"((?:\\.|[^"])*)")|(?:\'((?:\\.|[^\'])*)\')|([^>\s]+)))?'
 
+# compiled once so tags can be matched in place with match(html, pos)
+# instead of slicing the rest of the document at every '<'
+re_start_tag = re.compile(start_tag)
+re_end_tag = re.compile(end_tag)
+
 "Last matched HTML pair"
 last_match = {
 	'opening_tag': None, # Tag() or Comment() object
@@ -161,7 +172,8 @@ def get_tags(html, start_ix, mode='xhtml'):
 def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 	"""
 	Search for matching tags in <code>html</code>, starting from
-	<code>start_ix</code> position
+	<code>start_ix</code> position. Uses the native scanner when running
+	inside Geany and <code>_find_pair_python</code> otherwise
 	
 	@param html: Code to search
 	@type html: str
@@ -173,6 +185,47 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 	@param action: Function that creates selection range
 	@type action: function
 	
+	@return: list
+	"""
+	if _native_find_pair is None:
+		return _find_pair_python(html, start_ix, mode, action)
+	
+	set_mode(mode)
+	
+	found = _native_find_pair(html, start_ix, empty if cur_mode == 'html' else None)
+	if not found:
+		return action(None)
+	
+	kind, start, end = found
+	if kind == 'comment':
+		return action(Comment(start, end))
+	
+	# the scanner only reports offsets, build the same Tag objects as the
+	# Python version so last_match keeps working
+	opening_tag = Tag(re_start_tag.match(html, start), start)
+	closing_tag = None
+	if end != -1:
+		closing_tag = Tag(re_end_tag.match(html, end), end)
+	
+	return action(opening_tag, closing_tag, start_ix)
+
+def _find_pair_python(html, start_ix, mode='xhtml', action=make_range):
+	"""
+	Search for matching tags in <code>html</code>, starting from
+	<code>start_ix</code> position
+	
+	@param html: Code to search, a str or any object that supports
+	len(), indexing, slicing, find() and the buffer interface (like the
+	editor's content view)
+	@type html: str
+	
+	@param start_ix: Character index where to start searching pair
+	(commonly, current caret position)
+	@type start_ix: int
+	
+	@param action: Function that creates selection range
+	@type action: function
+	
 	@return: list
 	"""
 
@@ -188,7 +241,7 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 		if start is None:
 			start = ix
 
-		return html.find(substr, start) == start
+		return html[start:start + len(substr)] == substr
 
 
 	def find_comment_start(start_pos):
@@ -205,8 +258,7 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 	while ix >= 0:
 		ch = html[ix]
 		if ch == '<':
-			check_str = html[ix:]
-			m = re.match(end_tag, check_str)
+			m = re_end_tag.match(html, ix)
 			if m:  # found closing tag
 				tmp_tag = Tag(m, ix)
 				if tmp_tag.start < start_ix and tmp_tag.end > start_ix: # direct hit on searched closing tag
@@ -214,7 +266,7 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 				else:
 					backward_stack.append(tmp_tag)
 			else:
-				m = re.match(start_tag, check_str)
+				m = re_start_tag.match(html, ix)
 				if m: # found opening tag
 					tmp_tag = Tag(m, ix);
 					if tmp_tag.unary:
@@ -225,8 +277,9 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 					else: # found nearest unclosed tag
 						opening_tag = tmp_tag
 						break
-				elif check_str.startswith('<!--'): # found comment start
-					end_ix = check_str.find('-->') + ix + 3;
+				elif has_match('<!--'): # found comment start
+					end_ix = html.find('-->', ix)
+					end_ix = (end_ix if end_ix != -1 else ix - 1) + 3
 					if ix < start_ix and end_ix >= start_ix:
 						return action(Comment(ix, end_ix))
 		elif ch == '-' and has_match('-->'): # found comment end
@@ -244,14 +297,13 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 		while ix < html_len:
 			ch = html[ix]
 			if ch == '<':
-				check_str = html[ix:]
-				m = re.match(start_tag, check_str)
+				m = re_start_tag.match(html, ix)
 				if m: # found opening tag
 					tmp_tag = Tag(m, ix);
 					if not tmp_tag.unary:
 						forward_stack.append(tmp_tag)
 				else:
-					m = re.match(end_tag, check_str)
+					m = re_end_tag.match(html, ix)
 					if m:   #found closing tag
 						tmp_tag = Tag(m, ix);
 						if forward_stack and forward_stack[-1].name == tmp_tag.name:
@@ -260,7 +312,8 @@ def _find_pair(html, start_ix, mode='xhtml', action=make_range):
 							closing_tag = tmp_tag;
 							break
 					elif has_match('<!--'): # found comment
-						ix += check_str.find('-->') + 2
+						comment_end = html.find('-->', ix)
+						ix += (comment_end - ix if comment_end != -1 else -1) + 2
 						continue
 			elif ch == '-' and has_match('-->'):
 				# looks like cursor was inside comment with invalid HTML
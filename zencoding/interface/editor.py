@@ -86,7 +86,9 @@ class ZenEditor():
 		Replace editor's content or it's part (from <code>start</code> to
 		<code>end</code> index). If <code>value</code> contains
 		<code>caret_placeholder</code>, the editor will put caret into
-		this position. If you skip <code>start</code> and <code>end</code>
+		this position. Tabstops like <code>${1:value}</code> and
+		<code>$1</code> are replaced with their values and the caret is put
+		at the first one instead. If you skip <code>start</code> and <code>end</code>
 		arguments, the whole target's content will be replaced with
 		<code>value</code>.
 
@@ -106,6 +108,20 @@ class ZenEditor():
 		"""
 		pass
 
+	def replace_content_stream(self, chunks, start=None, end=None):
+		"""
+		Same as <code>replace_content()</code>, but takes the new content
+		as an iterable of strings, so it never has to be held in memory
+		at once. The whole replacement is a single undo step
+		@param chunks: Content you want to paste
+		@type chunks: iterable of str
+		@param start: Start index of editor's content
+		@type start: int
+		@param end: End index of editor's content
+		@type end: int
+		"""
+		self.replace_content(''.join(chunks), start, end)
+
 	def get_content(self):
 		"""
 		Returns editor's content
@@ -113,6 +129,68 @@ class ZenEditor():
 		"""
 		return ''
 
+	def get_content_view(self):
+		"""
+		Returns editor's content without copying it, if the editor can.
+		The result supports <code>len()</code>, indexing, slicing,
+		<code>find()</code> and can be searched with <code>re</code>, but
+		it is only valid until the content is modified, so don't hold on
+		to it across calls to <code>replace_content()</code>
+		@return: str or read-only buffer
+		"""
+		return self.get_content()
+
+	def get_content_range(self, start, end):
+		"""
+		Returns editor's content from <code>start</code> to <code>end</code>
+		index, only copying that part of the content
+		@type start: int
+		@type end: int
+		@return: str
+		"""
+		return self.get_content()[max(start, 0):max(end, 0)]
+
+	def char_at(self, pos):
+		"""
+		Returns character at <code>pos</code> index, or an empty string if
+		the index is out of range
+		@type pos: int
+		@return: str
+		"""
+		return pos >= 0 and self.get_content_range(pos, pos + 1) or ''
+
+	def get_line(self, line):
+		"""
+		Returns content of line number <code>line</code> (counting from 0),
+		without the line ending
+		@type line: int
+		@return: str
+		"""
+		lines = self.get_content().splitlines()
+		return 0 <= line < len(lines) and lines[line] or ''
+
+	def get_next_tabstop(self, pos):
+		"""
+		Returns character indexes of the first tabstop left by the last
+		<code>replace_content()</code> call which starts at or after
+		<code>pos</code>, skipping the one <code>pos</code> is inside of.
+		Editors that don't keep track of tabstops return None, and edit
+		point actions search the content instead
+		@type pos: int
+		@return: tuple of start and end indexes or None
+		"""
+		return None
+
+	def get_prev_tabstop(self, pos):
+		"""
+		Returns character indexes of the last tabstop left by the last
+		<code>replace_content()</code> call which ends at or before
+		<code>pos</code>, skipping the one <code>pos</code> is inside of
+		@type pos: int
+		@return: tuple of start and end indexes or None
+		"""
+		return None
+
 	def get_syntax(self):
 		"""
 		Returns current editor's syntax mode
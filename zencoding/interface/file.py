@@ -21,15 +21,34 @@ def read(path):
 	
 	return content
 
+_located = {}
+"Located files, keyed by the directory of the editor file and the file name"
+
 def locate_file(editor_file, file_name):
 	"""
 	Locate <code>file_name</code> file that relates to <code>editor_file</code>.
-	File name may be absolute or relative path
+	File name may be absolute or relative path. Located files are remembered
+	as long as they exist.
 	
 	@type editor_file: str
 	@type file_name: str
 	@return String or None if <code>file_name</code> cannot be located
 	"""
+	key = (os.path.dirname(editor_file), file_name)
+	result = _located.get(key)
+	if result and os.path.exists(result):
+		return result
+	
+	result = _find_file(editor_file, file_name)
+	if result:
+		_located[key] = result
+	else:
+		_located.pop(key, None)
+	
+	return result
+
+def _find_file(editor_file, file_name):
+	"Searches the parents of <code>editor_file</code> for <code>file_name</code>"
 	result = None
 	
 	previous_parent = ''
@@ -74,16 +93,65 @@ def save(file, content):
 	@param content: File content
 	@type content: str
 	"""
+	save_chunks(file, [content])
+
+def save_chunks(file, chunks):
+	"""
+	Saves content as <code>file</code>, writing each chunk as it comes.
+	The chunks go to a temporary file next to <code>file</code>, which
+	only replaces it once the last chunk is written, so if producing a
+	chunk fails an existing <code>file</code> is left as it was
+	
+	@param file: File's asolute path
+	@type file: str
+	@param chunks: File content
+	@type chunks: iterable of str
+	"""
+	fdirs, fname = os.path.split(file)
+	temp = os.path.join(fdirs, '.%s.%d.tmp' % (fname, os.getpid()))
 	try:
-		fp = open(file, 'wb')
+		fp = open(temp, 'wb')
 	except:
-		fdirs, fname = os.path.split(file)
 		if fdirs:
 			os.makedirs(fdirs)
-		fp = open(file, 'wb')
+		fp = open(temp, 'wb')
+	
+	try:
+		for chunk in chunks:
+			fp.write(chunk)
+		fp.close()
 		
-	fp.write(content)
-	fp.close()
+		if os.path.exists(file):
+			# keep the permissions of the file being replaced
+			os.chmod(temp, os.stat(file).st_mode & 07777)
+			if os.name == 'nt':
+				# rename() doesn't replace files there
+				os.remove(file)
+		os.rename(temp, file)
+	except:
+		fp.close()
+		if os.path.exists(temp):
+			os.remove(temp)
+		raise
+
+def read_chunks(path, size):
+	"""
+	Reads file content in chunks, so it is never held in memory at once
+	@param path: File's relative or absolute path
+	@type path: str
+	@param size: Chunk size in bytes
+	@type size: int
+	@return: iterator of str
+	"""
+	fp = open(path, 'rb')
+	try:
+		while True:
+			chunk = fp.read(size)
+			if not chunk:
+				break
+			yield chunk
+	finally:
+		fp.close()
 
 def get_ext(file):
 	"""
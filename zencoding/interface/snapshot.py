@@ -0,0 +1,165 @@
+'''
+Editor that works on a copy of the document instead of the document itself,
+so actions can run away from the editor's main loop. Reads are served from
+the copy, edits are only recorded in <code>edits</code> for the editor to
+apply afterwards, if the document didn't change in the meantime.
+
+The copy is never updated by the recorded edits.
+
+@example
+from zencoding.interface.snapshot import SnapshotEditor
+editor = SnapshotEditor(content, 0, 0, 0)
+zencoding.run_action('match_pair_outward', editor)
+for kind, value, start, end in editor.edits:
+	...
+'''
+import re
+from zencoding.interface.editor import ZenEditor
+
+re_newline = re.compile(r'\r\n|\r|\n')
+
+class ZenCancelled(Exception):
+	"""
+	Raised by snapshot editor methods once the request the action runs for
+	was cancelled
+	"""
+	pass
+
+class ZenMainThreadRequired(Exception):
+	"""
+	Raised by snapshot editor methods that can't work on a copy of the
+	document, so the action is run again on the editor itself
+	"""
+	pass
+
+class SnapshotEditor(ZenEditor):
+	def __init__(self, content, sel_start, sel_end, caret, syntax='html',
+			file_path=None, profile_name='xhtml', is_cancelled=None,
+			content_view=None):
+		"""
+		@param content: Document text
+		@type content: str
+		@param is_cancelled: Function telling whether the result is still wanted
+		@type is_cancelled: callable
+		@param content_view: View of content that pair searches take faster
+		@type content_view: buffer-like
+		"""
+		self.content = content
+		self.content_view = content_view
+		self.sel = (sel_start, sel_end)
+		self.caret = caret
+		self.syntax = syntax
+		self.file_path = file_path
+		self.profile_name = profile_name
+		self.is_cancelled = is_cancelled
+		self.edits = []
+		"List of (kind, value, start, end) tuples, kind is 'replace', 'select' or 'caret'"
+
+		self.__lines = None
+
+	def check_cancelled(self):
+		"""
+		Stops the running action if its request was cancelled
+		"""
+		if self.is_cancelled and self.is_cancelled():
+			raise ZenCancelled()
+
+	def set_context(self, context):
+		pass
+
+	def get_selection_range(self):
+		self.check_cancelled()
+		return self.sel
+
+	def create_selection(self, start, end=None):
+		self.check_cancelled()
+		if end is None:
+			self.sel = (start, start)
+			self.caret = start
+		else:
+			self.sel = (start, end)
+			self.caret = end
+
+		self.edits.append(('select', None, start, -1 if end is None else end))
+
+	def _line_bounds(self, pos):
+		start = max(self.content.rfind('\n', 0, pos), self.content.rfind('\r', 0, pos)) + 1
+		m = re_newline.search(self.content, pos)
+		return start, m.start() if m else len(self.content)
+
+	def get_current_line_range(self):
+		self.check_cancelled()
+		return self._line_bounds(self.caret)
+
+	def get_caret_pos(self):
+		self.check_cancelled()
+		return self.caret
+
+	def set_caret_pos(self, pos):
+		self.check_cancelled()
+		self.sel = (pos, pos)
+		self.caret = pos
+		self.edits.append(('caret', None, pos, -1))
+
+	def get_current_line(self):
+		self.check_cancelled()
+		start, end = self._line_bounds(self.caret)
+		m = re_newline.match(self.content, end)
+		return self.content[start:m.end() if m else end]
+
+	def replace_content(self, value, start=None, end=None):
+		self.check_cancelled()
+		self.edits.append(('replace', value,
+				-1 if start is None else start, -1 if end is None else end))
+
+	def replace_content_stream(self, chunks, start=None, end=None):
+		# chunks are consumed when the edit is taken, not here
+		self.replace_content(chunks, start, end)
+
+	def get_content(self):
+		self.check_cancelled()
+		return self.content
+
+	def get_content_view(self):
+		if self.content_view is not None:
+			self.check_cancelled()
+			return self.content_view
+		return self.get_content()
+
+	def get_content_range(self, start, end):
+		self.check_cancelled()
+		return self.content[max(start, 0):max(end, 0)]
+
+	def char_at(self, pos):
+		self.check_cancelled()
+		return self.content[pos] if 0 <= pos < len(self.content) else ''
+
+	def get_line(self, line):
+		self.check_cancelled()
+		if self.__lines is None:
+			self.__lines = re_newline.split(self.content)
+
+		return self.__lines[line] if 0 <= line < len(self.__lines) else ''
+
+	def get_next_tabstop(self, pos):
+		return None
+
+	def get_prev_tabstop(self, pos):
+		return None
+
+	def get_syntax(self):
+		return self.syntax
+
+	def get_profile_name(self):
+		return self.profile_name
+
+	def prompt(self, title):
+		# can't ask anything away from the main loop
+		raise ZenMainThreadRequired()
+
+	def get_selection(self):
+		self.check_cancelled()
+		return self.content[self.sel[0]:self.sel[1]]
+
+	def get_file_path(self):
+		return self.file_path
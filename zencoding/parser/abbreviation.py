@@ -4,6 +4,12 @@
 '''
 import re
 
+try:
+	# native parser provided by the Geany plugin, see src/zen-abbreviation.c
+	from geany import parse_abbreviation as _native_parse
+except ImportError:
+	_native_parse = None
+
 re_word = re.compile(r'^[\w\-:\$]+')
 re_attr_string = re.compile(r'^(["\'])((?:(?!\1)[^\\]|\\.)*)\1')
 re_valid_name = re.compile(r'^[\w\d\-_\$\:@!]+\+?$', re.IGNORECASE)
@@ -203,7 +209,23 @@ def parse(abbr):
 	Parses abbreviation into tree with respect of groups, 
 	text nodes and attributes. Each node of the tree is a single 
 	abbreviation. Tree represents actual structure of the outputted 
-	result
+	result. Uses the native parser when running inside Geany and
+	<code>_parse_python</code> for anything it leaves alone (like
+	invalid abbreviations)
+	@param abbr: Abbreviation to parse
+	@type abbr: str
+	@return: TreeNode
+	"""
+	if _native_parse is not None:
+		tree = _native_parse(abbr, TreeNode)
+		if tree is not None:
+			return tree
+	
+	return _parse_python(abbr)
+
+def _parse_python(abbr):
+	"""
+	Parses abbreviation into tree, see <code>parse</code>
 	@param abbr: Abbreviation to parse
 	@type abbr: str
 	@return: TreeNode
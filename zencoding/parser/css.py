@@ -2,70 +2,49 @@
 A Python port of Stoyan Stefanov's CSSEX CSS parser
 
 How to use:
-call <code>lex(source)</code> to parse CSS source into tokens
+call <code>lex(source)</code> to parse CSS source into (type, start, end) offsets
+call <code>parse(source)</code> to parse CSS source into tokens
 call <code>to_source(tokens)</code> to transform parsed tokens back to CSS source
 
 @link https://github.com/stoyan/etc/tree/master/cssex
 @author: Sergey Chikuyonok
 
 '''
+from array import array
+import re
+
+try:
+	# native lexer provided by the Geany plugin, see src/zen-css.c
+	from geany import css_lex as _native_lex
+except ImportError:
+	_native_lex = None
+
+# token types used by lex(), operators use the character code instead
+TOKEN_WHITE = 1
+TOKEN_COMMENT = 2
+TOKEN_STRING = 3
+TOKEN_BRACE = 4
+TOKEN_IDENTIFIER = 5
+TOKEN_NUMBER = 6
+TOKEN_MATCH = 7
+TOKEN_LINE = 8
+
+_type_names = (None, 'white', 'comment', 'string', 'brace', 'identifier',
+		'number', 'match', 'line')
+
+re_newline = re.compile(r'\r\n|\r|\n')
+
+def type_name(token_type):
+	"""
+	Returns token type name, as used by <code>parse()</code>
+	@param token_type: Token type returned by <code>lex()</code>
+	@type token_type: int
+	@return: str
+	"""
+	if token_type < len(_type_names):
+		return _type_names[token_type]
 
-class Walker(object):
-	def __init__(self, source=None):
-		self.lines = None
-		self.total_lines = 0
-		self.line = ''
-		self.ch =  ''
-		self.linenum = -1
-		self.chnum = -1
-
-		if source is not None:
-			self.init(source)
-
-	def init(self, source):
-		# source, yumm
-		self.lines = source.splitlines()
-		self.total_lines = len(self.lines)
-
-		# reset
-		self.chnum = -1
-		self.linenum = -1
-		self.ch = ''
-		self.line = ''
-
-		# advance
-		self.next_line()
-		self.next_char()
-
-
-	def next_line(self):
-		self.linenum += 1
-		if self.total_lines <= self.linenum:
-			self.line = False
-		else:
-			self.line = self.lines[self.linenum]
-
-		if self.chnum != -1:
-			self.chnum = 0
-
-		return self.line
-
-	def next_char(self):
-		self.chnum += 1
-		while get_char(self.line, self.chnum) is None:
-			if self.next_line() is False:
-				self.ch = False
-				return False # end of source
-
-			self.chnum = -1
-			self.ch = '\n'
-			return '\n'
-
-		self.ch = self.line[self.chnum]
-		return self.ch
-
-_walker = Walker()
-__tokens = []
+	return chr(token_type)
 
 # utility helpers
 def get_char(text, pos):
@@ -83,237 +62,214 @@ def is_op(ch, matchattr=None):
 
 	return ch in "{}[]()+*=.,;:>~|\\%$#@^!"
 
-def get_conf():
-	return {
-		'char': _walker.chnum,
-		'line': _walker.linenum
-	}
-
-def tokener(value, token_type=None, c={}):
-	"creates token objects and pushes them to a list"
-	w = _walker
-	__tokens.append({
-		'charstart': c.get('char', w.chnum),
-		'charend':   c.get('charend', w.chnum),
-		'linestart': c.get('line', w.linenum),
-		'lineend':   c.get('lineend', w.linenum),
-		'value':     value,
-		'type':      token_type or value
-	})
+def is_digit(c):
+	return c is not None and c.isdigit()
+
+def newline_length(source, pos):
+	"Length of the newline at pos, 0 if there's none"
+	m = re_newline.match(source, pos)
+	return m and len(m.group(0)) or 0
+
+def next_char(source, pos):
+	"Position after the character at pos, newlines count as one character"
+	return pos + (newline_length(source, pos) or 1)
 
 
 # oops
 class CSSEXError(Exception):
-	def __init__(self, value, conf=None):
+	def __init__(self, value, source, pos):
 		self.value = value
-		self.conf = conf or {}
-		self.w = _walker
+		self.line = len(re_newline.findall(source, 0, pos))
+		self.char = pos - max(source.rfind('\n', 0, pos), source.rfind('\r', 0, pos)) - 1
 
 	def __str__(self):
-		c = 'char' in self.conf and self.conf['char'] or self.w.chnum
-		l = 'line' in self.conf and self.conf['line'] or self.w.linenum
-		return "%s at line %d char %d" % (self.value, l + 1, c + 1)
+		return "%s at line %d char %d" % (self.value, self.line + 1, self.char + 1)
 
 
 # token handlers follow for:
 # white space, comment, string, identifier, number, operator
-def white():
-	c = _walker.ch
-	token = ''
-	conf = get_conf()
-
-	while c == " " or c == "\t":
-		token += c
-		c = _walker.next_char()
-
-
-	tokener(token, 'white', conf)
-
-def comment():
-	w = _walker
-	c = w.ch
-	token = c
-	conf = get_conf()
-
-	cnext = w.next_char()
-
-	if cnext != '*':
-		# oops, not a comment, just a /
-		conf['charend'] = conf['char']
-		conf['lineend'] = conf['line']
-		return tokener(token, token, conf)
-
-	while not (c == "*" and cnext == "/"):
-		token += cnext
-		c = cnext
-		cnext = w.next_char()
-
-	token += cnext
-	w.next_char()
-	tokener(token, 'comment', conf)
-
-def str():
-	w = _walker
-	c = w.ch
-	q = c
-	token = c
-	conf = get_conf()
-
-	c = w.next_char()
-
-	while c != q:
-
-		if c == '\n':
-			cnext = w.next_char()
-			if cnext == "\\":
-				token += c + cnext
-			else:
-				# end of line with no \ escape = bad
-				raise CSSEXError("Unterminated string", conf)
-
+# each one gets the token start and returns the token end
+def white(source, pos):
+	while get_char(source, pos) in (' ', '\t'):
+		pos += 1
+
+	return pos
+
+def comment(source, pos):
+	# "/*/" is a complete comment for CSSEX
+	end = source.find('*/', pos + 1)
+	if end == -1:
+		raise CSSEXError("Unterminated comment", source, pos)
+
+	return end + 2
+
+def str(source, start):
+	q = source[start]
+	pos = start + 1
+
+	while True:
+		c = get_char(source, pos)
+		if c == q:
+			return pos + 1
+
+		nl = newline_length(source, pos)
+		if nl:
+			# end of line with no \ escape = bad
+			pos += nl
+			if get_char(source, pos) != '\\':
+				raise CSSEXError("Unterminated string", source, start)
+			pos += 1
+		elif c == '\\':
+			pos += 1
+			if pos >= len(source):
+				raise CSSEXError("Unterminated string", source, start)
+			pos = next_char(source, pos)
+		elif c is None:
+			raise CSSEXError("Unterminated string", source, start)
 		else:
-			if c == "\\":
-				token += c + w.next_char()
-			else:
-				token += c
+			pos += 1
 
-		c = w.next_char()
+def brace(source, start):
+	pos = start + 1
 
-	token += c
-	w.next_char()
-	tokener(token, 'string', conf)
+	# stops one character after a nested brace, like the original
+	while True:
+		c = get_char(source, pos)
+		if c is None:
+			raise CSSEXError("Unterminated brace", source, start)
 
-def brace():
-	w = _walker
-	c = w.ch
-	depth = 0
-	token = c
-	conf = get_conf()
+		if c == ')':
+			return pos + 1
 
-	c = w.next_char()
-
-	while c != ')' and not depth:
 		if c == '(':
-			depth += 1
-		elif c == ')':
-			depth -= 1
-		elif c is False:
-			raise CSSEXError("Unterminated brace", conf)
-
-		token += c
-		c = w.next_char()
-
-	token += c
-	w.next_char()
-	tokener(token, 'brace', conf)
-
-def identifier(pre=None):
-	w = _walker
-	c = w.ch
-	conf = get_conf()
-	token = pre and pre + c or c
-
-	c = w.next_char()
+			pos += 1
+			if pos >= len(source):
+				raise CSSEXError("Unterminated brace", source, start)
+			return next_char(source, pos)
 
-	if pre: # adjust token position
-		conf['char'] -= len(pre)
+		pos = next_char(source, pos)
 
-	while is_name_char(c) or c.isdigit():
-		token += c
-		c = w.next_char()
+def identifier(source, pos):
+	c = get_char(source, pos)
+	while c is not None and (is_name_char(c) or c.isdigit()):
+		pos += 1
+		c = get_char(source, pos)
 
-	tokener(token, 'identifier', conf)
+	return pos
 
-def num():
-	w = _walker
-	c = w.ch
-	conf = get_conf()
-	token = c
-	point = token == '.'
-
-	c = w.next_char()
-	nondigit = not c.isdigit()
+def num(source, pos):
+	"Returns token type and end"
+	point = source[pos] == '.'
+	minus = source[pos] == '-'
+	pos += 1
+	nondigit = not is_digit(get_char(source, pos))
 
 	# .2px or .classname?
 	if point and nondigit:
 		# meh, NaN, could be a class name, so it's an operator for now
-		conf['charend'] = conf['char']
-		conf['lineend'] = conf['line']
-		return tokener(token, '.', conf)
+		return ord('.'), pos
 
-	# -2px or -moz-something
-	if token == '-' and nondigit:
-		return identifier('-')
+	# -2px or -moz-something, the character after - always belongs to it
+	if minus and nondigit:
+		if pos < len(source):
+			pos = next_char(source, pos)
+		return TOKEN_IDENTIFIER, identifier(source, pos)
 
-	while c is not False and (c.isdigit() or (not point and c == '.')):  # not end of source && digit or first instance of .
+	c = get_char(source, pos)
+	while is_digit(c) or (not point and c == '.'):
 		if c == '.':
 			point = True
 
-		token += c
-		c = w.next_char()
-
-	tokener(token, 'number', conf)
+		pos += 1
+		c = get_char(source, pos)
 
-def op():
-	w = _walker
-	c = w.ch
-	conf = get_conf()
-	token = c
-	next = w.next_char()
+	return TOKEN_NUMBER, pos
 
-	if next == "=" and is_op(token, True):
-		token += next
-		tokener(token, 'match', conf)
-		w.next_char()
-		return
+def op(source, pos):
+	"Returns token type and end"
+	c = source[pos]
+	if get_char(source, pos + 1) == '=' and is_op(c, True):
+		return TOKEN_MATCH, pos + 2
 
-	conf['charend'] = conf['char'] + 1
-	conf['lineend'] = conf['line']
-	tokener(token, token, conf)
+	return ord(c), pos + 1
 
-# call the appropriate handler based on the first character in a token suspect
-def tokenize():
-	ch = _walker.ch
+def tokenize(source, pos):
+	"""
+	Calls the appropriate handler based on the first character in a token
+	suspect
+	@return: Token type and end
+	"""
+	ch = source[pos]
 
 	if ch == " " or ch == "\t":
-		return white()
+		return TOKEN_WHITE, white(source, pos)
 
 	if ch == '/':
-		return comment()
+		if get_char(source, pos + 1) == '*':
+			return TOKEN_COMMENT, comment(source, pos)
+		# oops, not a comment, just a /
+		return ord(ch), pos + 1
 
 	if ch == '"' or ch == "'":
-		return str()
-	
+		return TOKEN_STRING, str(source, pos)
+
 	if ch == '(':
-		return brace()
+		return TOKEN_BRACE, brace(source, pos)
 
 	if ch == '-' or ch == '.' or ch.isdigit(): # tricky - char: minus (-1px) or dash (-moz-stuff)
-		return num()
+		return num(source, pos)
 
 	if is_name_char(ch):
-		return identifier()
+		return TOKEN_IDENTIFIER, identifier(source, pos + 1)
 
 	if is_op(ch):
-		return op()
+		return op(source, pos)
+
+	nl = newline_length(source, pos)
+	if nl:
+		return TOKEN_LINE, pos + nl
 
-	if ch == "\n":
-		tokener("line")
-		_walker.next_char()
-		return
+	raise CSSEXError("Unrecognized character", source, pos)
 
-	raise CSSEXError("Unrecognized character")
+def lex(source):
+	"""
+	Parse CSS source into a flat array of (type, start, end) offsets, three
+	items per token
+	@type source: str
+	@return: array
+	"""
+	if _native_lex:
+		tokens = _native_lex(source)
+		if tokens is not None:
+			return tokens
+
+	tokens = array('i')
+	pos = 0
+	while pos < len(source):
+		token_type, end = tokenize(source, pos)
+		tokens.extend((token_type, pos, end))
+		pos = end
+
+	return tokens
 
 def parse(source):
 	"""
 	Parse CSS source
 	@type source: str
+	@return: list of dicts with 'type', 'value', 'start' and 'end' keys
 	"""
-	_walker.init(source)
-	globals()['__tokens'] = []
-	while _walker.ch is not False:
-		tokenize()
+	tokens = lex(source)
+	result = []
+	for i in xrange(0, len(tokens), 3):
+		start, end = tokens[i + 1], tokens[i + 2]
+		result.append({
+			'type': type_name(tokens[i]),
+			'value': source[start:end],
+			'start': start,
+			'end': end
+		})
 
-	return __tokens
+	return result
 
 
 def to_source(tokens):
@@ -323,10 +279,6 @@ def to_source(tokens):
 	"""
 	src = ''
 	for t in tokens:
-		if t['type'] == 'line':
-			src += '\n'
-		else:
-			src += t['value']
+		src += t['value']
 
 	return src
-
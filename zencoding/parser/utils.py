@@ -3,10 +3,15 @@
 @link http://chikuyonok.ru
 '''
 from zencoding.parser import css, xml
+import bisect
 import re
 
-def is_stop_char(token):
-	return token['type'] in '{};:'
+re_rule_edge = re.compile(r'[{}]')
+
+_stop_chars = (ord('{'), ord('}'), ord(';'), ord(':'))
+
+def is_stop_char(token_type):
+	return token_type in _stop_chars
 
 def char_at(text, pos):
 	"""
@@ -15,18 +20,6 @@ def char_at(text, pos):
 	"""
 	return text[pos] if pos < len(text) else ''
 
-def calculate_nl_length(content, pos):
-	"""
-	Calculates newline width at specified position in content
-	@param content: str
-	@param pos: int
-	@return: int
-	"""
-	if char_at(content, pos) == '\r' and char_at(content, pos + 1) == '\n':
-		return 2
-		
-	return 1
-
 def post_process_optimized(optimized, original):
 	"""
 	Post-process optimized tokens: collapse tokens for complex values
@@ -83,7 +76,7 @@ def parse_css(source, offset=0):
 	@type offset: int
 	@return: list
 	"""
-	return optimize_css(css.parse(source), offset, source)
+	return optimize_css(css.lex(source), offset, source)
 
 def parse_html(tag, offset=0):
 	"""
@@ -94,22 +87,13 @@ def parse_html(tag, offset=0):
 	@type offset: int
 	@return: list
 	"""
-	tokens = xml.parse(tag)
+	tokens = xml.lex(tag)
 	result = []
-	i = 0
-	loop = 1000 # infinite loop protection
-		
-	try:
-		while loop:
-			loop -= 1
-			t = tokens['next']()
-			if not t:
-				break
-			else:
-				result.append(make_token(t['style'], t['content'], offset + i, 0))
-				i += len(t['value'])
-	except xml.StopIteration:
-		pass
+	
+	# same limit as the loop protection of the Python lexer
+	for i in xrange(0, min(len(tokens), 3000), 3):
+		start, end = tokens[i + 1], tokens[i + 2]
+		result.append(make_token(xml.style_name(tokens[i]), tag[start:end], offset + start, 0))
 	
 	return result
 
@@ -123,8 +107,8 @@ def optimize_css(tokens, offset, content):
 	"""
 	Optimizes parsed CSS tokens: combines selector chunks, complex values
 	into a single chunk
-	@param tokens: Tokens produced by <code>CSSEX.lex()</code>
-	@type tokens: list
+	@param tokens: Tokens produced by <code>css.lex()</code>
+	@type tokens: array
 	@param offset: CSS rule offset in source code (character index)
 	@type offset: int
 	@param content: Original CSS source code
@@ -133,9 +117,7 @@ def optimize_css(tokens, offset, content):
 	"""
 	offset = offset or 0
 	result = ExtList()
-	_o = 0
-	i = 0
-	delta = 0
+	token_count = len(tokens) // 3
 	in_rules = False
 	in_value = False
 	acc_tokens = {
@@ -145,81 +127,75 @@ def optimize_css(tokens, offset, content):
 	orig_tokens = []
 	acc_type = None
 		
-	def add_token(token, type):
+	def add_token(type, value, pos):
 		if type and type in acc_tokens:
 			if not acc_tokens[type]:
-				acc_tokens[type] = make_token(type, token['value'], offset + delta + token['charstart'], i)
+				acc_tokens[type] = make_token(type, value, pos, i)
 				result.append(acc_tokens[type])
 			else:
-				acc_tokens[type]['content'] += token['value']
-				acc_tokens[type]['end'] += len(token['value'])
+				acc_tokens[type]['content'] += value
+				acc_tokens[type]['end'] += len(value)
 				acc_tokens[type]['ref_end_ix'] = i
 		else:
-			result.append(make_token(token['type'], token['value'], offset + delta + token['charstart'], i))
+			result.append(make_token(css.type_name(token_type), value, pos, i))
 		
-	for i, token in enumerate(tokens):
-		token = tokens[i]
+	for i in xrange(token_count):
+		token_type, start, end = tokens[i * 3:i * 3 + 3]
+		value = content[start:end]
 		acc_type = None
 		
-		if token['type'] == 'line':
-			delta += _o
-			nl_size = content and calculate_nl_length(content, delta) or 1
-			tok_value = nl_size == 1 and '\n' or '\r\n'
-			
-			orig_tokens.append(make_token(token['type'], tok_value, offset + delta))
-			
-			result.append(make_token(token['type'], tok_value, offset + delta, i))
-			delta += nl_size
-			_o = 0
-			
-			continue
-		
-		orig_tokens.append(make_token(token['type'], token['value'], offset + delta + token['charstart']))
+		orig_tokens.append(make_token(css.type_name(token_type), value, offset + start))
 		
-		# use charstart and length because of incorrect charend 
-		# computation for whitespace
-		_o = token['charstart'] + len(token['value'])
+		if token_type == css.TOKEN_LINE:
+			result.append(make_token('line', value, offset + start, i))
+			continue
 		
-		if token['type'] != 'white':
-			if token['type'] == '{':
+		if token_type != css.TOKEN_WHITE:
+			if token_type == ord('{'):
 				in_rules = True
 				acc_tokens['selector'] = None
 			elif in_rules:
-				if token['type'] == ':':
+				if token_type == ord(':'):
 					in_value = True
-				elif token['type'] == ';':
+				elif token_type == ord(';'):
 					in_value = False
 					acc_tokens['value'] = None
-				elif token['type'] == '}':
+				elif token_type == ord('}'):
 					in_value = in_rules = False
 					acc_tokens['value'] = None
 				elif in_value or acc_tokens['value']:
 					acc_type = 'value'
-			elif acc_tokens['selector'] or (not in_rules and not is_stop_char(token)):
+			elif acc_tokens['selector'] or (not in_rules and not is_stop_char(token_type)):
 				# start selector token
 				acc_type = 'selector'
 			
-			add_token(token, acc_type)
+			add_token(acc_type, value, offset + start)
 		else:
 			# whitespace token, decide where it should be
-			if i < len(tokens) - 1 and is_stop_char(tokens[i + 1]):
+			if i < token_count - 1 and is_stop_char(tokens[i * 3 + 3]):
 				continue
 			
 			if acc_tokens['selector'] or acc_tokens['value']:
-				add_token(token, acc_tokens['selector'] and 'selector' or 'value')
+				add_token(acc_tokens['selector'] and 'selector' or 'value', value, offset + start)
 	
 	result.original = orig_tokens
 	return post_process_optimized(result, orig_tokens)
 
-def extract_css_rule(content, pos, is_backward=False):
+def index_css_rules(content):
 	"""
-	 Extracts single CSS selector definition from source code
-	 @param {String} content CSS source code
-	 @type content: str
-	 @param pos: Character position where to start source code extraction
-	 @type pos: int
+	Collects the positions of rule braces in CSS source code, so that
+	<code>extract_css_rule()</code> can find rule edges without scanning
+	@param content: CSS source code
+	@type content: str
+	@return: tuple of sorted '{' positions, '}' positions and both
 	"""
-	result = '' 
+	braces = [m.start() for m in re_rule_edge.finditer(content)]
+	opens = [pos for pos in braces if content[pos] == '{']
+	closes = [pos for pos in braces if content[pos] == '}']
+	return opens, closes, braces
+
+def _find_rule_braces(content, pos, is_backward):
+	"Returns positions of the opening and closing brace of the rule at pos"
 	c_len = len(content)
 	offset = pos 
 	brace_pos = -1
@@ -243,12 +219,70 @@ def extract_css_rule(content, pos, is_backward=False):
 			brace_pos = offset
 		elif ch == '}':
 			if brace_pos != -1:
-				result = content[brace_pos:offset + 1]
+				return brace_pos, offset
 			break
 		
 		offset += 1
 	
-	if result:
+	return None
+
+def _find_indexed_rule_braces(content, pos, is_backward, index):
+	"Same as <code>_find_rule_braces()</code>, using positions from <code>index_css_rules()</code>"
+	opens, closes, braces = index
+	brace_pos = -1
+	offset = -1
+	
+	# rule edge left to pos
+	if is_backward:
+		i = bisect.bisect_right(opens, pos) - 1
+		if i >= 0:
+			offset = opens[i]
+	else:
+		i = bisect.bisect_right(braces, pos) - 1
+		if i >= 0:
+			offset = braces[i]
+			if content[offset] == '}':
+				offset += 1
+	
+	if offset == -1:
+		# the search right then starts at content[-1]
+		if content[-1] == '}':
+			return None
+		offset = 0
+	
+	# full rule set right to the edge
+	i = bisect.bisect_left(closes, offset)
+	if i == len(closes):
+		return None
+	
+	close_pos = closes[i]
+	i = bisect.bisect_left(opens, close_pos) - 1
+	if i >= 0 and opens[i] >= offset:
+		brace_pos = opens[i]
+	
+	if brace_pos == -1:
+		return None
+	
+	return brace_pos, close_pos
+
+def extract_css_rule(content, pos, is_backward=False, index=None):
+	"""
+	 Extracts single CSS selector definition from source code
+	 @param {String} content CSS source code
+	 @type content: str
+	 @param pos: Character position where to start source code extraction
+	 @type pos: int
+	 @param index: Rule braces from <code>index_css_rules(content)</code>
+	 @type index: tuple
+	"""
+	if index is not None:
+		rule = _find_indexed_rule_braces(content, pos, is_backward, index)
+	else:
+		rule = _find_rule_braces(content, pos, is_backward)
+	
+	if rule:
+		brace_pos, close_pos = rule
+		
 		# find CSS selector
 		offset = brace_pos - 1
 		selector = ''
@@ -260,7 +294,7 @@ def extract_css_rule(content, pos, is_backward=False):
 		# also trim whitespace
 		re_white = re.compile(r'^[\s\n\r]+', re.MULTILINE)
 		selector = re.sub(re_white, '', content[offset + 1:brace_pos])
-		return (brace_pos - len(selector), brace_pos + len(result))
+		return (brace_pos - len(selector), close_pos + 1)
 	
 	return None
 
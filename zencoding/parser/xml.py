@@ -11,10 +11,39 @@ from CodeMirror project: http://codemirror.net/
 
 =====
 Run <code>parse(text)</code> method to parse HTML string 
+Run <code>lex(text)</code> method to get (style, start, end) offsets instead
 =====
 '''
+from array import array
 import re
 
+try:
+	# native lexer provided by the Geany plugin, see src/zen-xml.c
+	from geany import xml_lex as _native_lex
+except ImportError:
+	_native_lex = None
+
+# token styles used by lex(), each " xml-error" suffix adds STYLE_ERROR
+STYLE_WHITESPACE = 1
+STYLE_PUNCTUATION = 2
+STYLE_NAME = 3
+STYLE_TAGNAME = 4
+STYLE_ATTNAME = 5
+STYLE_ATTRIBUTE = 6
+STYLE_TEXT = 7
+STYLE_ENTITY = 8
+STYLE_COMMENT = 9
+STYLE_CDATA = 10
+STYLE_DOCTYPE = 11
+STYLE_PROCESSING = 12
+STYLE_ERROR = 16
+
+_style_names = (None, 'whitespace', 'xml-punctuation', 'xml-name',
+		'xml-tagname', 'xml-attname', 'xml-attribute', 'xml-text', 'xml-entity',
+		'xml-comment', 'xml-cdata', 'xml-doctype', 'xml-processing')
+
+_style_codes = dict((name, code) for code, name in enumerate(_style_names) if name)
+
 class StopIteration(Exception):
 	def __str__(self):
 		return 'StopIteration'
@@ -485,5 +514,48 @@ def parse(source):
 	cc = [base]
 	return {'next': next}
 
+def style_name(style):
+	"""
+	Returns token style name, as used by <code>parse()</code>
+	@param style: Token style returned by <code>lex()</code>
+	@type style: int
+	@return: str
+	"""
+	return _style_names[style % STYLE_ERROR] + ' xml-error' * (style // STYLE_ERROR)
 
-	
+def style_code(name):
+	"Returns token style code for a style name used by <code>parse()</code>"
+	parts = name.split(' ')
+	return _style_codes[parts[0]] + STYLE_ERROR * (len(parts) - 1)
+
+def lex(source):
+	"""
+	Parse HTML source into a flat array of (style, start, end) offsets,
+	three items per token. Token ends don't include the whitespace that
+	follows them.
+	@type source: str
+	@return: array
+	"""
+	if _native_lex:
+		tokens = _native_lex(source)
+		if tokens is not None:
+			return tokens
+
+	tokens = array('i')
+	next = parse(source)['next']
+	pos = 0
+	loop = 1000 # infinite loop protection
+
+	try:
+		while loop:
+			loop -= 1
+			t = next()
+			if not t:
+				break
+
+			tokens.extend((style_code(t['style']), pos, pos + len(t['content'])))
+			pos += len(t['value'])
+	except StopIteration:
+		pass
+
+	return tokens
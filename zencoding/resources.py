@@ -5,9 +5,11 @@
 @link http://chikuyonok.ru
 '''
 import re
+import sys
 import types
 from zencoding.zen_settings import zen_settings
 import imp
+import marshal
 import os.path
 
 TYPE_ABBREVIATION = 'zen-tag'
@@ -27,6 +29,30 @@ vocabularies = {}
 vocabularies[VOC_SYSTEM] = {}
 vocabularies[VOC_USER] = {}
 
+TABLE_RESOURCES = ('abbreviations', 'snippets')
+"Resources looked up item by item, which get_resource() serves from tables"
+
+TABLES_FORMAT = 1
+"Version of the resolved tables file, change when the tables change"
+
+tables = {}
+"Resolved resources for (syntax, name), see get_table()"
+
+user_settings_file = None
+"File my_zen_settings were loaded from"
+
+settings_generation = 0
+"Changes whenever settings that affect expanded output change"
+
+def settings_changed():
+	"""
+	Tells Zen Coding that vocabularies, profiles or variables were changed,
+	so that results computed from the old ones (like cached expansions) are
+	dropped
+	"""
+	global settings_generation
+	settings_generation += 1
+
 def is_parsed(obj):
 	"""
 	Check if specified resource is parsed by Zen Coding
@@ -221,6 +247,141 @@ def set_vocabulary(data, type):
 		vocabularies[VOC_SYSTEM] = data
 	else:
 		vocabularies[VOC_USER] = data
+	
+	tables.clear()
+	settings_changed()
+
+def _resolve(vocabulary, syntax, name):
+	"""
+	Merges resource collections of syntax and the ones it extends, earlier
+	ones in the chain taking precedence like in create_resource_chain()
+	lookups
+	@return: dict
+	"""
+	result = {}
+	for res in reversed(create_resource_chain(vocabulary, syntax, name)):
+		result.update(res)
+
+	return result
+
+def _build_table(syntax, name):
+	"""
+	Builds the resolved table of resource <code>name</code> for syntax:
+	user and system vocabularies and their inheritance chains merged into a
+	single dict, with abbreviations already parsed
+	@return: dict
+	"""
+	table = _resolve(VOC_SYSTEM, syntax, name)
+	for item, value in _resolve(VOC_USER, syntax, name).items():
+		# empty user values fall back to system ones
+		if value:
+			table[item] = value
+
+	if name == 'abbreviations':
+		for item, value in table.items():
+			if not is_parsed(value):
+				table[item] = parse_abbreviation(item, value)
+
+	return table
+
+def get_table(syntax, name):
+	"""
+	Returns resolved table of resource <code>name</code> for syntax, so
+	looking up an item in it is a single dict lookup. Tables are built on
+	first use and dropped when a vocabulary is replaced
+	@param syntax: Syntax name
+	@type syntax: str
+	@param name: Resource name ('snippets' or 'abbreviations')
+	@type name: str
+	@return: dict
+	"""
+	key = (syntax, name)
+	table = tables.get(key)
+	if table is None:
+		table = tables[key] = _build_table(syntax, name)
+
+	return table
+
+def _tables_file():
+	"""
+	Returns the file resolved tables are saved to, next to zen_settings.py
+	"""
+	path = sys.modules['zencoding.zen_settings'].__file__
+	return os.path.join(os.path.dirname(path), 'zen_settings.tables')
+
+def _settings_stamp():
+	"""
+	Returns what the saved tables depend on: the format and the size and
+	modification time of the settings files
+	@return: tuple
+	"""
+	stamp = [TABLES_FORMAT]
+	zen_settings_file = sys.modules['zencoding.zen_settings'].__file__
+	for path in (os.path.splitext(zen_settings_file)[0] + '.py', user_settings_file):
+		try:
+			st = os.stat(path)
+			stamp.append((path, st.st_size, st.st_mtime))
+		except (OSError, TypeError):
+			stamp.append(None)
+
+	return tuple(stamp)
+
+def load_tables(rebuild=False):
+	"""
+	Fills <code>tables</code> for every syntax from the file saved by an
+	earlier run, or builds them and saves the file if it's missing or was
+	made from other settings files. Saves parsing the abbreviations on each
+	start. Can't be used once vocabularies were changed in code
+	@param rebuild: Build the tables from the current vocabularies even if
+	the saved file looks up to date
+	@type rebuild: bool
+	"""
+	stamp = _settings_stamp()
+	path = _tables_file()
+
+	if rebuild:
+		saved_stamp = saved = None
+	else:
+		try:
+			fp = open(path, 'rb')
+			try:
+				saved_stamp, saved = marshal.load(fp)
+			finally:
+				fp.close()
+		except (IOError, EOFError, ValueError, TypeError):
+			saved_stamp = saved = None
+
+	if saved_stamp == stamp:
+		for key, table in saved.items():
+			if key[1] == 'abbreviations':
+				for item, value in table.items():
+					table[item] = Entry(*value)
+
+			tables[key] = table
+		return
+
+	saved = {}
+	for voc in (get_vocabulary(VOC_SYSTEM), get_vocabulary(VOC_USER)):
+		for syntax, res in voc.items():
+			if not isinstance(res, dict):
+				continue
+
+			for name in TABLE_RESOURCES:
+				table = get_table(syntax, name)
+				if name == 'abbreviations':
+					table = dict((item, (e.type, e.key, e.value)) for item, e in table.items())
+				saved[(syntax, name)] = table
+
+	try:
+		# write and rename, so readers never see half a file
+		fp = open(path + '.tmp', 'wb')
+		try:
+			marshal.dump((stamp, saved), fp)
+		finally:
+			fp.close()
+		os.rename(path + '.tmp', path)
+	except (IOError, OSError, ValueError):
+		pass
 
 def get_resource(syntax, name, item):
 	"""
@@ -232,6 +393,9 @@ def get_resource(syntax, name, item):
 	@param abbr: Abbreviation name
 	@type abbr: str name
 	"""
+	if name in TABLE_RESOURCES:
+		return get_table(syntax, name).get(item)
+
 	return get_parsed_item(VOC_USER, syntax, name, item) \
 		or get_parsed_item(VOC_SYSTEM, syntax, name, item)
 
@@ -341,30 +505,72 @@ class Entry:
 	def __repr__(self):
 		return 'Entry[type=%s, key=%s, value=%s]' % (self.type, self.key, self.value)
 
+def _load_user_settings():
+	"""
+	Loads settings from my_zen_settings module, looked up in user's home
+	folder first, then in <code>sys.path</code>
+	@return: dict or None
+	"""
+	global user_settings_file
+
+	user_settings_file = None
+	for path in ([os.path.expanduser('~')], None):
+		try:
+			fp, pathname, description = imp.find_module('my_zen_settings', path)
+		except ImportError:
+			continue
+
+		try:
+			module = imp.load_module('my_zen_settings', fp, pathname, description)
+			user_settings_file = pathname
+			return module.my_zen_settings
+		finally:
+			# Since we may exit via an exception, close fp explicitly.
+			if fp: fp.close()
+
+	return None
+
+def reload_settings():
+	"""
+	Reads zen_settings.py and my_zen_settings.py again and swaps in
+	vocabularies built from them. Vocabularies are replaced in one go, so
+	lookups see either old or new settings, never a mix of both. If any
+	of the files fails to load, the exception is raised and current
+	settings are kept
+	"""
+	global vocabularies, tables, zen_settings
+
+	old_module = sys.modules['zencoding.zen_settings']
+	path = os.path.splitext(old_module.__file__)[0] + '.py'
+
+	# a fresh module, so the old one stays intact if this one fails
+	module = imp.new_module(old_module.__name__)
+	module.__file__ = path
+	execfile(path, module.__dict__)
+
+	new_vocabularies = {
+		VOC_SYSTEM: module.zen_settings,
+		VOC_USER: _load_user_settings() or {}
+	}
+
+	sys.modules[module.__name__] = module
+	sys.modules['zencoding'].zen_settings = module
+	zen_settings = module.zen_settings
+	vocabularies, tables = new_vocabularies, {}
+	settings_changed()
+	load_tables(rebuild=True)
+
 # init vocabularies
 set_vocabulary(zen_settings, VOC_SYSTEM)
 user_settings = None
 
-# try to load settings from user's home folder
-fp = None
-
+# try to load settings from user's home folder or local module
 try:
-	fp, pathname, description = imp.find_module('my_zen_settings', [os.path.expanduser('~')])
-	module = imp.load_module('my_zen_settings', fp, pathname, description)
-	user_settings = module.my_zen_settings
+	user_settings = _load_user_settings()
 except:
 	pass
-finally:
-	# Since we may exit via an exception, close fp explicitly.
-	if fp: fp.close()
 
-if not user_settings:
-	# try to load local module
-	try:
-		from my_zen_settings import my_zen_settings
-		user_settings = my_zen_settings
-	except:
-		pass
-	
 if user_settings:
-	set_vocabulary(user_settings, VOC_USER)
\ No newline at end of file
+	set_vocabulary(user_settings, VOC_USER)
+
+load_tables()
@@ -24,18 +24,29 @@ Created on Apr 17, 2009
 
 @author: Sergey Chikuyonok (http://chikuyonok.ru)
 '''
+from cStringIO import StringIO
+import os
 import re
+import struct
 import zencoding
 import zencoding.resources as zen_resources
 import zencoding.parser.abbreviation as zen_parser
-import copy
 from zencoding.parser.utils import char_at
 
+try:
+	# native image probes provided by the Geany plugin, see src/zen-image.c
+	from geany import image_size as _native_image_size
+	from geany import image_file_size as _native_image_file_size
+except ImportError:
+	_native_image_size = _native_image_file_size = None
+
 newline = '\n'
 "Newline symbol"
 
 caret_placeholder = '{%::zen-caret::%}'
 
+# start of a ${variable} at the end of a string
+re_partial_var = re.compile(r'\$(\{[\w\-]*)?\Z')
 re_tag = re.compile(r'<\/?[\w:\-]+(?:\s+[\w\-:]+(?:\s*=\s*(?:(?:"[^"]*")|(?:\'[^\']*\')|[^>\s]+))?)*\s*(\/?)>$')
 
 profiles = {}
@@ -110,6 +121,7 @@ def setup_profile(name, options = {}):
 	@type options: dict
 	"""
 	profiles[name.lower()] = create_profile(options);
+	zen_resources.settings_changed()
 
 def get_newline():
 	"""
@@ -190,6 +202,33 @@ def replace_variables(text, vars=None):
 		
 	return re.sub(re_var, _repl, text)
 
+def chunk_output(pieces, chunk_size):
+	"""
+	Joins output strings into chunks of at least <code>chunk_size</code>
+	characters (but the last one) and replaces variables in them, never
+	splitting a variable between two chunks
+	@param pieces: Output strings, like <code>ZenNode.iter_output()</code>
+	@type chunk_size: int
+	@return: generator of str
+	"""
+	buf = []
+	size = 0
+	for piece in pieces:
+		buf.append(piece)
+		size += len(piece)
+		if size >= chunk_size:
+			text = ''.join(buf)
+			m = re_partial_var.search(text)
+			cut = m.start() if m else len(text)
+			if cut:
+				yield replace_variables(text[:cut])
+			buf = [text[cut:]]
+			size = len(buf[0])
+	
+	text = ''.join(buf)
+	if text:
+		yield replace_variables(text)
+
 def filter_node_name(name):
 	"""
 	Removes any unnecessary characters from node name
@@ -551,6 +590,7 @@ def set_caret_placeholder(value):
 	"""
 	global caret_placeholder
 	caret_placeholder = value
+	zen_resources.settings_changed()
 
 def apply_filters(tree, syntax, profile, additional_filters=None):
 	"""
@@ -645,6 +685,16 @@ def escape_text(text):
 	"""
 	return re.sub(r'([\$\|\\])', r'\\\1', text)
 
+def escape_output(text):
+	"""
+	Escapes backslashes in the output of expanded abbreviations, which the
+	filters have unescaped already, so that <code>replace_content()</code>
+	inserts them as they are. Tabstops and caret placeholders are kept
+	@type text: str
+	@return: str
+	"""
+	return text.replace('\\', '\\\\')
+
 def unescape_text(text):
 	"""
 	Unescapes special characters used in Zen Coding, like '$', '|', etc.
@@ -712,53 +762,208 @@ def prettify_number(num, fraction=2):
 def get_image_size(stream):
 	"""
 	Gets image size from image byte stream.
-	@author http://romeda.org/rePublish/
-	@param stream: Image byte stream (use <code>zen_file.read()</code>)
+	@param stream: Image byte stream
 	@type stream: str
-	@return: dict with <code>width</code> and <code>height</code> properties
+	@return: dict with <code>width</code> and <code>height</code> properties,
+	None for unknown image formats
 	""" 
-	png_magic_num = "\211PNG\r\n\032\n"
-	jpg_magic_num = "\377\330"
-	gif_magic_num = "GIF8"
-	pos = [0]
-	
-	def next_byte():
-		char = char_at(stream, pos[0])
-		pos[0] += 1
-		return ord(char)
-
-	if stream.startswith(png_magic_num):
-		# PNG. Easy peasy.
-		pos[0] = stream.find('IHDR') + 4
-	
-		return {
-			'width':  (next_byte() << 24) | (next_byte() << 16) | (next_byte() <<  8) | next_byte(),
-			'height': (next_byte() << 24) | (next_byte() << 16) | (next_byte() <<  8) | next_byte()
-		}
-	
-	elif stream.startswith(gif_magic_num):
-		pos[0] = 6
-	
-		return {
-			'width': next_byte() | (next_byte() << 8),
-			'height': next_byte() | (next_byte() << 8)
-		}
-	
-	elif stream.startswith(jpg_magic_num):
-		hex_list = ["%02X" % ord(ch) for ch in stream]
-		
-		for k in range(len(hex_list) - 1):
-			if hex_list[k] == 'FF' and (hex_list[k + 1] == 'C0' or hex_list[k + 1] == 'C2'):
-				#print k, hex(k)  # test
-				return {
-					'height': int(hex_list[k + 5], 16) * 256 + int(hex_list[k + 6], 16),
-					'width': int(hex_list[k + 7], 16) * 256 + int(hex_list[k + 8], 16)
-				}
+	if _native_image_size:
+		return _native_image_size(stream)
+	
+	return _probe_image(StringIO(stream))
+
+_image_sizes = {}
+"Image sizes by file path, with the modification time and size of the file"
+
+def get_image_file_size(path):
+	"""
+	Gets image size from image file, reading only its headers. Sizes are
+	cached until the file changes.
+	@param path: Image file path
+	@type path: str
+	@return: dict with <code>width</code> and <code>height</code> properties,
+	None for unknown image formats or unreadable files
+	""" 
+	try:
+		st = os.stat(path)
+	except OSError:
+		_image_sizes.pop(path, None)
+		return None
+	
+	stamp = (st.st_mtime, st.st_size)
+	cached = _image_sizes.get(path)
+	if cached and cached[0] == stamp:
+		return cached[1] and dict(cached[1])
+	
+	if _native_image_file_size:
+		size = _native_image_file_size(path)
 	else:
-		return {
-			'width': -1,
-			'height': -1
-		}
+		try:
+			fp = open(path, 'rb')
+		except IOError:
+			return None
+		
+		try:
+			size = _probe_image(fp)
+		finally:
+			fp.close()
+	
+	_image_sizes[path] = (stamp, size)
+	return size and dict(size)
+
+def _image_size(width, height):
+	return {'width': width, 'height': height}
+
+def _probe_image(fp):
+	"""
+	Reads image size from the headers of PNG, GIF, JPEG, WebP, BMP and SVG
+	images
+	@param fp: Image file object
+	@return: dict with <code>width</code> and <code>height</code> properties
+	"""
+	header = fp.read(32)
+	
+	if header.startswith('\211PNG\r\n\032\n'):
+		# IHDR should be the first chunk, but some encoders put others first
+		pos = 8
+		for i in range(9):
+			fp.seek(pos)
+			chunk = fp.read(16)
+			if len(chunk) < 16:
+				break
+			if chunk[4:8] == 'IHDR':
+				return _image_size(*struct.unpack('>ii', chunk[8:16]))
+			pos += 12 + struct.unpack('>I', chunk[0:4])[0]
+	
+	elif header.startswith('GIF8') and len(header) >= 10:
+		return _image_size(*struct.unpack('<HH', header[6:10]))
+	
+	elif header.startswith('\377\330'):
+		return _probe_jpeg(fp)
+	
+	elif header.startswith('RIFF') and header[8:12] == 'WEBP' and len(header) >= 30:
+		return _probe_webp(header)
+	
+	elif header.startswith('BM') and len(header) >= 26:
+		if struct.unpack('<I', header[14:18])[0] == 12:
+			# OS/2 bitmaps have 16 bit sizes
+			return _image_size(*struct.unpack('<HH', header[18:22]))
+		
+		# height is negative for top-down bitmaps
+		width, height = struct.unpack('<ii', header[18:26])
+		return _image_size(abs(width), abs(height))
+	
+	elif (header[3:] if header.startswith('\357\273\277') else header).lstrip().startswith('<'):
+		# markup, maybe after a byte order mark
+		fp.seek(0)
+		return _probe_svg(fp.read(65536))
+	
+	return None
+
+def _probe_jpeg(fp):
+	"Walks JPEG segments up to the first frame header"
+	pos = 2
+	while True:
+		fp.seek(pos)
+		if fp.read(1) != '\377':
+			return None
+		
+		# markers can be padded with any number of 0xFF
+		marker = fp.read(1)
+		while marker == '\377':
+			marker = fp.read(1)
+		
+		if not marker:
+			return None
+		
+		marker = ord(marker)
+		if marker == 0x01 or 0xD0 <= marker <= 0xD7:
+			# no length
+			pos = fp.tell()
+			continue
+		
+		if marker == 0xD9 or marker == 0xDA:
+			# image data starts before any frame header
+			return None
+		
+		if 0xC0 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC):
+			# length, precision, height and width
+			data = fp.read(7)
+			if len(data) < 7:
+				return None
+			height, width = struct.unpack('>HH', data[3:7])
+			return _image_size(width, height)
+		
+		data = fp.read(2)
+		if len(data) < 2 or struct.unpack('>H', data)[0] < 2:
+			return None
+		pos = fp.tell() - 2 + struct.unpack('>H', data)[0]
+
+def _probe_webp(header):
+	chunk = header[12:16]
+	if chunk == 'VP8 ':
+		if header[23:26] != '\x9d\x01\x2a':
+			return None
+		width, height = struct.unpack('<HH', header[26:30])
+		return _image_size(width & 0x3FFF, height & 0x3FFF)
+	
+	if chunk == 'VP8L':
+		if header[20] != '\x2f':
+			return None
+		b = [ord(ch) for ch in header[21:25]]
+		return _image_size(1 + (((b[1] & 0x3F) << 8) | b[0]),
+				1 + (((b[3] & 0x0F) << 10) | (b[2] << 2) | ((b[1] & 0xC0) >> 6)))
+	
+	if chunk == 'VP8X':
+		b = [ord(ch) for ch in header[24:30]]
+		return _image_size(1 + (b[0] | (b[1] << 8) | (b[2] << 16)),
+				1 + (b[3] | (b[4] << 8) | (b[5] << 16)))
+	
+	return None
+
+re_svg_tag = re.compile(r'<svg((?:\s(?:[^>"\']|"[^"]*"|\'[^\']*\')*)?)>')
+re_svg_attr = re.compile(r'\s([\w:\-]+)\s*=\s*(?:"([^"]*)"|\'([^\']*)\')')
+
+def _svg_length(value):
+	"Parses length in user units, which are pixels"
+	value = value.strip()
+	if value.endswith('px'):
+		value = value[:-2]
+	
+	try:
+		num = float(value)
+		if num >= 0:
+			return int(num + 0.5)
+	except (ValueError, OverflowError):
+		pass
+	
+	return None
+
+def _probe_svg(text):
+	"Reads size from the attributes of the <svg> element"
+	m = re_svg_tag.search(text)
+	if not m:
+		return None
+	
+	attrs = {}
+	for attr in re_svg_attr.finditer(m.group(1) or ''):
+		attrs.setdefault(attr.group(1), attr.group(2) if attr.group(2) is not None else attr.group(3))
+	
+	width = _svg_length(attrs.get('width', ''))
+	height = _svg_length(attrs.get('height', ''))
+	
+	# relative sizes depend on the page, use the size of the drawing
+	view_box = re.split(r'[\s,]+', attrs.get('viewBox', '').strip())
+	if len(view_box) >= 4:
+		if width is None:
+			width = _svg_length(view_box[2])
+		if height is None:
+			height = _svg_length(view_box[3])
+	
+	if width is None or height is None:
+		return None
+	
+	return _image_size(width, height)
 
 def get_counter_for_node(node):
 	"""
@@ -854,6 +1059,13 @@ def process_text_before_paste(text, escape_fn, tabstop_fn):
 	return ''.join(str_builder)
 
 class Tag(object):
+	# fixed attribute set, so the thousands of tags a multiplied
+	# abbreviation creates don't each carry a __dict__
+	__slots__ = ('name', 'real_name', 'count', '__abbr', 'syntax', '__content',
+				'__paste_content', 'repeat_by_lines', 'is_repeating', 'parent',
+				'children', 'attributes', '__attr_hash', 'multiply_elem', 'last',
+				'has_implicit_name', 'filters')
+	
 	def __init__(self, node, syntax='html'):
 		"""
 		@param node: Parsed tree node
@@ -876,6 +1088,7 @@ class Tag(object):
 		self.__attr_hash = {}
 		self.multiply_elem = None
 		self.last = None
+		self.filters = None
 		self.has_implicit_name = node is not None and node.has_implicit_name
 		
 		if node:
@@ -968,10 +1181,11 @@ class Tag(object):
 		
 	def set_paste_content(self, val):
 		"""
-		Set content that should be pasted to the output
+		Set content that should be pasted to the output, escaped already
+		like <code>paste_content()</code> takes it
 		@type val: str
 		"""
-		self.__paste_content = escape_text(val)
+		self.__paste_content = val
 	
 	def get_paste_content(self):
 		"""
@@ -1001,6 +1215,8 @@ class Tag(object):
 		return self.__abbr
 	
 class Snippet(Tag):
+	__slots__ = ('value',)
+	
 	def __init__(self, node, syntax='html'):
 		super(Snippet, self).__init__(node, syntax)
 		self.value = replace_unescaped_symbol(get_snippet(syntax, self.name), '|', get_caret_placeholder())
@@ -1016,6 +1232,11 @@ class ZenNode(object):
 	"""
 	Creates simplified tag from Zen Coding tag
 	"""
+	__slots__ = ('type', 'name', 'real_name', 'children', 'counter',
+				'has_implicit_name', 'is_repeating', 'repeat_by_lines',
+				'attributes', 'source', 'parent', 'next_sibling',
+				'previous_sibling', 'start', 'end', 'content', 'padding')
+	
 	def __init__(self, tag):
 		"""
 		@type tag: Tag
@@ -1023,19 +1244,19 @@ class ZenNode(object):
 		self.type = 'snippet' if isinstance(tag, Snippet) else 'tag'
 		self.name = tag.name
 		self.real_name = tag.real_name
-		self.children = [];
+		self.children = []
 		self.counter = 1
 		self.has_implicit_name = tag.has_implicit_name
 		self.is_repeating = tag.is_repeating
 		self.repeat_by_lines = tag.repeat_by_lines
 		
-		# create deep copy of attribute list so we can change
-		# their values in runtime without affecting other nodes
-		# created from the same tag
-		self.attributes = copy.deepcopy(tag.attributes)
+		# copy attribute list so we can change their values in runtime
+		# without affecting other nodes created from the same tag;
+		# attributes only hold strings, so copying each dict is enough
+		self.attributes = [dict(a) for a in tag.attributes]
 		
+		# source element from which current tag was created
 		self.source = tag
-		"Source element from which current tag was created"
 		
 		# relations
 		self.parent = None
@@ -1150,8 +1371,20 @@ class ZenNode(object):
 	
 	def to_string(self):
 		"@return {String}"
-		content = ''.join([item.to_string() for item in self.children])
-		return self.start + self.content + content + self.end
+		return ''.join(self.iter_output())
+	
+	def iter_output(self):
+		"""
+		Yields output strings of current element and its children in the
+		order they appear in <code>to_string()</code>
+		@return: generator of str
+		"""
+		yield self.start
+		yield self.content
+		for item in self.children:
+			for text in item.iter_output():
+				yield text
+		yield self.end
 	
 	def __str__(self):
 		return self.to_string()